@@ -186,6 +186,21 @@ TEST_F(CentralTest, ServicePermission) {
     ASSERT_EQ(central.listServicePermissions(pubKey2.hash()).size(), 0u);
 }
 
+TEST_F(CentralTest, VerifyRemembersSignatures) {
+    auto pubKey(central.getPublicKey());
+    auto hash(Mist::CryptoHelper::SHA3::fromString("HLlZ+hhZIx0OppsWjOCiyjjD3Sj18UrRe9bAjbYntLE="));
+    auto other(Mist::CryptoHelper::SHA3::fromString("AAlZ+hhZIx0OppsWjOCiyjjD3Sj18UrRe9bAjbYntLE="));
+    auto sig(central.sign(hash));
+
+    EXPECT_TRUE(central.verify(pubKey, hash, sig));
+    // Answered from the verified signatures
+    EXPECT_TRUE(central.verify(pubKey, hash, sig));
+    // A remembered hash does not make another signature valid
+    EXPECT_FALSE(central.verify(pubKey, hash, central.sign(other)));
+    EXPECT_FALSE(central.verify(pubKey, other, sig));
+    EXPECT_TRUE(central.verify(pubKey, hash, sig));
+}
+
 // TEST_F(CentralTest, AddressLookupServers) {
 //     LOG(INFO) << "Test Central AddressLookupServers";
 //     central.addAddressLookupServer("www.hej.se", 8080);
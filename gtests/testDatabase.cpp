@@ -4,10 +4,17 @@
  * Free software licensed under GPLv3.
  */
 
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "Helper.h"
 #include "Database.h"
+#include "Query.h"
 #include "gtest/gtest.h"
 
 namespace M = Mist;
@@ -21,6 +28,51 @@ TEST(ManifestTest, TODO_TestAllMethods) {
     // TODO: Do this.
 }
 
+TEST(SketchTest, DecodeDifference) {
+    std::mt19937 rng( 4711 );
+    auto randomHash = [&rng]() -> M::CryptoHelper::SHA3 {
+        std::vector<std::uint8_t> hash( 32 );
+        for ( auto& b : hash ) {
+            b = static_cast<std::uint8_t>( rng() );
+        }
+        return M::CryptoHelper::SHA3( hash );
+    };
+    std::vector<M::CryptoHelper::SHA3> onlyA{}, onlyB{};
+    M::Database::Sketch a( 96 ), b( 96 ), small( 6 );
+    for ( int i = 0; i < 1000; ++i ) {
+        M::CryptoHelper::SHA3 hash{ randomHash() };
+        a.insert( hash );
+        b.insert( hash );
+    }
+    for ( int i = 0; i < 10; ++i ) {
+        onlyA.push_back( randomHash() );
+        a.insert( onlyA.back() );
+    }
+    for ( int i = 0; i < 5; ++i ) {
+        onlyB.push_back( randomHash() );
+        b.insert( onlyB.back() );
+    }
+    for ( int i = 0; i < 20; ++i ) {
+        small.insert( randomHash() );
+    }
+
+    M::Database::Sketch difference{ M::Database::Sketch::fromString( a.toString() ) };
+    EXPECT_EQ( 96u, difference.size() );
+    difference.subtract( M::Database::Sketch::fromString( b.toString() ) );
+    std::vector<M::CryptoHelper::SHA3> here{}, there{};
+    ASSERT_TRUE( difference.decode( here, there ) );
+    std::sort( onlyA.begin(), onlyA.end() );
+    std::sort( onlyB.begin(), onlyB.end() );
+    std::sort( here.begin(), here.end() );
+    std::sort( there.begin(), there.end() );
+    EXPECT_EQ( onlyA, here );
+    EXPECT_EQ( onlyB, there );
+
+    // Too many differences for the number of cells
+    EXPECT_FALSE( small.decode( here, there ) );
+    EXPECT_THROW( a.subtract( small ), std::invalid_argument );
+}
+
 TEST(ObjectRefTest, TODO_TestSort) {
     LOG( INFO ) << "TODO: Test sorting object references";
     // TODO: Do this.
@@ -183,3 +235,278 @@ TEST_F(DatabaseTest, Close) {
     ASSERT_TRUE( db.isOK() );
 }
 
+
+class VersionDatabase : public M::Database {
+public:
+    VersionDatabase( M::Central* c, const std::string& path ) : M::Database( c, path ) {}
+    virtual ~VersionDatabase() = default;
+
+    using M::Database::reorderTransaction;
+    using M::Database::getTransactionMeta;
+    using M::Database::toBlob;
+    using M::Database::db;
+};
+
+TEST_F(DatabaseTest, MigrateDenseVersions) {
+    LOG( INFO ) << "Test migrating a database with dense versions";
+    db.create( 0, nullptr );
+    db.close();
+    {
+        M::Database::Connection conn( p.string(), M::Helper::Database::OPEN_READWRITE );
+        for ( const char* index : { "transaction_hash_index", "transaction_version_index", "transaction_timestamp_index",
+                "transaction_parent_version_index", "transaction_parent_parent_version_index",
+                "object_version_index", "attribute_version_index", "renumber_version_index" } ) {
+            conn.exec( std::string( "DROP INDEX " ) + index );
+        }
+        conn.exec( "DROP TABLE ObjectHead" );
+        M::Database::Statement insert( conn,
+                "INSERT INTO 'Transaction' (accessDomain, version, timestamp, userHash, hash, signature) "
+                "VALUES (2, ?, ?, '', ?, '')" );
+        for ( unsigned version : { 1u, 2u, 3u } ) {
+            insert << version << "2017-01-01 00:00:0" + std::to_string( version ) + ".000"
+                    << M::CryptoHelper::SHA3( std::vector<std::uint8_t>( 32, version ) ).toString();
+            insert.exec();
+            insert.reset();
+            insert.clearBindings();
+        }
+        conn.exec( "INSERT INTO TransactionParent (accessDomain, version, parentAccessDomain, parentVersion) VALUES "
+                "(2, 2, 2, 1), (2, 3, 2, 2)" );
+        conn.exec( "INSERT INTO Object (accessDomain, id, version, status, parent, parentAccessDomain, transactionAction) VALUES "
+                "(2, 2000, 1, 11, 0, 2, 1), (2, 2000, 2, 1, 0, 2, 2)" );
+        conn.exec( "PRAGMA user_version=0" );
+    }
+
+    ASSERT_NO_THROW( db2.init() );
+    db2.close();
+
+    M::Database::Connection conn( p.string(), M::Helper::Database::OPEN_READONLY );
+    EXPECT_EQ( M::Database::SCHEMA_VERSION, conn.execAndGet( "PRAGMA user_version" ).getInt() );
+    M::Database::Statement transactions( conn, "SELECT version FROM 'Transaction' ORDER BY version" );
+    for ( unsigned version : { 1u, 2u, 3u } ) {
+        ASSERT_TRUE( transactions.executeStep() );
+        EXPECT_EQ( version * M::Database::VERSION_STRIDE, transactions.getColumn( "version" ).getUInt() );
+    }
+    M::Database::Statement parents( conn, "SELECT version, parentVersion FROM TransactionParent ORDER BY version" );
+    ASSERT_TRUE( parents.executeStep() );
+    EXPECT_EQ( 2 * M::Database::VERSION_STRIDE, parents.getColumn( "version" ).getUInt() );
+    EXPECT_EQ( 1 * M::Database::VERSION_STRIDE, parents.getColumn( "parentVersion" ).getUInt() );
+    M::Database::Statement objects( conn, "SELECT MAX(version) AS version FROM Object WHERE id=2000" );
+    ASSERT_TRUE( objects.executeStep() );
+    EXPECT_EQ( 2 * M::Database::VERSION_STRIDE, objects.getColumn( "version" ).getUInt() );
+    M::Database::Statement head( conn, "SELECT version, status FROM ObjectHead WHERE id=2000" );
+    ASSERT_TRUE( head.executeStep() );
+    EXPECT_EQ( 2 * M::Database::VERSION_STRIDE, head.getColumn( "version" ).getUInt() );
+    EXPECT_EQ( static_cast<int>( M::Database::ObjectStatus::Current ), head.getColumn( "status" ).getInt() );
+    EXPECT_FALSE( head.executeStep() );
+}
+
+TEST_F(DatabaseTest, MigrateTextHashes) {
+    LOG( INFO ) << "Test migrating a database with base64 hashes and signatures";
+    const M::CryptoHelper::SHA3 hash{ std::vector<std::uint8_t>( 32, 7 ) };
+    const M::CryptoHelper::SHA3 userHash{ std::vector<std::uint8_t>( 32, 9 ) };
+    const M::CryptoHelper::Signature signature{ std::vector<std::uint8_t>( 64, 5 ) };
+    db.create( 0, nullptr );
+    db.close();
+    {
+        M::Database::Connection conn( p.string(), M::Helper::Database::OPEN_READWRITE );
+        conn.exec( "DROP TABLE ObjectHead" );
+        conn.exec( "DROP TABLE 'Transaction'" );
+        conn.exec( "CREATE TABLE 'Transaction' (accessDomain INTEGER, version INTEGER, timestamp DATETIME, userHash TEXT, hash TEXT, signature TEXT, "
+                "PRIMARY KEY ( accessDomain, version ) ) " );
+        M::Database::Statement insert( conn,
+                "INSERT INTO 'Transaction' (accessDomain, version, timestamp, userHash, hash, signature) "
+                "VALUES (2, 256, '2017-01-01 00:00:00.000', ?, ?, ?)" );
+        insert << userHash.toString() << hash.toString() << signature.toString();
+        insert.exec();
+        conn.exec( "PRAGMA user_version=1" );
+    }
+
+    VersionDatabase vdb( nullptr, p.string() );
+    ASSERT_NO_THROW( vdb.init() );
+    EXPECT_EQ( M::Database::SCHEMA_VERSION, vdb.db->execAndGet( "PRAGMA user_version" ).getInt() );
+    EXPECT_EQ( "blob", vdb.db->execAndGet( "SELECT typeof(hash) FROM 'Transaction'" ).getString() );
+    EXPECT_EQ( 32, vdb.db->execAndGet( "SELECT length(hash) FROM 'Transaction'" ).getInt() );
+
+    M::Database::Transaction meta{ vdb.getTransactionMeta( hash ) };
+    EXPECT_EQ( 256u, meta.version );
+    EXPECT_TRUE( hash == meta.hash );
+    EXPECT_TRUE( userHash == meta.creatorHash );
+    EXPECT_EQ( signature.toString(), meta.signature.toString() );
+    EXPECT_EQ( 256u, vdb.getTransactionMeta( hash.toString() ).version );
+
+    // The hash index is unique
+    M::Database::Statement duplicate( *vdb.db,
+            "INSERT INTO 'Transaction' (accessDomain, version, timestamp, userHash, hash, signature) "
+            "VALUES (2, 512, '2017-01-01 00:00:01.000', NULL, ?, NULL)" );
+    duplicate << VersionDatabase::toBlob( hash );
+    EXPECT_THROW( duplicate.exec(), M::Helper::Database::Exception );
+}
+
+TEST_F(DatabaseTest, ReorderOlderTransactions) {
+    LOG( INFO ) << "Test reordering transactions received out of order";
+    db.create( 0, nullptr );
+    db.close();
+
+    VersionDatabase vdb( nullptr, p.string() );
+    vdb.init();
+
+    // Every transaction is older than the previous ones, which uses up the
+    // gap below the first transaction and forces the versions to be spread out.
+    const unsigned count{ 40 };
+    for ( unsigned i = 0; i < count; ++i ) {
+        M::Database::Statement maxVersion( *vdb.db,
+                "SELECT IFNULL(MAX(version),0)+? AS version FROM 'Transaction'" );
+        maxVersion << M::Database::VERSION_STRIDE;
+        ASSERT_TRUE( maxVersion.executeStep() );
+        unsigned version{ maxVersion.getColumn( "version" ).getUInt() };
+
+        char timestamp[32];
+        std::snprintf( timestamp, sizeof( timestamp ), "2017-01-01 00:%02u:00.000", count - i );
+        M::Database::Statement insert( *vdb.db,
+                "INSERT INTO 'Transaction' (accessDomain, version, timestamp, userHash, hash, signature) "
+                "VALUES (2, ?, ?, NULL, ?, NULL)" );
+        insert << version << std::string( timestamp )
+                << VersionDatabase::toBlob( M::CryptoHelper::SHA3( std::vector<std::uint8_t>( 32, i ) ) );
+        insert.exec();
+
+        unsigned newVersion{ vdb.reorderTransaction( vdb.getTransactionMeta( version ) ) };
+        EXPECT_EQ( std::string( timestamp ), vdb.getTransactionMeta( newVersion ).date.toString() );
+    }
+
+    M::Database::Statement ordered( *vdb.db,
+            "SELECT version, timestamp FROM 'Transaction' ORDER BY version ASC" );
+    std::string last;
+    unsigned rows{ 0 };
+    while ( ordered.executeStep() ) {
+        std::string timestamp{ ordered.getColumn( "timestamp" ).getString() };
+        EXPECT_LT( last, timestamp );
+        last = timestamp;
+        ++rows;
+    }
+    EXPECT_EQ( count, rows );
+}
+
+TEST_F(DatabaseTest, StatementCache) {
+    LOG( INFO ) << "Test reusing prepared statements";
+    db.create( 0, nullptr );
+    db.close();
+
+    VersionDatabase vdb( nullptr, p.string() );
+    vdb.init();
+    M::Database::Connection& connection{ *vdb.db };
+    const std::string sql{ "SELECT ? AS value" };
+    unsigned long long hits{ connection.getStatementCacheHits() };
+    unsigned long long misses{ connection.getStatementCacheMisses() };
+
+    for ( int i = 0; i < 10; ++i ) {
+        M::Database::CachedStatement statement( connection, sql );
+        statement << i;
+        ASSERT_TRUE( statement.executeStep() );
+        EXPECT_EQ( i, statement.getColumn( "value" ).getInt() );
+    }
+    EXPECT_EQ( misses + 1, connection.getStatementCacheMisses() );
+    EXPECT_EQ( hits + 9, connection.getStatementCacheHits() );
+
+    // A borrowed statement is not handed out twice
+    {
+        M::Database::CachedStatement outer( connection, sql );
+        M::Database::CachedStatement inner( connection, sql );
+        outer << 1;
+        inner << 2;
+        ASSERT_TRUE( outer.executeStep() );
+        ASSERT_TRUE( inner.executeStep() );
+        EXPECT_EQ( 1, outer.getColumn( "value" ).getInt() );
+        EXPECT_EQ( 2, inner.getColumn( "value" ).getInt() );
+    }
+    EXPECT_EQ( misses + 2, connection.getStatementCacheMisses() );
+
+    // Bindings are cleared when the statement is handed back
+    {
+        M::Database::CachedStatement statement( connection, sql );
+        ASSERT_TRUE( statement.executeStep() );
+        EXPECT_TRUE( statement.getColumn( "value" ).isNull() );
+    }
+
+    // The cache is shared by the threads using the connection
+    hits = connection.getStatementCacheHits();
+    misses = connection.getStatementCacheMisses();
+    const int threads{ 8 }, uses{ 5000 };
+    std::vector<std::thread> workers{};
+    std::vector<int> wrong( threads, 0 );
+    for ( int t = 0; t < threads; ++t ) {
+        workers.emplace_back( [&, t]() -> void {
+            for ( int i = 0; i < uses; ++i ) {
+                M::Database::CachedStatement statement( connection, sql );
+                statement << t * uses + i;
+                if ( !statement.executeStep() || t * uses + i != statement.getColumn( "value" ).getInt() ) {
+                    ++wrong.at( t );
+                }
+            }
+        } );
+    }
+    for ( std::thread& worker : workers ) {
+        worker.join();
+    }
+    EXPECT_EQ( std::vector<int>( threads, 0 ), wrong );
+    EXPECT_EQ( hits + misses + threads * uses,
+            connection.getStatementCacheHits() + connection.getStatementCacheMisses() );
+
+    // Database methods reuse their statements
+    hits = connection.getStatementCacheHits();
+    for ( int i = 0; i < 3; ++i ) {
+        EXPECT_ANY_THROW( vdb.getTransactionMeta( 4711 ) );
+    }
+    EXPECT_LE( hits + 2, connection.getStatementCacheHits() );
+}
+
+TEST_F(DatabaseTest, QueryPlansUseIndexes) {
+    LOG( INFO ) << "Test that generated queries do not scan the object tables";
+    db.create( 0, nullptr );
+    db.close();
+
+    VersionDatabase vdb( nullptr, p.string() );
+    vdb.init();
+
+    std::map<std::string,M::ArgumentVT> args;
+    args.emplace( "max", 17.0 );
+    const std::string filter{ "(a.max>o.len||o.cow==true) && 'hej' == o.name && o.width < 17" };
+
+    // Every query should find its rows by parent or id
+    std::vector<M::Query> queries( 20 );
+    queries[0].parseQuery( 2, 100, "", filter, "", args, 0, false );
+    queries[1].parseQuery( 2, 100, "", filter, "o.name", args, 0, true );
+    queries[2].parseQuery( 2, 100, "o.len,o.name", filter, "", args, 0, false );
+    queries[3].parseQuery( 2, 100, "sum(o.len)", filter, "", args, 0, false );
+    queries[4].parseQuery( 2, 100, "count(o.len)", filter, "", args, 0, false );
+    queries[5].parseQuery( 2, 100, "", filter, "o.name", args, 17, false );
+    queries[6].parseQuery( 2, 100, "", filter, "", args, 17, true );
+    queries[7].parseQuery( 2, 100, "sum(o.len)", filter, "", args, 17, false );
+    queries[8].parseQuery( 2, 100, "", "", "", args, 17, false );
+    queries[9].parseQuery( 2, 100, "sum(o.len)", "", "", args, 17, false );
+    queries[10].parseVersionQuery( 2, 100, "", filter, args, false );
+    queries[11].parseVersionQuery( 2, 100, "o.len", filter, args, true );
+    queries[12].parseVersionQuery( 2, 100, "sum(o.len)", filter, args, false );
+    queries[13].parseVersionQuery( 2, 100, "count(o.len)", filter, args, false );
+    queries[14].parseQuery( 2, 100, "", filter, "", args, 0, false, 50, true );
+    queries[15].parseQuery( 2, 100, "o.len", filter, "o.name", args, 0, false, 50, true );
+    queries[16].parseQuery( 2, 100, "", "", "", args, 0, false );
+    queries[17].parseQuery( 2, 100, "o.len", "", "o.name", args, 0, true );
+    queries[18].parseQuery( 2, 100, "", "", "", args, 0, false, 50, true );
+    queries[19].parseQuery( 2, 100, "o.len", "", "desc(o.name)", args, 0, false, 50, true );
+
+    for ( const M::Query& query : queries ) {
+        M::Database::Statement plan( *vdb.db, "EXPLAIN QUERY PLAN " + query.getSqlQuery() );
+        while ( plan.executeStep() ) {
+            // "SCAN TABLE Object AS o" in older versions of SQLite, "SCAN o" in newer
+            std::string detail{ plan.getColumn( "detail" ).getString() };
+            bool subquery{ std::string::npos != detail.find( "SUBQUERY" )
+                    || std::string::npos != detail.find( "subquery" )
+                    || std::string::npos != detail.find( "CONSTANT ROW" ) };
+            EXPECT_FALSE( 0 == detail.find( "SCAN " ) && !subquery )
+                    << detail << "\n" << query.getSqlQuery();
+            // Searching on the access domain alone visits every object in it
+            EXPECT_EQ( std::string::npos, detail.find( "(accessDomain=?)" ) )
+                    << detail << "\n" << query.getSqlQuery();
+        }
+    }
+}
@@ -4,12 +4,17 @@
  * Free software licensed under GPLv3.
  */
 
+#include <atomic>
 #include <exception>
+#include <future>
+#include <sstream>
+#include <thread>
 
 #include <gtest/gtest.h> // Google test framework
 
 #include "Exception.h"
 #include "Database.h"
+#include "ExchangeFormat.h"
 #include "Transaction.h"
 
 namespace { // Anonymous namespace
@@ -25,6 +30,7 @@ using AD = M::Database::AccessDomain;
 using V = M::Database::Value;
 using VT = M::Database::Value::Type;
 using QR = M::Database::QueryResult;
+using QD = M::Database::QueryDelta;
 
 void removeTestDb( const FS::path &p ) {
     LOG ( INFO ) << "Removing db: " << p;
@@ -60,6 +66,8 @@ public:
 
     using M::Database::beginTransaction;
     using M::Database::beginRemoteTransaction;
+    using M::Database::db;
+    using M::Database::mapTransactions;
 };
 
 class TransactionTest: public ::testing::Test {
@@ -198,8 +206,16 @@ TEST_F( TransactionTest, DeleteObjects ) {
 }
 
 TEST_F( TransactionTest, QueryAndSubscribeToObject ) {
+    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    unsigned long parent{ t->newObject( { AD::Normal, 0 }, { { "name", V( "query" ) } } ) };
+    for ( int i = 0; i < 60; ++i ) {
+        t->newObject( { AD::Normal, parent }, { { "i", V( i ) } } );
+    }
+    t->commit();
+    t.reset();
+
     std::map<std::string,V> args{};
-    QR qr{ db.query( static_cast<int>( AD::Normal ), 0, "", "", "", args, 0, false ) }; // Get all objects
+    QR qr{ db.query( static_cast<int>( AD::Normal ), parent, "", "", "", args, 0, false ) }; // Get the children
     EXPECT_FALSE( qr.isFunctionCall ); // Not function call?
     EXPECT_LT( 0u, qr.objects.size() ); // Got some objects?
     O& changeThis{ qr.objects.at( 50 ) }; // Save ref to object
@@ -217,7 +233,7 @@ TEST_F( TransactionTest, QueryAndSubscribeToObject ) {
             changeThis.id,
             false );
 
-    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    t = std::move( db.beginTransaction() );
     t->moveObject( changeThis.id, { AD::Normal, 0 } ); // Make last as leaf to root
     t->commit();
     EXPECT_EQ( o.id, changeThis.id ); // Expect this to have changed
@@ -225,19 +241,27 @@ TEST_F( TransactionTest, QueryAndSubscribeToObject ) {
 }
 
 TEST_F( TransactionTest, SubscribeToQuery ) {
+    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    unsigned long parent{ t->newObject( { AD::Normal, 0 }, { { "name", V( "subscribe" ) } } ) };
+    for ( int i = 0; i < 30; ++i ) {
+        t->newObject( { AD::Normal, parent }, { { "i", V( i ) } } );
+    }
+    t->commit();
+    t.reset();
+
     bool gotCb{ false };
     std::map<std::string,V> args{};
 
-    // Sub to all objects
+    // Sub to the children
     unsigned subId = db.subscribeQuery(
             [&gotCb](QR) -> void {
                 gotCb = true;
             },
-            static_cast<int>( AD::Normal ), 0, "", "", "", args, 0, false
+            static_cast<int>( AD::Normal ), parent, "", "", "", args, 0, false
     );
 
-    // Get all objects
-    QR qr{ db.query( static_cast<int>( AD::Normal ), 0, "", "", "", args, 0, false ) }; // Get all objects
+    // Get the children
+    QR qr{ db.query( static_cast<int>( AD::Normal ), parent, "", "", "", args, 0, false ) }; // Get the children
     EXPECT_FALSE( qr.isFunctionCall ); // Not function call?
     EXPECT_LT( 0u, qr.objects.size() ); // Got some objects?
     O& changeThis{ qr.objects.at( 25 ) }; // Save ref to object
@@ -247,7 +271,7 @@ TEST_F( TransactionTest, SubscribeToQuery ) {
     EXPECT_NE( o.id, changeThis.id ); // First != ref ?
 
     // Change ref
-    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    t = std::move( db.beginTransaction() );
     t->moveObject( changeThis.id, { AD::Normal, 0 } ); // Make last as leaf to root
     t->commit();
 
@@ -256,6 +280,982 @@ TEST_F( TransactionTest, SubscribeToQuery ) {
     db.unsubscribe( subId );
 }
 
+TEST_F( TransactionTest, ObjectHeadFollowsUpdates ) {
+    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    unsigned long id{ t->newObject( { AD::Normal, 0 }, { { "count", V( 0 ) } } ) };
+    t->commit();
+    t.reset();
+
+    for ( int i = 1; i <= 5; ++i ) {
+        t = std::move( db.beginTransaction() );
+        t->updateObject( id, { { "count", V( i ) } } );
+        // The transaction sees its own change before it is committed
+        EXPECT_EQ( i, t->getObject( static_cast<int>( AD::Normal ), id ).attributes.at( "count" ).n );
+        t->commit();
+        t.reset();
+    }
+
+    O o{ db.getObject( static_cast<int>( AD::Normal ), id ) };
+    EXPECT_EQ( 5, o.attributes.at( "count" ).n );
+    EXPECT_EQ( db.db->execAndGet( "SELECT MAX(version) FROM Object WHERE id=" + std::to_string( id ) ).getUInt(),
+            o.version );
+
+    // An object created, read and deleted in one transaction leaves no head
+    t = std::move( db.beginTransaction() );
+    unsigned long gone{ t->newObject( { AD::Normal, id }, { { "count", V( 1 ) } } ) };
+    EXPECT_EQ( 1, t->getObject( static_cast<int>( AD::Normal ), gone ).attributes.at( "count" ).n );
+    std::map<std::string,V> args{};
+    EXPECT_EQ( 1, t->query( static_cast<int>( AD::Normal ), id, "count(o.count)", "", "", args, 0, false ).functionValue );
+    t->deleteObject( gone );
+    t->commit();
+    t.reset();
+    EXPECT_ANY_THROW( db.getObject( static_cast<int>( AD::Normal ), gone ) );
+    EXPECT_EQ( 0, db.query( static_cast<int>( AD::Normal ), id, "count(o.count)", "", "", args, 0, false ).functionValue );
+
+    // One head per object, pointing at its latest version
+    EXPECT_EQ( db.db->execAndGet( "SELECT COUNT(*) FROM ( SELECT DISTINCT accessDomain, id FROM Object )" ).getInt(),
+            db.db->execAndGet( "SELECT COUNT(*) FROM ObjectHead" ).getInt() );
+    EXPECT_EQ( 0, db.db->execAndGet( "SELECT COUNT(*) FROM ObjectHead AS h "
+            "WHERE h.version <> ( SELECT MAX(version) FROM Object WHERE accessDomain=h.accessDomain AND id=h.id )" ).getInt() );
+}
+
+TEST_F( TransactionTest, QueryRebindsArguments ) {
+    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    unsigned long first{ t->newObject( { AD::Normal, 0 }, { { "name", V( "first" ) } } ) };
+    unsigned long second{ t->newObject( { AD::Normal, 0 }, { { "name", V( "second" ) } } ) };
+    t->newObject( { AD::Normal, first }, { { "n", V( 1 ) } } );
+    t->newObject( { AD::Normal, first }, { { "n", V( 2 ) } } );
+    t->newObject( { AD::Normal, second }, { { "n", V( 3 ) } } );
+    t->commit();
+    t.reset();
+
+    // The same query shape is parsed once and reused with new arguments
+    for ( int n : { 1, 2, 1, 3 } ) {
+        std::map<std::string,V> args{ { "n", V( n ) } };
+        QR qr{ db.query( static_cast<int>( AD::Normal ), n < 3 ? first : second, "", "o.n == a.n", "", args, 0, false ) };
+        ASSERT_EQ( 1u, qr.objects.size() );
+        EXPECT_EQ( n, qr.objects.at( 0 ).attributes.at( "n" ).n );
+    }
+
+    std::map<std::string,V> args{};
+    EXPECT_EQ( 3, db.query( static_cast<int>( AD::Normal ), first, "sum(o.n)", "", "", args, 0, false ).functionValue );
+    EXPECT_EQ( 3, db.query( static_cast<int>( AD::Normal ), second, "sum(o.n)", "", "", args, 0, false ).functionValue );
+}
+
+TEST_F( TransactionTest, SubscribeToChildren ) {
+    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    unsigned long parent{ t->newObject( { AD::Normal, 0 }, { { "name", V( "parent" ) } } ) };
+    unsigned long child{ t->newObject( { AD::Normal, parent }, { { "n", V( 1 ) }, { "note", V( "a" ) } } ) };
+    t->commit();
+    t.reset();
+
+    unsigned calls{ 0 };
+    QR listed{};
+    std::map<std::string,V> args{ { "n", V( 0 ) } };
+    unsigned listSub = db.subscribeQuery(
+            [&calls, &listed](QR qr) -> void {
+                ++calls;
+                listed = qr;
+            },
+            static_cast<int>( AD::Normal ), parent, "o.n", "o.n > a.n", "", args, 0, false );
+    double sum{ 0 };
+    std::map<std::string,V> noArgs{};
+    unsigned sumSub = db.subscribeQuery(
+            [&sum](QR qr) -> void {
+                sum = qr.functionValue;
+            },
+            static_cast<int>( AD::Normal ), parent, "sum(o.n)", "", "", noArgs, 0, false );
+
+    // A new child is noticed although the subscriptions have not returned it
+    t = std::move( db.beginTransaction() );
+    t->newObject( { AD::Normal, parent }, { { "n", V( 2 ) } } );
+    t->commit();
+    t.reset();
+    EXPECT_EQ( 1u, calls );
+    EXPECT_EQ( 2u, listed.objects.size() );
+    EXPECT_EQ( 3, sum );
+
+    // An attribute that neither query reads
+    t = std::move( db.beginTransaction() );
+    t->updateObject( child, { { "n", V( 1 ) }, { "note", V( "b" ) } } );
+    t->commit();
+    t.reset();
+    EXPECT_EQ( 1u, calls );
+
+    t = std::move( db.beginTransaction() );
+    t->updateObject( child, { { "n", V( 5 ) }, { "note", V( "b" ) } } );
+    t->commit();
+    t.reset();
+    EXPECT_EQ( 2u, calls );
+    EXPECT_EQ( 7, sum );
+
+    // Without a filter a query still reads the children of its parent only
+    unsigned allCalls{ 0 };
+    QR all{};
+    unsigned allSub = db.subscribeQuery(
+            [&allCalls, &all](QR qr) -> void {
+                ++allCalls;
+                all = qr;
+            },
+            static_cast<int>( AD::Normal ), parent, "", "", "", noArgs, 0, false );
+    EXPECT_EQ( 2u, db.query( static_cast<int>( AD::Normal ), parent, "", "", "", noArgs, 0, false ).objects.size() );
+
+    // Another parent
+    t = std::move( db.beginTransaction() );
+    t->newObject( { AD::Normal, 0 }, { { "n", V( 3 ) } } );
+    t->commit();
+    t.reset();
+    EXPECT_EQ( 2u, calls );
+    EXPECT_EQ( 0u, allCalls );
+
+    db.unsubscribe( listSub );
+    db.unsubscribe( sumSub );
+    t = std::move( db.beginTransaction() );
+    t->newObject( { AD::Normal, parent }, { { "n", V( 4 ) } } );
+    t->commit();
+    t.reset();
+    EXPECT_EQ( 2u, calls );
+    EXPECT_EQ( 7, sum );
+    EXPECT_EQ( 1u, allCalls );
+    EXPECT_EQ( 3u, all.objects.size() );
+    db.unsubscribe( allSub );
+}
+
+TEST_F( TransactionTest, SubscribeToQueryDelta ) {
+    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    unsigned long parent{ t->newObject( { AD::Normal, 0 }, { { "name", V( "parent" ) } } ) };
+    unsigned long first{ t->newObject( { AD::Normal, parent }, { { "n", V( 1 ) } } ) };
+    t->commit();
+    t.reset();
+
+    unsigned calls{ 0 };
+    QD delta{};
+    std::map<std::string,V> args{ { "n", V( 0 ) } };
+    unsigned subId = db.subscribeQueryDelta(
+            [&calls, &delta](QD qd) -> void {
+                ++calls;
+                delta = qd;
+            },
+            static_cast<int>( AD::Normal ), parent, "", "o.n > a.n", "", args, 0, false );
+
+    // The current result
+    EXPECT_EQ( 1u, calls );
+    ASSERT_EQ( 1u, delta.added.size() );
+    EXPECT_EQ( first, delta.added.at( 0 ).id );
+
+    t = std::move( db.beginTransaction() );
+    unsigned long second{ t->newObject( { AD::Normal, parent }, { { "n", V( 2 ) } } ) };
+    t->commit();
+    t.reset();
+    EXPECT_EQ( 2u, calls );
+    ASSERT_EQ( 1u, delta.added.size() );
+    EXPECT_EQ( second, delta.added.at( 0 ).id );
+    EXPECT_TRUE( delta.changed.empty() );
+    EXPECT_TRUE( delta.removed.empty() );
+
+    t = std::move( db.beginTransaction() );
+    t->updateObject( first, { { "n", V( 5 ) } } );
+    t->commit();
+    t.reset();
+    EXPECT_EQ( 3u, calls );
+    EXPECT_TRUE( delta.added.empty() );
+    ASSERT_EQ( 1u, delta.changed.size() );
+    EXPECT_EQ( 5, delta.changed.at( 0 ).attributes.at( "n" ).n );
+    EXPECT_TRUE( delta.removed.empty() );
+
+    // No longer matches the filter
+    t = std::move( db.beginTransaction() );
+    t->updateObject( first, { { "n", V( -1 ) } } );
+    t->commit();
+    t.reset();
+    EXPECT_EQ( 4u, calls );
+    ASSERT_EQ( 1u, delta.removed.size() );
+    EXPECT_EQ( first, delta.removed.at( 0 ).id );
+
+    t = std::move( db.beginTransaction() );
+    t->deleteObject( second );
+    t->commit();
+    t.reset();
+    EXPECT_EQ( 5u, calls );
+    ASSERT_EQ( 1u, delta.removed.size() );
+    EXPECT_EQ( second, delta.removed.at( 0 ).id );
+
+    // Nothing in the result changed
+    t = std::move( db.beginTransaction() );
+    t->updateObject( first, { { "n", V( -2 ) } } );
+    t->commit();
+    t.reset();
+    EXPECT_EQ( 5u, calls );
+
+    db.unsubscribe( subId );
+
+    std::map<std::string,V> noArgs{};
+    EXPECT_THROW( db.subscribeQueryDelta( [](QD) -> void {},
+            static_cast<int>( AD::Normal ), parent, "count(o.n)", "", "", noArgs, 0, false ), std::runtime_error );
+}
+
+TEST_F( TransactionTest, SubscribeToAggregates ) {
+    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    unsigned long parent{ t->newObject( { AD::Normal, 0 }, { { "name", V( "parent" ) } } ) };
+    unsigned long other{ t->newObject( { AD::Normal, 0 }, { { "name", V( "other" ) } } ) };
+    unsigned long one{ t->newObject( { AD::Normal, parent }, { { "n", V( 1 ) } } ) };
+    t->newObject( { AD::Normal, parent }, { { "n", V( 2 ) } } );
+    unsigned long three{ t->newObject( { AD::Normal, parent }, { { "n", V( 3 ) } } ) };
+    t->newObject( { AD::Normal, parent }, { { "name", V( "no n" ) } } );
+    t->commit();
+    t.reset();
+
+    std::map<std::string,V> noArgs{};
+    std::map<std::string,double> values{};
+    std::vector<unsigned> subIds{};
+    for ( const std::string select : { "count(o.n)", "sum(o.n)", "avg(o.n)", "min(o.n)", "max(o.n)" } ) {
+        values[ select ] = db.query( static_cast<int>( AD::Normal ), parent, select, "", "", noArgs, 0, false ).functionValue;
+        subIds.push_back( db.subscribeQuery(
+                [&values, select](QR qr) -> void {
+                    values[ select ] = qr.functionValue;
+                },
+                static_cast<int>( AD::Normal ), parent, select, "", "", noArgs, 0, false ) );
+    }
+    auto expectValues = [&]( double count, double sum, double min, double max ) -> void {
+        EXPECT_EQ( count, values.at( "count(o.n)" ) );
+        EXPECT_EQ( sum, values.at( "sum(o.n)" ) );
+        EXPECT_EQ( sum / count, values.at( "avg(o.n)" ) );
+        EXPECT_EQ( min, values.at( "min(o.n)" ) );
+        EXPECT_EQ( max, values.at( "max(o.n)" ) );
+        for ( const auto& kv : values ) {
+            EXPECT_EQ( db.query( static_cast<int>( AD::Normal ), parent, kv.first, "", "", noArgs, 0, false ).functionValue,
+                    kv.second ) << kv.first;
+        }
+    };
+    expectValues( 3, 6, 1, 3 );
+
+    t = std::move( db.beginTransaction() );
+    unsigned long five{ t->newObject( { AD::Normal, parent }, { { "n", V( 5 ) } } ) };
+    t->commit();
+    t.reset();
+    expectValues( 4, 11, 1, 5 );
+
+    // The smallest value is replaced
+    t = std::move( db.beginTransaction() );
+    t->updateObject( one, { { "n", V( 4 ) } } );
+    t->commit();
+    t.reset();
+    expectValues( 4, 14, 2, 5 );
+
+    t = std::move( db.beginTransaction() );
+    t->moveObject( three, { AD::Normal, other } );
+    t->commit();
+    t.reset();
+    expectValues( 3, 11, 2, 5 );
+
+    t = std::move( db.beginTransaction() );
+    t->deleteObject( five );
+    t->commit();
+    t.reset();
+    expectValues( 2, 6, 2, 4 );
+
+    for ( unsigned subId : subIds ) {
+        db.unsubscribe( subId );
+    }
+}
+
+TEST_F( TransactionTest, QueryPages ) {
+    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    unsigned long parent{ t->newObject( { AD::Normal, 0 }, { { "name", V( "pages" ) } } ) };
+    for ( int i = 0; i < 23; ++i ) {
+        // Repeated sort values, some objects without one
+        std::map<std::string,V> attributes{ { "i", V( i ) } };
+        if ( i % 5 ) {
+            attributes.emplace( "rank", V( i % 4 ) );
+        }
+        t->newObject( { AD::Normal, parent }, attributes );
+    }
+    t->commit();
+    t.reset();
+
+    std::map<std::string,V> args{ { "from", V( 3 ) } };
+    // Rank of each object, -1 for those without one
+    std::map<unsigned long,double> ranks{};
+    for ( const O& o : db.query( static_cast<int>( AD::Normal ), parent, "", "o.i >= a.from", "", args, 0, false ).objects ) {
+        ranks[ o.id ] = o.attributes.count( "rank" ) ? o.attributes.at( "rank" ).n : -1;
+    }
+    ASSERT_EQ( 20u, ranks.size() );
+
+    for ( const std::string& select : { std::string( "" ), std::string( "o.i" ) } ) {
+        for ( const std::string& sort : { std::string( "" ), std::string( "o.rank" ), std::string( "desc(o.rank)" ) } ) {
+            std::vector<unsigned long> paged{};
+            std::string cursor{};
+            unsigned pages{ 0 };
+            do {
+                QR page{ db.query( static_cast<int>( AD::Normal ), parent, select, "o.i >= a.from", sort, args, 0, false,
+                        6, cursor ) };
+                EXPECT_GE( 6u, page.objects.size() );
+                for ( const O& o : page.objects ) {
+                    paged.push_back( o.id );
+                }
+                cursor = page.cursor;
+                ++pages;
+            } while ( !cursor.empty() && pages < 10 );
+
+            EXPECT_EQ( 4u, pages ) << "select '" << select << "' sort '" << sort << "'";
+            ASSERT_EQ( ranks.size(), paged.size() ) << "select '" << select << "' sort '" << sort << "'";
+            // Pages are ordered by the sort value, then by id
+            for ( std::size_t i = 1; i < paged.size(); ++i ) {
+                double previous{ ranks.at( paged.at( i - 1 ) ) }, current{ ranks.at( paged.at( i ) ) };
+                if ( sort.empty() || previous == current ) {
+                    EXPECT_LT( paged.at( i - 1 ), paged.at( i ) ) << "select '" << select << "' sort '" << sort << "'";
+                } else if ( "o.rank" == sort ) {
+                    EXPECT_LT( previous, current ) << "select '" << select << "'";
+                } else {
+                    EXPECT_GT( previous, current ) << "select '" << select << "'";
+                }
+            }
+        }
+    }
+
+    // Updating an object that was already listed neither repeats nor skips any
+    for ( const std::string& sort : { std::string( "" ), std::string( "o.rank" ) } ) {
+        QR first{ db.query( static_cast<int>( AD::Normal ), parent, "", "o.i >= a.from", sort, args, 0, false, 6 ) };
+        ASSERT_EQ( 6u, first.objects.size() );
+        std::set<unsigned long> seen{};
+        for ( const O& o : first.objects ) {
+            seen.insert( o.id );
+        }
+        std::map<std::string,V> updated{ first.objects.front().attributes };
+        updated[ "note" ] = V( sort );
+        t = std::move( db.beginTransaction() );
+        t->updateObject( first.objects.front().id, updated );
+        t->commit();
+        t.reset();
+
+        std::string cursor{ first.cursor };
+        while ( !cursor.empty() ) {
+            QR page{ db.query( static_cast<int>( AD::Normal ), parent, "", "o.i >= a.from", sort, args, 0, false,
+                    6, cursor ) };
+            for ( const O& o : page.objects ) {
+                EXPECT_TRUE( seen.insert( o.id ).second ) << "sort '" << sort << "'";
+            }
+            cursor = page.cursor;
+        }
+        EXPECT_EQ( ranks.size(), seen.size() ) << "sort '" << sort << "'";
+    }
+
+    EXPECT_THROW( db.query( static_cast<int>( AD::Normal ), parent, "", "", "", args, 0, false, 6, "garbage" ),
+            std::runtime_error );
+    EXPECT_THROW( db.query( static_cast<int>( AD::Normal ), parent, "", "", "o.rank", args, 0, false, 6, "12" ),
+            std::runtime_error );
+}
+
+TEST_F( TransactionTest, MapQuery ) {
+    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    unsigned long parent{ t->newObject( { AD::Normal, 0 }, { { "name", V( "map" ) } } ) };
+    for ( int i = 0; i < 10; ++i ) {
+        t->newObject( { AD::Normal, parent }, { { "i", V( i ) }, { "odd", V( i % 2 == 1 ) } } );
+    }
+    t->commit();
+    t.reset();
+
+    std::map<std::string,V> args{ { "odd", V( true ) } };
+    for ( const std::string& select : { std::string( "" ), std::string( "o.i" ) } ) {
+        QR qr{ db.query( static_cast<int>( AD::Normal ), parent, select, "o.odd == a.odd", "desc(o.i)", args, 0, false ) };
+        std::vector<O> mapped{};
+        db.mapQuery( [&mapped](const O& o) -> void {
+                    mapped.push_back( o );
+                },
+                static_cast<int>( AD::Normal ), parent, select, "o.odd == a.odd", "desc(o.i)", args, 0, false );
+        ASSERT_EQ( 5u, mapped.size() );
+        ASSERT_EQ( qr.objects.size(), mapped.size() );
+        for ( std::size_t i = 0; i < mapped.size(); ++i ) {
+            EXPECT_EQ( qr.objects.at( i ).id, mapped.at( i ).id );
+            EXPECT_EQ( qr.objects.at( i ).attributes.size(), mapped.at( i ).attributes.size() );
+            EXPECT_EQ( 9 - 2 * static_cast<int>( i ), mapped.at( i ).attributes.at( "i" ).n );
+        }
+    }
+
+    // Objects not yet committed
+    t = std::move( db.beginTransaction() );
+    t->newObject( { AD::Normal, parent }, { { "i", V( 11 ) }, { "odd", V( true ) } } );
+    unsigned count{ 0 };
+    t->mapQuery( [&count](const O&) -> void {
+                ++count;
+            },
+            static_cast<int>( AD::Normal ), parent, "", "o.odd == a.odd", "", args, 0, false );
+    EXPECT_EQ( 6u, count );
+    t->rollback();
+    t.reset();
+
+    std::map<std::string,V> noArgs{};
+    EXPECT_THROW( db.mapQuery( [](const O&) -> void {},
+            static_cast<int>( AD::Normal ), parent, "count(o.i)", "", "", noArgs, 0, false ), std::runtime_error );
+}
+
+TEST_F( TransactionTest, ReadConnectionPool ) {
+    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    unsigned long parent{ t->newObject( { AD::Normal, 0 }, { { "name", V( "pool" ) } } ) };
+    unsigned long child{ 0 };
+    for ( int i = 0; i < 10; ++i ) {
+        child = t->newObject( { AD::Normal, parent }, { { "n", V( 0 ) } } );
+    }
+    t->commit();
+    t.reset();
+
+    // A borrowed connection keeps reading the snapshot it started with
+    {
+        M::Database::ReadConnection reader{ db.getReadConnection() };
+        EXPECT_EQ( 0, db.getObject( reader.get(), static_cast<int>( AD::Normal ), child ).attributes.at( "n" ).n );
+        t = std::move( db.beginTransaction() );
+        t->updateObject( child, { { "n", V( 1 ) } } );
+        t->commit();
+        t.reset();
+        EXPECT_EQ( 0, db.getObject( reader.get(), static_cast<int>( AD::Normal ), child ).attributes.at( "n" ).n );
+        EXPECT_EQ( 1, db.readObject( static_cast<int>( AD::Normal ), child ).attributes.at( "n" ).n );
+    }
+
+    // Readers on other threads while objects are added
+    std::atomic<unsigned> failures{ 0 };
+    std::vector<std::thread> readers{};
+    for ( int r = 0; r < 4; ++r ) {
+        readers.emplace_back( [this, parent, child, &failures]() -> void {
+            std::map<std::string,V> args{ { "zero", V( 0 ) } };
+            std::size_t last{ 0 };
+            for ( int i = 0; i < 20; ++i ) {
+                QR qr{ db.readQuery( static_cast<int>( AD::Normal ), parent, "", "o.n >= a.zero", "", args, 0 ) };
+                if ( qr.objects.size() < std::max<std::size_t>( last, 10 ) || qr.objects.size() > 20 ) {
+                    ++failures;
+                }
+                last = qr.objects.size();
+                if ( 1 != db.readObject( static_cast<int>( AD::Normal ), child ).attributes.at( "n" ).n ) {
+                    ++failures;
+                }
+            }
+        } );
+    }
+    for ( int i = 0; i < 10; ++i ) {
+        t = std::move( db.beginTransaction() );
+        t->newObject( { AD::Normal, parent }, { { "n", V( i ) } } );
+        t->commit();
+        t.reset();
+    }
+    for ( std::thread& reader : readers ) {
+        reader.join();
+    }
+    EXPECT_EQ( 0u, failures );
+    std::map<std::string,V> args{ { "zero", V( 0 ) } };
+    EXPECT_EQ( 20u, db.readQuery( static_cast<int>( AD::Normal ), parent, "", "o.n >= a.zero", "", args, 0 ).objects.size() );
+}
+
+TEST_F( TransactionTest, CommitAsync ) {
+    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    unsigned long id{ t->newObject( { AD::Normal, 0 }, { { "n", V( 0 ) } } ) };
+    std::future<void> committed{ db.commitAsync( std::move( t ) ) };
+    ASSERT_NO_THROW( committed.get() );
+    EXPECT_EQ( 0, db.getObject( static_cast<int>( AD::Normal ), id ).attributes.at( "n" ).n );
+
+    // Subscriptions are notified on the writer thread before the future is ready
+    std::thread::id notifiedOn{};
+    double notified{ -1 };
+    unsigned sub{ db.subscribeObject( [&notifiedOn, &notified]( O o ) -> void {
+        notifiedOn = std::this_thread::get_id();
+        notified = o.attributes.at( "n" ).n;
+    }, static_cast<int>( AD::Normal ), id ) };
+    t = std::move( db.beginTransaction() );
+    t->updateObject( id, { { "n", V( 1 ) } } );
+    committed = db.commitAsync( std::move( t ) );
+    ASSERT_NO_THROW( committed.get() );
+    EXPECT_EQ( 1, notified );
+    EXPECT_NE( std::this_thread::get_id(), notifiedOn );
+    db.unsubscribe( sub );
+
+    // A failed commit is reported through the future
+    t = std::move( db.beginTransaction() );
+    t->rollback();
+    committed = db.commitAsync( std::move( t ) );
+    EXPECT_THROW( committed.get(), M::Exception );
+}
+
+TEST_F( TransactionTest, GroupCommit ) {
+    std::unique_ptr<M::Transaction> t{ std::move( db.beginTransaction() ) };
+    unsigned long id{ t->newObject( { AD::Normal, 0 }, { { "n", V( 0 ) } } ) };
+    t->commit();
+    t.reset();
+
+    std::vector<double> notified{};
+    unsigned sub{ db.subscribeObject( [&notified]( O o ) -> void {
+        notified.push_back( o.attributes.at( "n" ).n );
+    }, static_cast<int>( AD::Normal ), id ) };
+    notified.clear();
+    auto hashes = [this]() -> int {
+        M::Database::Statement count( *db.db, "SELECT COUNT(DISTINCT hash) AS hashes FROM 'Transaction'" );
+        count.executeStep();
+        return count.getColumn( "hashes" ).getInt();
+    };
+    int hashesBefore{ hashes() };
+
+    db.setGroupCommit( 3 );
+    for ( int n = 1; n <= 2; ++n ) {
+        t = std::move( db.beginTransaction() );
+        EXPECT_THROW( db.beginTransaction(), std::runtime_error );
+        t->updateObject( id, { { "n", V( n ) } } );
+        t->commit();
+        t.reset();
+    }
+    // Not written yet
+    EXPECT_TRUE( notified.empty() );
+    EXPECT_EQ( 0, db.getObject( static_cast<int>( AD::Normal ), id ).attributes.at( "n" ).n );
+
+    // The third transaction writes the group and notifies once
+    t = std::move( db.beginTransaction() );
+    t->updateObject( id, { { "n", V( 3 ) } } );
+    t->commit();
+    t.reset();
+    ASSERT_EQ( 1u, notified.size() );
+    EXPECT_EQ( 3, notified.back() );
+    EXPECT_EQ( 3, db.getObject( static_cast<int>( AD::Normal ), id ).attributes.at( "n" ).n );
+    EXPECT_EQ( hashesBefore + 3, hashes() );
+
+    // A rolled back transaction leaves the rest of the group
+    t = std::move( db.beginTransaction() );
+    t->updateObject( id, { { "n", V( 4 ) } } );
+    t->rollback();
+    t.reset();
+    t = std::move( db.beginTransaction() );
+    t->updateObject( id, { { "n", V( 5 ) } } );
+    t->commit();
+    t.reset();
+    db.flushGroupCommit();
+    ASSERT_EQ( 2u, notified.size() );
+    EXPECT_EQ( 5, db.getObject( static_cast<int>( AD::Normal ), id ).attributes.at( "n" ).n );
+
+    // The window writes a group that is not full
+    db.setGroupCommit( 10, 20 );
+    t = std::move( db.beginTransaction() );
+    t->updateObject( id, { { "n", V( 6 ) } } );
+    t->commit();
+    t.reset();
+    for ( int i = 0; i < 100 && 6 != db.readObject( static_cast<int>( AD::Normal ), id ).attributes.at( "n" ).n; ++i ) {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+    }
+    EXPECT_EQ( 6, db.readObject( static_cast<int>( AD::Normal ), id ).attributes.at( "n" ).n );
+
+    // A window that passes while a transaction is open is written when it ends
+    t = std::move( db.beginTransaction() );
+    t->updateObject( id, { { "n", V( 7 ) } } );
+    t->commit();
+    t = std::move( db.beginTransaction() );
+    std::this_thread::sleep_for( std::chrono::milliseconds( 60 ) );
+    t->updateObject( id, { { "n", V( 8 ) } } );
+    t->commit();
+    t.reset();
+    EXPECT_EQ( 8, db.readObject( static_cast<int>( AD::Normal ), id ).attributes.at( "n" ).n );
+    EXPECT_EQ( 4u, notified.size() );
+
+    // The window does not hold up the writer, commits queued meanwhile join the group
+    db.setGroupCommit( 10, 500 );
+    for ( int n = 9; n <= 10; ++n ) {
+        t = std::move( db.beginTransaction() );
+        t->updateObject( id, { { "n", V( n ) } } );
+        std::future<void> committed{ db.commitAsync( std::move( t ) ) };
+        ASSERT_EQ( std::future_status::ready, committed.wait_for( std::chrono::milliseconds( 250 ) ) );
+        committed.get();
+    }
+    EXPECT_EQ( 8, db.readObject( static_cast<int>( AD::Normal ), id ).attributes.at( "n" ).n );
+    for ( int i = 0; i < 100 && 10 != db.readObject( static_cast<int>( AD::Normal ), id ).attributes.at( "n" ).n; ++i ) {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+    }
+    EXPECT_EQ( 10, db.readObject( static_cast<int>( AD::Normal ), id ).attributes.at( "n" ).n );
+    EXPECT_EQ( 5u, notified.size() );
+
+    db.setGroupCommit( 0 );
+    db.unsubscribe( sub );
+    EXPECT_EQ( 5u, notified.size() );
+}
+
+TEST_F( TransactionTest, IngestDump ) {
+    std::stringbuf dump{};
+    db.mapTransactions( [this, &dump]( const M::Database::Transaction& transaction ) -> void {
+        db.readTransaction( dump, transaction.hash.toString() );
+        dump.sputc( '\n' );
+    } );
+    ASSERT_FALSE( dump.str().empty() );
+
+    // Everything in the dump is already in the database
+    std::stringbuf existing{ dump.str() };
+    EXPECT_EQ( 0u, db.ingest( existing ) );
+
+    std::string text{ dump.str() };
+    std::stringbuf truncated{ text.substr( 0, text.size() / 2 ) };
+    EXPECT_THROW( db.ingest( truncated ), M::FormatException );
+}
+
+TEST_F( TransactionTest, TransactionGraph ) {
+    std::unique_ptr<M::Transaction> t{ db.beginTransaction() };
+    unsigned long id{ t->newObject( { AD::Normal, 0 }, { { "n", V( 0 ) } } ) };
+    t->commit();
+    t.reset();
+    M::CryptoHelper::SHA3 head{ db.getTransactionList().back().hash };
+    EXPECT_TRUE( db.haveTransaction( head ) );
+    ASSERT_EQ( 1u, db.getTransactionHeads().size() );
+    EXPECT_EQ( head, db.getTransactionHeads().front() );
+    ASSERT_EQ( 1u, db.getTransactionLatest().size() );
+    EXPECT_EQ( head, db.getTransactionLatest().front().hash );
+    EXPECT_EQ( 1u, db.getTransactionsFrom( { head.toString() } ).size() );
+
+    // Transactions of a group are added when the group is written
+    db.setGroupCommit( 2 );
+    t = db.beginTransaction();
+    t->updateObject( id, { { "n", V( 1 ) } } );
+    t->commit();
+    t.reset();
+    EXPECT_EQ( head, db.getTransactionHeads().front() );
+    db.flushGroupCommit();
+    db.setGroupCommit( 0 );
+    M::CryptoHelper::SHA3 next{ db.getTransactionList().back().hash };
+    ASSERT_EQ( 1u, db.getTransactionHeads().size() );
+    EXPECT_EQ( next, db.getTransactionHeads().front() );
+    EXPECT_EQ( 2u, db.getTransactionsFrom( { head.toString() } ).size() );
+
+    // The graph is rebuilt from the database
+    db.close();
+    db.init();
+    EXPECT_TRUE( db.haveTransaction( head ) );
+    ASSERT_EQ( 1u, db.getTransactionHeads().size() );
+    EXPECT_EQ( next, db.getTransactionHeads().front() );
+    EXPECT_THROW( db.getTransactionsFrom( { M::CryptoHelper::SHA3().toString() } ), M::Exception );
+}
+
+TEST_F( TransactionTest, TransactionsMissingFromSketch ) {
+    for ( int n = 0; n < 3; ++n ) {
+        std::unique_ptr<M::Transaction> t{ db.beginTransaction() };
+        t->newObject( { AD::Normal, 0 }, { { "n", V( n ) } } );
+        t->commit();
+    }
+
+    // A peer that lacks the last two transactions
+    std::vector<M::Database::Transaction> transactions{ db.getTransactionList() };
+    M::Database::Sketch sketch( 96 );
+    for ( std::size_t i = 0; i + 2 < transactions.size(); ++i ) {
+        sketch.insert( transactions.at( i ).hash );
+    }
+    std::vector<std::string> missing{ db.getTransactionsMissingFrom( sketch ) };
+    ASSERT_EQ( 2u, missing.size() );
+    EXPECT_EQ( transactions.at( transactions.size() - 2 ).hash.toString(), missing.at( 0 ) );
+    EXPECT_EQ( transactions.back().hash.toString(), missing.at( 1 ) );
+
+    // The difference to an empty set is larger than the sketch
+    if ( transactions.size() > 96 ) {
+        EXPECT_THROW( db.getTransactionsMissingFrom( M::Database::Sketch( 96 ) ), M::Exception );
+    }
+}
+
+const std::string creatorPem = R"(-----BEGIN PUBLIC KEY-----
+MIIBIjANBgkqhkiG9w0BAQEFAAOCAQ8AMIIBCgKCAQEA1SEWOOAm6wFSHI6ixs0jBGMyfriXfpFFaDL15ihHdfezFNR8mc6AO30UeArNfCp/IgQff7lk735fni8O5GrbFd8LBYtFH7AT55MDa+qjK1VkwFlEPq9Qezhg+Rbnrole1XU2zc/NiRuCQtrygblhCbdK87kTirpOAnFT7lGonBNx4Os6tYJwcBl15xQpeRD0wO1PZQg2BLGyymrtdlnEBd+kg58ffmnlgJuAwx+FZ5L2Zzz4hrfFCQQVQvXJJlamIWYuZAE8+HXtQQ1iVay0ZuhCVziEfESrBTZrwVXYCcgM54cN1/jCqI0tb6Vl5Ny0CX/Yw1Gzo3fi/Ub20ZDHlQIDAQAB
+-----END PUBLIC KEY-----)";
+
+// A database created by the holder of creatorPem, that accepts any signature unless told not to
+class ReplicaDatabase : public OpenDatabase {
+public:
+    ReplicaDatabase( const std::string& path ) : OpenDatabase( nullptr, path ) {
+        creator = M::CryptoHelper::PublicKey::fromPem( creatorPem );
+        userHash = creator.hash().toString();
+        verifier = [this]( const M::CryptoHelper::PublicKey&, const M::CryptoHelper::SHA3&,
+                const M::CryptoHelper::Signature& ) -> bool {
+            return acceptSignatures;
+        };
+    }
+    virtual ~ReplicaDatabase() = default;
+
+    void init() {
+        M::Database::init();
+        manifest.reset( new Manifest( nullptr, nullptr, "replica", M::Helper::Date(), creator ) );
+    }
+
+    void dumpTo( std::basic_streambuf<char>& sb ) {
+        mapTransactions( [this, &sb]( const M::Database::Transaction& transaction ) -> void {
+            readTransaction( sb, transaction.hash.toString() );
+            sb.sputc( '\n' );
+        } );
+    }
+
+    M::CryptoHelper::PublicKey creator;
+    std::atomic<bool> acceptSignatures{ true };
+};
+
+TEST( ReplicaTest, IngestVerifies ) {
+    FS::path source{ "replicaSource.db" }, replica{ "replicaTest.db" };
+    removeTestDb( source );
+    removeTestDb( replica );
+    for ( const FS::path& path : { source, replica } ) {
+        M::Database db( nullptr, path.string() );
+        db.create( 0, nullptr );
+        db.close();
+    }
+
+    std::stringbuf dump{};
+    {
+        ReplicaDatabase db( source.string() );
+        db.init();
+        std::unique_ptr<M::Transaction> t{ db.beginTransaction() };
+        unsigned long a{ t->newObject( { AD::Normal, 0 },
+                { { "name", V( "a \"quoted\" name" ) }, { "n", V( 1.5 ) }, { "b", V( true ) }, { "z", V() } } ) };
+        unsigned long b{ t->newObject( { AD::Normal, a }, { { "name", V( "b" ) } } ) };
+        unsigned long c{ t->newObject( { AD::Normal, a }, { { "name", V( "c" ) } } ) };
+        unsigned long d{ t->newObject( { AD::Normal, a }, { { "name", V( "d" ) } } ) };
+        t->commit();
+        t = db.beginTransaction();
+        t->updateObject( a, { { "n", V( 2 ) } } );
+        t->moveObject( c, { AD::Normal, b } );
+        t->deleteObject( d );
+        t->commit();
+        t.reset();
+        db.dumpTo( dump );
+        db.close();
+    }
+
+    ReplicaDatabase db( replica.string() );
+    db.init();
+    std::string text{ dump.str() };
+    std::stringbuf tampered{ text.replace( text.find( "\"n\":2" ), 5, "\"n\":3" ) };
+    EXPECT_THROW( db.ingest( tampered ), M::Exception );
+    db.acceptSignatures = false;
+    std::stringbuf rejected{ dump.str() };
+    EXPECT_THROW( db.ingest( rejected ), M::Exception );
+    db.acceptSignatures = true;
+
+    std::stringbuf copy{ dump.str() };
+    EXPECT_EQ( 2u, db.ingest( copy ) );
+    std::stringbuf again{ dump.str() };
+    EXPECT_EQ( 0u, db.ingest( again ) );
+    db.close();
+}
+
+TEST( ReplicaTest, IngestNotifiesEmptyReplica ) {
+    FS::path source{ "replicaSource.db" }, replica{ "replicaTest.db" };
+    removeTestDb( source );
+    removeTestDb( replica );
+    for ( const FS::path& path : { source, replica } ) {
+        M::Database db( nullptr, path.string() );
+        db.create( 0, nullptr );
+        db.close();
+    }
+
+    std::stringbuf dump{};
+    {
+        ReplicaDatabase db( source.string() );
+        db.init();
+        std::unique_ptr<M::Transaction> t{ db.beginTransaction() };
+        unsigned long a{ t->newObject( { AD::Normal, 0 }, { { "n", V( 1 ) } } ) };
+        t->commit();
+        t = db.beginTransaction();
+        t->newObject( { AD::Normal, 0 }, { { "n", V( 2 ) } } );
+        t->updateObject( a, { { "n", V( 3 ) } } );
+        t->commit();
+        t.reset();
+        db.dumpTo( dump );
+        db.close();
+    }
+
+    // Subscribed before the replica has any objects
+    ReplicaDatabase db( replica.string() );
+    db.init();
+    unsigned calls{ 0 };
+    double sum{ -1 };
+    std::map<std::string,V> noArgs{};
+    unsigned sub = db.subscribeQuery(
+            [&calls, &sum](QR qr) -> void {
+                ++calls;
+                sum = qr.functionValue;
+            },
+            static_cast<int>( AD::Normal ), 0, "sum(o.n)", "", "", noArgs, 0, false );
+    unsigned callsBefore{ calls };
+
+    std::stringbuf copy{ dump.str() };
+    EXPECT_EQ( 2u, db.ingest( copy ) );
+    EXPECT_LT( callsBefore, calls );
+    EXPECT_EQ( 5, sum );
+    db.unsubscribe( sub );
+    db.close();
+}
+
+TEST( ReplicaTest, GraphAfterReplication ) {
+    FS::path source{ "replicaSource.db" }, ingested{ "replicaTest.db" }, written{ "replicaWritten.db" };
+    for ( const FS::path& path : { source, ingested, written } ) {
+        removeTestDb( path );
+        M::Database db( nullptr, path.string() );
+        db.create( 0, nullptr );
+        db.close();
+    }
+
+    std::stringbuf dump{};
+    std::vector<M::CryptoHelper::SHA3> heads{};
+    {
+        ReplicaDatabase db( source.string() );
+        db.init();
+        std::unique_ptr<M::Transaction> t{ db.beginTransaction() };
+        unsigned long a{ t->newObject( { AD::Normal, 0 }, { { "name", V( "a" ) } } ) };
+        t->commit();
+        for ( int n = 0; n < 2; ++n ) {
+            t = db.beginTransaction();
+            t->updateObject( a, { { "n", V( n ) } } );
+            t->commit();
+        }
+        t.reset();
+        heads = db.getTransactionHeads();
+        db.dumpTo( dump );
+        db.close();
+    }
+    ASSERT_EQ( 1u, heads.size() );
+
+    // Remote transactions are linked to their parents, whether they are
+    // ingested in batches or written one at a time
+    ReplicaDatabase db( ingested.string() );
+    db.init();
+    std::stringbuf copy{ dump.str() };
+    EXPECT_EQ( 3u, db.ingest( copy ) );
+    std::vector<M::CryptoHelper::SHA3> ingestedHeads{ db.getTransactionHeads() };
+    ASSERT_EQ( 1u, ingestedHeads.size() );
+    EXPECT_TRUE( heads.front() == ingestedHeads.front() );
+    db.close();
+
+    ReplicaDatabase other( written.string() );
+    other.init();
+    other.writeToDatabase( dump.str() );
+    std::vector<M::CryptoHelper::SHA3> writtenHeads{ other.getTransactionHeads() };
+    ASSERT_EQ( 1u, writtenHeads.size() );
+    EXPECT_TRUE( heads.front() == writtenHeads.front() );
+    other.close();
+}
+
+TEST( ReplicaTest, WriteBatchStream ) {
+    FS::path source{ "replicaSource.db" }, replica{ "replicaTest.db" };
+    removeTestDb( source );
+    removeTestDb( replica );
+    for ( const FS::path& path : { source, replica } ) {
+        M::Database db( nullptr, path.string() );
+        db.create( 0, nullptr );
+        db.close();
+    }
+
+    std::stringbuf batch{};
+    std::vector<std::string> hashes{};
+    M::CryptoHelper::SHA3 digest{};
+    {
+        ReplicaDatabase db( source.string() );
+        db.init();
+        std::unique_ptr<M::Transaction> t{ db.beginTransaction() };
+        unsigned long a{ t->newObject( { AD::Normal, 0 }, { { "name", V( "a" ) } } ) };
+        t->commit();
+        t = db.beginTransaction();
+        t->updateObject( a, { { "name", V( "b" ) } } );
+        t->commit();
+        t.reset();
+        for ( const M::Database::Transaction& transaction : db.getTransactionList() ) {
+            hashes.push_back( transaction.hash.toString() );
+        }
+        db.readTransactions( batch, hashes );
+        digest = db.getHeadDigest();
+        db.close();
+    }
+
+    // Written in parts the way a download arrives
+    ReplicaDatabase db( replica.string() );
+    db.init();
+    EXPECT_FALSE( digest == db.getHeadDigest() );
+    auto stream( db.openWriteStream() );
+    std::string data{ batch.str() };
+    std::promise<std::exception_ptr> written{};
+    for ( std::size_t i = 0; i < data.size(); i += 100 ) {
+        db.writeToStreamAsync( stream, data.substr( i, 100 ), nullptr );
+    }
+    db.writeToStreamAsync( stream, "", [&written]( std::exception_ptr error ) -> void {
+        written.set_value( error );
+    } );
+    EXPECT_FALSE( written.get_future().get() );
+    for ( const std::string& hash : hashes ) {
+        EXPECT_TRUE( db.haveTransaction( M::CryptoHelper::SHA3( hash ) ) );
+    }
+    // The same transactions give the same digest
+    EXPECT_TRUE( digest == db.getHeadDigest() );
+    db.close();
+}
+
+TEST( ReplicaTest, RemoteWriteWaitsForGroup ) {
+    FS::path source{ "replicaSource.db" }, replica{ "replicaTest.db" };
+    auto createDb = []( const FS::path& path ) -> void {
+        removeTestDb( path );
+        M::Database db( nullptr, path.string() );
+        db.create( 0, nullptr );
+        db.close();
+    };
+    createDb( source );
+
+    std::stringbuf dump{};
+    {
+        ReplicaDatabase db( source.string() );
+        db.init();
+        std::unique_ptr<M::Transaction> t{ db.beginTransaction() };
+        t->newObject( { AD::Normal, 0 }, { { "n", V( 1 ) } } );
+        t->commit();
+        t.reset();
+        db.dumpTo( dump );
+        db.close();
+    }
+    std::map<std::string,V> noArgs{};
+    auto objects = [&noArgs]( ReplicaDatabase& db ) -> std::size_t {
+        return db.readQuery( static_cast<int>( AD::Normal ), 0, "", "", "", noArgs, 0 ).objects.size();
+    };
+
+    // Written on the writer thread once the open transaction of the group ends
+    createDb( replica );
+    {
+        ReplicaDatabase db( replica.string() );
+        db.init();
+        db.setGroupCommit( 10 );
+        std::unique_ptr<M::Transaction> t{ db.beginTransaction() };
+        t->newObject( { AD::Normal, 0 }, { { "n", V( 2 ) } } );
+        std::promise<std::exception_ptr> written{};
+        std::future<std::exception_ptr> done{ written.get_future() };
+        db.writeToDatabaseAsync( dump.str(), [&written]( std::exception_ptr error ) -> void {
+            written.set_value( error );
+        } );
+        EXPECT_EQ( std::future_status::timeout, done.wait_for( std::chrono::milliseconds( 50 ) ) );
+        std::future<void> committed{ db.commitAsync( std::move( t ) ) };
+        ASSERT_NO_THROW( committed.get() );
+        EXPECT_FALSE( done.get() );
+        EXPECT_EQ( 2u, objects( db ) );
+        db.setGroupCommit( 0 );
+        db.close();
+    }
+
+    // A write on another thread waits the same way
+    createDb( replica );
+    {
+        ReplicaDatabase db( replica.string() );
+        db.init();
+        db.setGroupCommit( 10 );
+        std::unique_ptr<M::Transaction> t{ db.beginTransaction() };
+        t->newObject( { AD::Normal, 0 }, { { "n", V( 2 ) } } );
+        std::atomic<bool> writing{ true };
+        std::exception_ptr error{};
+        std::thread writer( [&]() -> void {
+            try {
+                db.writeToDatabase( dump.str() );
+            } catch (...) {
+                error = std::current_exception();
+            }
+            writing = false;
+        } );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+        EXPECT_TRUE( writing );
+        t->commit();
+        t.reset();
+        writer.join();
+        EXPECT_FALSE( error );
+        EXPECT_EQ( 2u, objects( db ) );
+        db.setGroupCommit( 0 );
+        db.close();
+    }
+}
+
 TEST_F( TransactionTest, DumpDb ) {
     db.dump( p.string() );
 }
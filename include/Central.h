@@ -6,6 +6,8 @@
 #define SRC_CENTRAL_H_
 
 // STL
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <list>
 #include <map>
@@ -117,6 +119,7 @@ public:
 
     /**
      * Verify a signature against a public key. Signatures are 224-bit SHA-3 hash, encrypted by a private RSA key.
+     * Successful verifications are remembered, so the same signature is only verified once.
      */
     virtual bool verify(const CryptoHelper::PublicKey& key, const CryptoHelper::SHA3& hash, const CryptoHelper::Signature& sig) const;
 
@@ -196,6 +199,12 @@ public:
 
     virtual void addDatabasePermission( const CryptoHelper::PublicKeyHash& keyHash, const CryptoHelper::SHA3& dbHash );
     virtual void removeDatabasePermission( const CryptoHelper::PublicKeyHash& keyHash, const CryptoHelper::SHA3& dbHash );
+    /**
+     * Announce transactions committed here to the connected peers with permission to the database, so that they
+     * fetch them right away. Called by Database.
+     */
+    virtual void announceTransactions( const CryptoHelper::SHA3& dbHash,
+        const std::vector<CryptoHelper::SHA3>& hashes );
 
     /**
      * List all databases a peer has permission to.
@@ -252,6 +261,11 @@ public:
      * Stop the Mist connection library, and close any open network connections.
      */
     virtual void stopSync();
+    /**
+     * Set how many databases are synced at the same time with each peer, and with all peers together. Each database
+     * that is synced has one request in flight, the databases of a peer share its connection.
+     */
+    virtual void setSyncConcurrency( std::size_t databasesPerPeer, std::size_t databases );
 
     using peer_service_list_callback = std::function<void( CryptoHelper::PublicKeyHash, std::vector<std::string> )>;
     /**
@@ -313,8 +327,22 @@ private:
     std::unique_ptr<Helper::Database::Database> settingsDatabase;
     std::map<unsigned, Mist::Database*> databases;
 
+    /* In-memory copy of the settings database tables, kept up to date by the
+     * methods that change them so that reads do not need the database */
+    void loadSettings();
+    mutable struct {
+        std::recursive_mutex mux;
+        std::map<CryptoHelper::PublicKeyHash, Mist::Peer> peers;
+        std::map<unsigned, Mist::Database::Manifest> manifests;
+        std::map<CryptoHelper::SHA3, unsigned> localIds;
+        std::multimap<CryptoHelper::PublicKeyHash, CryptoHelper::SHA3> databasePermissions;
+        std::multimap<CryptoHelper::PublicKeyHash, std::string> servicePermissions;
+    } settings;
+
     mist::io::IOContext ioCtx;
     mist::io::SSLContext sslCtx;
+    // Run a job on the event loop, from any thread, and wake the loop for it
+    void post( std::function<void()> job );
     mist::ConnectContext connCtx;
 
     void addDatabaseInvite(Database::Manifest manifest,
@@ -328,6 +356,16 @@ private:
 
     CryptoHelper::PrivateKey privKey;
 
+    /* Successfully verified signatures, most recently used first */
+    constexpr static std::size_t VERIFIED_SIGNATURES_SIZE = 4096;
+    using verified_key_t = std::pair<CryptoHelper::PublicKeyHash, CryptoHelper::SHA3>;
+    using verified_list_t = std::list<std::pair<verified_key_t, std::vector<std::uint8_t>>>;
+    mutable struct {
+        std::recursive_mutex mux;
+        verified_list_t signatures;
+        std::map<verified_key_t, verified_list_t::iterator> index;
+    } verified;
+
     /* Other services */
     struct {
         std::recursive_mutex mux;
@@ -344,6 +382,13 @@ private:
 
         void startSync();
         void stopSync();
+        // Called when a sync slot is free after the peer had to wait for one
+        void continueSync();
+        // Tell the peer about transactions committed here
+        void announceTransactions(const CryptoHelper::SHA3& dbHash,
+            const std::vector<CryptoHelper::SHA3>& hashes);
+        // Sync a database now, the peer announced transactions we do not have
+        void syncDatabase(const CryptoHelper::SHA3& dbHash);
         void onPeerConnectionStatus(mist::Peer::ConnectionStatus status);
 
         void listServices(Central::peer_service_list_callback callback);
@@ -362,6 +407,22 @@ private:
         using manifest_vector_t = std::vector<Database::Manifest>;
         using sha3_vector_t = std::vector<CryptoHelper::SHA3>;
 
+        // A database being synced, the databases of a peer are synced side
+        // by side while the transactions of each are written in order
+        struct DatabaseSync {
+            explicit DatabaseSync(Mist::Database* database)
+                : database(database), reconcileFallback(false), complete(false) {}
+            Mist::Database* database;
+            std::set<std::string> transactionParentsToDownload;
+            std::map<std::string,JSON::Value> transactionsToDownload;
+            std::vector<std::string> transactionToDownloadInOrder;
+            // Set when the database is synced the old way instead
+            bool reconcileFallback;
+            // Set when all transactions the peer listed have been written
+            bool complete;
+        };
+        using database_sync_ptr = std::shared_ptr<DatabaseSync>;
+
         std::string shortFinger() const;
 
         void onDisconnect();
@@ -376,10 +437,18 @@ private:
         void connectDirectDone();
 //        void queryDatabases();
 //        void queryDatabasesDone();
+        void queryCapabilities();
         void queryTransactions();
+        void queryDatabaseHeads();
         void queryTransactionsNext();
-        void queryTransactionsGetNextParent();
-        void queryTransactionsDownloadNextTransaction(std::vector<std::string>::iterator it);
+        void queryTransactionsDatabase(database_sync_ptr sync);
+        void queryTransactionsReconcile(database_sync_ptr sync, std::size_t cells);
+        void queryTransactionsGetNextParent(database_sync_ptr sync);
+        void queryTransactionsDownloadNextTransaction(database_sync_ptr sync,
+            std::vector<std::string>::iterator it);
+        void queryTransactionsDownloadBatch(database_sync_ptr sync,
+            std::vector<std::string>::iterator it);
+        void queryTransactionsDatabaseDone(database_sync_ptr sync);
         void queryTransactionsDone();
         void queryInvites();
         void queryInvitesDone();
@@ -392,6 +461,8 @@ private:
             ConnectTor,
 //            QueryDatabases,
             QueryTransactions,
+            QueryInvites,
+            Synced,
         } state;
         Mist::Central& central;
 
@@ -399,17 +470,23 @@ private:
         CryptoHelper::PublicKeyHash keyHash;
         mist::Peer& peer;
         bool anonymous;
-        Mist::Database *currentDatabase;
 
         std::recursive_mutex mux;
         std::vector<std::pair<std::string, std::uint16_t>> addressServers;
         std::vector<std::pair<std::string, std::uint16_t>> addresses;
         std::vector<Database::Manifest> databases;
-        sha3_vector_t databaseHashes;
-        sha3_vector_t::iterator databaseHashesIterator;
-        std::set<std::string> transactionParentsToDownload;
-        std::map<std::string,JSON::Value> transactionsToDownload;
-        std::vector<std::string> transactionToDownloadInOrder;
+        std::deque<CryptoHelper::SHA3> databaseQueue;
+        std::set<database_sync_ptr> databaseSyncs;
+        // Start of the last pass through all databases
+        std::chrono::steady_clock::time_point lastSync;
+        // Head digests of the databases of the peer, as listed for this pass
+        // and as of the last complete sync of each database
+        std::map<CryptoHelper::SHA3,CryptoHelper::SHA3> listedDigests;
+        std::map<CryptoHelper::SHA3,CryptoHelper::SHA3> syncedDigests;
+
+        // What the peer serves beyond the first version, see queryCapabilities
+        bool capabilitiesKnown;
+        std::set<std::string> capabilities;
     };
     friend class PeerSyncState;
 
@@ -425,6 +502,23 @@ private:
     void syncStep();
     PeerSyncState& getPeerSyncState( const CryptoHelper::PublicKeyHash& keyHash );
 
+    /* Databases synced at the same time, see setSyncConcurrency */
+    constexpr static std::size_t SYNC_DATABASES_PER_PEER = 4;
+    constexpr static std::size_t SYNC_DATABASES = 16;
+    struct {
+        std::mutex mux;
+        std::size_t perPeer;
+        std::size_t total;
+        std::size_t active;
+        // Peers to continue when a slot is released
+        std::deque<PeerSyncState*> waiting;
+    } syncSlots;
+    // Take a slot for a peer that syncs peerActive databases, when none is
+    // free the peer is continued later if it was limited by the total
+    bool acquireSyncSlot( PeerSyncState& peerState, std::size_t peerActive );
+    void releaseSyncSlot();
+    void cancelSyncSlot( PeerSyncState& peerState );
+
     /* connCtx callbacks */
     void authenticatePeer( mist::Peer& peer );
     void onPeerConnectionStatus( mist::Peer& peer,
@@ -465,9 +559,18 @@ private:
         void transactionsFrom( const CryptoHelper::SHA3& dbHash,
             const std::vector<CryptoHelper::SHA3>& from );
         void transactionsNew( const CryptoHelper::SHA3& dbHash );
+        void transactionsReconcile( const CryptoHelper::SHA3& dbHash );
+        void transactionsBatch( const CryptoHelper::SHA3& dbHash );
+        void transactionsBatchFrom( const CryptoHelper::SHA3& dbHash,
+            const std::vector<CryptoHelper::SHA3>& from );
+        // The database if the peer may read it, otherwise replies and returns nullptr
+        Mist::Database* readableDatabase( const CryptoHelper::SHA3& dbHash );
+
+        void capabilities( const std::vector<std::string>& elts );
 
         void databases( const std::vector<std::string>& elts );
         void databasesAll();
+        void databasesHeads();
 
         void users( const std::vector<std::string>& elts );
         void usersAll( const CryptoHelper::SHA3& dbHash );
@@ -482,6 +585,7 @@ private:
         void replyBadMethod();
         void replyNotFound();
         void replyNotAuthorized();
+        void replyConflict();
     };
     friend class RestRequest;
 
@@ -8,12 +8,22 @@
 #define SRC_DATABASE_H_
 
 // STL
+#include <array>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <future>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <streambuf>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <SQLiteCpp/SQLiteCpp.h>
@@ -51,8 +61,9 @@ class Serializer;
  */
 class Database {
 public:
-    using Connection = Helper::Database::Database;
+    using Connection = Helper::Database::Connection;
     using Statement = Helper::Database::Statement;
+    using CachedStatement = Helper::Database::CachedStatement;
 
     class Manifest {
         std::string name;
@@ -92,6 +103,61 @@ public:
 
     };
 
+    /**
+     * A read-only connection borrowed from the pool of a Database and handed
+     * back when it goes out of scope. All reads on it are made in one read
+     * transaction, so they see the same WAL snapshot even while the writer
+     * commits. It must not outlive the Database.
+     */
+    class ReadConnection {
+    public:
+        ReadConnection( const Database* database, std::unique_ptr<Connection> connection );
+        ReadConnection( ReadConnection&& other ) = default;
+        ReadConnection( const ReadConnection& ) = delete;
+        ReadConnection& operator=( const ReadConnection& ) = delete;
+        virtual ~ReadConnection();
+
+        Connection* get() const { return connection.get(); }
+        Connection& operator*() const { return *connection; }
+        Connection* operator->() const { return connection.get(); }
+
+    protected:
+        const Database* database;
+        std::unique_ptr<Connection> connection;
+    };
+
+    /**
+     * Invertible Bloom lookup table of transaction hashes, used by peers to
+     * find the transactions only one of them has. The difference of the
+     * sketches of two sets decodes into the hashes that differ, as long as
+     * there are clearly fewer of them than cells.
+     */
+    class Sketch {
+    public:
+        explicit Sketch( std::size_t cells );
+        virtual ~Sketch() = default;
+
+        std::size_t size() const { return cells.size(); }
+        void insert( const CryptoHelper::SHA3& hash );
+        void subtract( const Sketch& other );
+        // Split a difference into the hashes of the sketch subtracted from
+        // and the hashes of the other sketch, false if it can not be decoded
+        bool decode( std::vector<CryptoHelper::SHA3>& here,
+                std::vector<CryptoHelper::SHA3>& there ) const;
+        std::string toString() const;
+        static Sketch fromString( const std::string& serialized );
+
+    private:
+        using key_t = std::array<std::uint8_t, 32>;
+        struct Cell {
+            long long count;
+            key_t keySum;
+            std::uint32_t checkSum;
+        };
+        void toggle( const key_t& key, long long count );
+        std::vector<Cell> cells;
+    };
+
     enum class AccessDomain
         : std::int8_t {
             Settings = 1,
@@ -197,6 +263,20 @@ public:
     constexpr static unsigned long ALLOCATE_64_BIT = 1024 * 1024 * 1024;
     constexpr static unsigned ROOT_OBJECT_ID = 0;
     constexpr static unsigned USERS_OBJECT_ID = 1;
+    // Distance between the versions of consecutive transactions, leaves room
+    // for transactions that are received out of order.
+    constexpr static unsigned VERSION_STRIDE = 256;
+    // Smallest average distance left between versions when they are spread out
+    constexpr static unsigned VERSION_MIN_GAP = 16;
+    constexpr static int SCHEMA_VERSION = 5;
+    // Number of parsed queries kept for reuse, see compiledQuery
+    constexpr static std::size_t QUERY_CACHE_SIZE = 64;
+    // Idle read-only connections kept open, see getReadConnection
+    constexpr static std::size_t READ_CONNECTION_POOL_SIZE = 4;
+    // Transactions written in one SQLite transaction by ingest
+    constexpr static std::size_t INGEST_BATCH_SIZE = 1000;
+    // Largest sketch accepted from a peer, see Sketch
+    constexpr static std::size_t SKETCH_CELLS_MAX = 1 << 16;
 
     Database( Central *central, std::string path );
     virtual ~Database();
@@ -214,6 +294,33 @@ public:
      */
     std::unique_ptr<Mist::Transaction> beginTransaction();
 
+    /**
+     * Commit a transaction on the writer thread of the database instead of
+     * the calling thread. Commits are made in the order they are queued.
+     * The future is ready when the commit is durable and the subscriptions
+     * have been notified, and holds the exception if the commit failed.
+     */
+    std::future<void> commitAsync( std::unique_ptr<Mist::Transaction> transaction );
+    std::future<void> commitAsync( std::unique_ptr<Mist::RemoteTransaction> transaction );
+
+    /**
+     * Write local transactions in groups. The transactions committed until
+     * maxTransactions have been committed, or windowMilliseconds have passed
+     * since the first of them, are written in one SQLite transaction and the
+     * subscriptions are notified once for all of them. Each transaction is
+     * still hashed and signed on its own. Until the group is written its
+     * changes are only visible to the transactions of the group. Only one
+     * transaction can be open at a time. Without a window the group waits
+     * for maxTransactions or flushGroupCommit. Transactions from peers wait
+     * for the open transaction of the group to end and write the group
+     * first. A maxTransactions of 0 or 1 turns group commits off.
+     */
+    void setGroupCommit( unsigned maxTransactions, unsigned windowMilliseconds = 0 );
+    /**
+     * Write the transactions of the current group now.
+     */
+    void flushGroupCommit();
+
     bool isOK(); // TODO: fix proper error handling instead!
 
     void inviteUser( const UserAccount& user ); // TODO make some call to central, or the other way around?
@@ -229,6 +336,18 @@ public:
         double functionValue{};
 
         std::vector<Object> objects;
+        // Continues a paged query after these objects, empty on the last page
+        std::string cursor{};
+    };
+
+    /**
+     * Changes to the result of a query since it was last delivered. Objects
+     * with a new version are changed, removed objects are only referenced.
+     */
+    struct QueryDelta {
+        std::vector<Object> added;
+        std::vector<Object> changed;
+        std::vector<ObjectRef> removed;
     };
 
     /**
@@ -241,20 +360,72 @@ public:
     unsigned subscribeObject( std::function<void(Object)> cb, int accessDomain,
             long long id, bool includeDeleted = false );
 
+    /**
+     * Borrow a read-only connection from the pool, a new one is opened when
+     * none is idle. Safe to call from any thread.
+     */
+    ReadConnection getReadConnection() const;
+    /**
+     * Read an object or the result of a query on a pooled read-only
+     * connection. Unlike getObject and query they do not use the main
+     * connection or the query cache, so they can run on worker threads
+     * while another thread commits.
+     */
+    Object readObject( int accessDomain, long long id, bool includeDeleted = false ) const;
+    QueryResult readQuery( int accessDomain, long long parentId, const std::string& select,
+            const std::string& filter, const std::string& sort,
+            const std::map<std::string, Value>& args,
+            int maxVersion, bool includeDeleted = false,
+            unsigned pageSize = 0, const std::string& cursor = "" );
+
+    /**
+     * With a page size, at most that many objects are returned together with
+     * a cursor that is passed to get the next page. Pages are in the sort
+     * order and then by version and id. Function queries are not paged.
+     */
     QueryResult query( int accessDomain, long long parentId, const std::string& select,
             const std::string& filter, const std::string& sort,
             const std::map<std::string, Value>& args,
-            int maxVersion, bool includeDeleted = false );
+            int maxVersion, bool includeDeleted = false,
+            unsigned pageSize = 0, const std::string& cursor = "" );
     QueryResult query( Connection* connection, int accessDomain, long long parentId, const std::string& select,
                 const std::string& filter, const std::string& sort,
                 const std::map<std::string, Value>& args,
-                int maxVersion, bool includeDeleted = false );
+                int maxVersion, bool includeDeleted = false,
+                unsigned pageSize = 0, const std::string& cursor = "" );
     QueryResult query( const Query& querier, Connection* connection );
+    /**
+     * Call fn with each object of a query in order, while the statement is
+     * still open, instead of collecting them in a QueryResult. Function
+     * queries are not supported.
+     */
+    void mapQuery( std::function<void(const Object&)> fn,
+            int accessDomain, long long parentId, const std::string& select,
+            const std::string& filter, const std::string& sort,
+            const std::map<std::string, Value>& args,
+            int maxVersion, bool includeDeleted = false );
+    void mapQuery( std::function<void(const Object&)> fn, Connection* connection,
+            int accessDomain, long long parentId, const std::string& select,
+            const std::string& filter, const std::string& sort,
+            const std::map<std::string, Value>& args,
+            int maxVersion, bool includeDeleted = false );
+    void mapQuery( std::function<void(const Object&)> fn, const Query& querier,
+            Connection* connection );
     unsigned subscribeQuery( std::function<void(QueryResult)> cb,
             int accessDomain, long long parentId, const std::string& select,
             const std::string& filter, const std::string& sort,
             const std::map<std::string, Value>& args,
             int maxVersion, bool includeDeleted = false );
+    /**
+     * Subscribe to the changes of a query result. The current result is
+     * delivered as added objects before returning. Function queries are
+     * not supported, subscribe to them with subscribeQuery.
+     */
+    unsigned subscribeQueryDelta( std::function<void(QueryDelta)> cb,
+            int accessDomain, long long parentId, const std::string& select,
+            const std::string& filter, const std::string& sort,
+            const std::map<std::string, Value>& args,
+            int maxVersion, bool includeDeleted = false );
 
     QueryResult queryVersion( int accessDomain, long long parentId, const std::string& select,
             const std::string& filter, const std::map<std::string, Value>& args,
@@ -275,6 +446,34 @@ public:
     void writeToDatabase( std::basic_streambuf<char>& sb );
     void writeToDatabase( const char* data, std::size_t length );
     void writeToDatabase( const std::string& data );
+    /**
+     * Write exchange format data on the writer thread. done is called on
+     * that thread when it has been committed, with the exception if it failed.
+     */
+    void writeToDatabaseAsync( const std::string& data,
+            std::function<void(std::exception_ptr)> done );
+    /**
+     * A parser of its own for data that arrives in parts, such as a batch
+     * of transactions downloaded from a peer, so that parts of other
+     * streams may be written in between.
+     */
+    std::shared_ptr<Deserializer> openWriteStream();
+    void writeToStreamAsync( std::shared_ptr<Deserializer> stream,
+            const std::string& data,
+            std::function<void(std::exception_ptr)> done );
+    /**
+     * Write a stream of many exchange format transactions, such as the
+     * output of dump, when a replica is first synced. The transactions are
+     * sorted once by timestamp and hash, so they are added at the end of the
+     * order, and written INGEST_BATCH_SIZE at a time in one SQLite
+     * transaction. The hash of each transaction is verified as it is
+     * written, while the signatures of the batch are verified on worker
+     * threads. If any transaction in a batch fails, the whole batch is
+     * rolled back and the error is thrown. Batches committed before it are kept. Transactions
+     * already in the database are skipped. Returns the number of
+     * transactions written.
+     */
+    std::size_t ingest( std::basic_streambuf<char>& sb );
 
     // TODO: serializer have to be reset after throw, change that!
     void readTransaction( std::basic_streambuf<char>& sb,
@@ -293,6 +492,14 @@ public:
     void readTransactionMetadataLastest( std::basic_streambuf<char>& sb ) const;
     void readTransactionMetadataFrom( std::basic_streambuf<char>& sb,
             const std::vector<std::string>& hashes ) const;
+    void readTransactionMetadataOf( std::basic_streambuf<char>& sb,
+            const std::vector<std::string>& hashes ) const;
+    // Whole transactions in the given order, and all transactions after
+    // the given ones in version order
+    void readTransactions( std::basic_streambuf<char>& sb,
+            const std::vector<std::string>& hashes ) const;
+    void readTransactionsFrom( std::basic_streambuf<char>& sb,
+            const std::vector<std::string>& hashes ) const;
 
     void readUser( std::basic_streambuf<char>& sb,
             const std::string& userHash ) const;
@@ -313,6 +520,15 @@ public:
 
     std::vector<Database::Transaction> getTransactionLatest() const;
     std::vector<Database::Transaction> getTransactionList() const;
+    // Answered from the in-memory transaction graph
+    bool haveTransaction( const CryptoHelper::SHA3& hash ) const;
+    std::vector<CryptoHelper::SHA3> getTransactionHeads() const;
+    // Digest of the heads, the same for databases with the same transactions
+    CryptoHelper::SHA3 getHeadDigest() const;
+    Sketch getTransactionSketch( std::size_t cells ) const;
+    // The transactions missing from the set of a peer's sketch, oldest first.
+    // Throws when the sketch is too small for the difference.
+    std::vector<std::string> getTransactionsMissingFrom( const Sketch& sketch ) const;
     std::vector<Database::Transaction> getTransactionsFrom(
             const std::vector<std::string>& hashIds,
             Connection* connection = nullptr ) const;
@@ -336,6 +552,30 @@ protected:
     friend class Mist::Deserializer;
     friend class Mist::Serializer;
 
+    /**
+     * Held while transactions from peers are written on a connection of
+     * their own. It waits for the open transaction of a group commit to
+     * end and writes the group, since the group holds the write lock of
+     * the database, and no transaction of a group begins until it is let go.
+     */
+    class RemoteWrite {
+    public:
+        explicit RemoteWrite( Database* database );
+        RemoteWrite( const RemoteWrite& ) = delete;
+        RemoteWrite& operator=( const RemoteWrite& ) = delete;
+        virtual ~RemoteWrite();
+
+    protected:
+        Database* database;
+    };
+
+    // A job of the writer thread, a remote write waits for the open
+    // transaction of a group commit, see submitWrite
+    struct WriterJob {
+        std::function<void()> run;
+        bool remote;
+    };
+
     using map_trans_f = std::function<void(const Database::Transaction&)>;
     using map_meta_f = std::function<void(const Database::Meta&)>;
     using map_obj_f = std::function<void(const Database::Object&)>;
@@ -345,6 +585,31 @@ protected:
             const std::string&,
             const std::string&)>;
 
+    // What a commit changed among the children of one parent
+    struct ChildrenChange {
+        bool membership{ false };
+        std::set<std::string> attributes{};
+        std::set<unsigned long> objects{};
+    };
+
+    // A transaction in the in-memory transaction graph. Versions are left
+    // out since reorderTransaction may move them, timestamp and hash give
+    // the same order.
+    struct GraphNode {
+        std::string timestamp;
+        std::vector<CryptoHelper::SHA3> parents;
+        std::vector<CryptoHelper::SHA3> children;
+    };
+    using graph_nodes_t = std::vector<std::pair<CryptoHelper::SHA3,GraphNode>>;
+
+    // Values of the objects a function subscription aggregates
+    struct FunctionAggregate {
+        std::map<unsigned long,double> values{};
+        double sum{};
+        double min{};
+        double max{};
+    };
+
     void mapTransactions( map_trans_f fn,
             Connection* connection = nullptr ) const;
     void mapTransactionLatest( map_trans_f fn,
@@ -358,8 +623,7 @@ protected:
     void mapParents( map_trans_f fn, const Database::Transaction& transaction,
             Connection* connection = nullptr ) const;
 
-    bool haveAll( const std::vector<std::string>& transactionHashes,
-            Connection* connection = nullptr ) const;
+    bool haveAll( const std::vector<std::string>& transactionHashes ) const;
 
     /*
      * Help methods for users
@@ -368,35 +632,88 @@ protected:
     void mapUsers( map_user_f fn ) const;
     void mapUsersFrom( map_user_f fn, const std::vector<std::string>& userIds ) const;
 
-    std::shared_ptr<UserAccount> getUser( const std::string& userHash ) const;
+    std::shared_ptr<UserAccount> getUser( const std::string& userHash,
+            Connection* connection = nullptr ) const;
 
     /*
      * Transactions
      */
+    // With a batch connection the transaction is written as part of the batch
+    // and its signature is verified when the batch is, see ingest
     std::unique_ptr<Mist::RemoteTransaction> beginRemoteTransaction(
             Database::AccessDomain accessDomain,
             std::vector<Database::Transaction> parents,
             Helper::Date timestamp,
             CryptoHelper::SHA3 userHash,
             CryptoHelper::SHA3 hash,
-            CryptoHelper::Signature signature );
+            CryptoHelper::Signature signature,
+            Connection* batchConnection = nullptr );
+    CryptoHelper::PublicKey transactionSigner( const CryptoHelper::SHA3& userHash,
+            Connection* connection = nullptr ) const;
+    // Verify the signatures of a batch on worker threads, see ingest
+    std::future<std::vector<char>> verifySignatures( const std::vector<Meta>& batch,
+            Connection* connection ) const;
+    std::size_t verifyBatch( const std::vector<Meta>& batch, std::vector<char> signatures,
+            Connection* connection ) const;
+    void batchCommitted( const std::set<ObjectRef,lessObjectRef>& objects,
+            const CryptoHelper::SHA3& hash, GraphNode node );
 
     std::unique_ptr<Connection> getIsolatedDbConnection() const;
+    void releaseReadConnection( std::unique_ptr<Connection> connection ) const;
+    void endGroupTransaction( const std::set<ObjectRef,lessObjectRef>& objects, bool committed,
+            const CryptoHelper::SHA3& hash = CryptoHelper::SHA3(), GraphNode node = GraphNode() );
+    void loadGraph();
+    void addToGraph( const graph_nodes_t& nodes );
+    // Tell the peers of central about transactions committed here
+    void announceTransactions( const std::vector<CryptoHelper::SHA3>& hashes );
+    std::future<void> submitWrite( std::function<void()> job, bool remote = false );
+    // Queue the remote writes that waited for the group at the front of the
+    // writer queue, with mux held
+    void resumeRemoteWrites();
+    // Have the writer thread write the group at deadline, if it is still open
+    void scheduleGroupFlush( unsigned group, std::chrono::steady_clock::time_point deadline );
+    void runWriter();
+    void stopWriter();
     CryptoHelper::SHA3 calculateTransactionHash( const Database::Transaction& transaction,
             Connection* connection = nullptr ) const;
     unsigned reorderTransaction( const Database::Transaction& tranasaction,
             Connection* connection = nullptr );
+    void migrate();
+    void createIndexes();
+    void createObjectHeadTable();
+    void updateObjectHeads( unsigned version, Connection* connection = nullptr );
+    Query& compiledQuery( bool versionsQuery, int accessDomain, long long parentId,
+            const std::string& select, const std::string& filter, const std::string& sort,
+            const std::map<std::string,ArgumentVT>& args, int maxVersion, bool includeDeleted,
+            unsigned pageSize = 0, bool afterCursor = false );
+    static void bindQueryArguments( Database::Statement& statement, const Query& querier );
     CryptoHelper::Signature signTransaction( const CryptoHelper::SHA3& hash ) const;
 
     void usersChanged( const ObjectRef& userObject );
     //void objectChanged( const ObjectRef& objectRef );
     void objectsChanged( const std::set<Database::ObjectRef, Database::lessObjectRef>& objects );
+    bool describeChange( const ObjectRef& objectRef,
+            std::map<ObjectRef,ChildrenChange,lessObjectRef>& changes );
+    static QueryDelta diffObjects( const std::vector<Object>& objects,
+            std::map<ObjectRef,unsigned,lessObjectRef>& delivered );
+    void loadAggregate( const Query& querier, FunctionAggregate& aggregate );
+    void updateAggregate( const Query& querier, FunctionAggregate& aggregate,
+            const std::set<unsigned long>& objects );
+    static double aggregateValue( const std::string& functionName,
+            const FunctionAggregate& aggregate );
+    void registerQuerySubscriber( unsigned subscriber, const Query& querier,
+            int accessDomain, long long id, bool versionsQuery );
     void rollback( Mist::RemoteTransaction *transaction );
     void rollback( Mist::Transaction *transaction );
     void commit( Mist::RemoteTransaction *transaction );
     void commit( Mist::Transaction *transaction );
 
     static Database::Transaction statementRowToTransaction( Database::Statement& stmt );
+    // Transaction hashes and signatures are stored as BLOBs, empty values as NULL
+    static Helper::Database::Blob toBlob( const CryptoHelper::SHA3& hash );
+    static Helper::Database::Blob toBlob( const CryptoHelper::Signature& signature );
+    static CryptoHelper::SHA3 columnToHash( const Helper::Database::Column& column );
+    static CryptoHelper::Signature columnToSignature( const Helper::Database::Column& column );
     static Database::Object statementRowToObject( Database::Statement& stmt, std::map<std::string, Database::Value> attributes );
     static Database::ObjectMeta statementRowToObjectMeta( Database::Statement& stmt );
     static Database::Value statementRowToValue( Database::Statement& attribute );
@@ -405,8 +722,7 @@ protected:
 
     std::vector<CryptoHelper::SHA3> getParents( unsigned version,
             Connection* connection = nullptr ) const;
-    std::vector<CryptoHelper::SHA3> getParents( CryptoHelper::SHA3 transactionHash,
-            Connection* connection = nullptr ) const;
+    std::vector<CryptoHelper::SHA3> getParents( CryptoHelper::SHA3 transactionHash ) const;
 
     const std::string& getUserHash() { return userHash; }
 
@@ -422,6 +738,49 @@ protected:
     std::string path;
     std::string userHash;
     std::unique_ptr<Connection> db;
+    // Idle read-only connections, see getReadConnection
+    mutable std::mutex readConnectionsMutex{};
+    mutable std::vector<std::unique_ptr<Connection>> readConnections{};
+    // Commits queued for the writer thread, see submitWrite
+    std::thread writer{};
+    std::mutex writerMutex{};
+    std::condition_variable writerCondition{};
+    std::deque<WriterJob> writerQueue{};
+    bool writerStopping{ false };
+    std::thread::id writerThread{};
+    // The group window timed by the writer thread, see scheduleGroupFlush
+    bool groupTimerArmed{ false };
+    unsigned groupTimerSequence{ 0 };
+    std::chrono::steady_clock::time_point groupTimerDeadline{};
+    // Group commit, see setGroupCommit. The group is one SQLite transaction
+    // on groupConnection, each local transaction is a savepoint within it.
+    unsigned groupCommitSize{ 0 };
+    std::chrono::milliseconds groupCommitWindow{ 0 };
+    std::chrono::steady_clock::time_point groupCommitDeadline{};
+    std::unique_ptr<Connection> groupConnection{};
+    std::unique_ptr<Helper::Database::Transaction> groupTransaction{};
+    bool groupMemberOpen{ false };
+    std::thread::id groupMemberThread{};
+    // Remote writes queued while a transaction of the group was open, and
+    // the threads holding a RemoteWrite, see RemoteWrite
+    std::deque<std::function<void()>> groupWaiting{};
+    std::multiset<std::thread::id> remoteWriteThreads{};
+    std::condition_variable_any groupCondition{};
+    unsigned groupCommitted{ 0 };
+    unsigned groupSequence{ 0 };
+    std::set<ObjectRef,lessObjectRef> groupObjects{};
+    graph_nodes_t groupNodes{};
+    // Objects changed and transactions written by the batch being ingested
+    std::set<ObjectRef,lessObjectRef> batchObjects{};
+    graph_nodes_t batchNodes{};
+    // The committed transactions by hash and the ones without children,
+    // loaded by init and kept up to date by the commits
+    mutable std::mutex graphMutex{};
+    std::map<CryptoHelper::SHA3,GraphNode> graph{};
+    std::set<CryptoHelper::SHA3> graphHeads{};
+    // Held while the main connection, the query cache or the subscriptions
+    // are used, since commits notify the subscriptions on the writer thread
+    mutable std::recursive_mutex mux{};
     std::unique_ptr<Deserializer> deserializer;
     std::unique_ptr<Serializer> serializer;
 
@@ -438,6 +797,27 @@ protected:
         std::unique_ptr<Query>,
         double,
         std::function<void(QueryResult)>>> queryFunctionSubscriberCallback{};
+    // Function subscriptions that are updated from the changed objects only
+    std::map<unsigned,FunctionAggregate> functionAggregates{};
+    // The version of each object last delivered to a delta subscriber
+    std::map<unsigned,std::tuple<
+        std::unique_ptr<Query>,
+        std::map<ObjectRef,unsigned,lessObjectRef>,
+        std::function<void(QueryDelta)>>> queryDeltaSubscriberCallback{};
+
+    // Query and function subscriptions by the parent whose children they read,
+    // version subscriptions are found through objectSubscribers instead
+    std::map<ObjectRef,std::set<unsigned>,lessObjectRef> parentSubscribers{};
+    std::map<unsigned,ObjectRef> subscriberParent{};
+    // Attribute names a subscription depends on. Subscriptions without an
+    // entry are re-evaluated on every change under their parent.
+    std::map<unsigned,std::set<std::string>> subscriberAttributes{};
+
+    // Parsed queries by shape, most recently used first in queryCacheOrder
+    std::list<std::string> queryCacheOrder{};
+    std::map<std::string,std::pair<
+        std::unique_ptr<Query>,
+        std::list<std::string>::iterator>> queryCache{};
 };
 
 } /* namespace Mist */
@@ -50,6 +50,7 @@
 #define INCLUDE_EXCHANGEFORMAT_H_
 
 #include <memory>
+#include <ostream>
 #include <stack>
 #include <streambuf>
 #include <string>
@@ -57,6 +58,7 @@
 
 #include "Database.h"
 #include "Exception.h"
+#include "Helper.h"
 #include "JSONstream.h"
 
 namespace Mist {
@@ -75,24 +77,38 @@ using S = ExchangeState;
 
 class Serializer {
 public:
-    Serializer( Database* db );
+    Serializer( const Database* db );
     virtual ~Serializer() = default;
 
     virtual void readTransaction( std::basic_streambuf<char>& sb,
             const std::string& hash,
-            Helper::Database::Database* connection );
+            Helper::Database::Connection* connection );
     virtual void readTransactionBody( std::basic_streambuf<char>& sb,
             const std::string& hash,
-            Helper::Database::Database* connection );
+            Helper::Database::Connection* connection );
     virtual void readTransactionBody( std::basic_streambuf<char>& sb,
             unsigned version,
-            Helper::Database::Database* connection );
-    virtual void readTransactionList( std::basic_streambuf<char>& sb );
+            Helper::Database::Connection* connection );
+    virtual void readTransactionList( std::basic_streambuf<char>& sb,
+            Helper::Database::Connection* connection = nullptr );
     virtual void readTransactionMetadata( std::basic_streambuf<char>& sb,
-            const std::string& hash );
-    virtual void readTransactionMetadataLatest( std::basic_streambuf<char>& sb );
+            const std::string& hash,
+            Helper::Database::Connection* connection = nullptr );
+    virtual void readTransactionMetadataLatest( std::basic_streambuf<char>& sb,
+            Helper::Database::Connection* connection = nullptr );
     virtual void readTransactionMetadataFrom( std::basic_streambuf<char>& sb,
-            const std::vector<std::string>& hashes );
+            const std::vector<std::string>& hashes,
+            Helper::Database::Connection* connection = nullptr );
+    virtual void readTransactionMetadataOf( std::basic_streambuf<char>& sb,
+            const std::vector<std::string>& hashes,
+            Helper::Database::Connection* connection = nullptr );
+    // Transactions one after the other, each on a line of its own
+    virtual void readTransactions( std::basic_streambuf<char>& sb,
+            const std::vector<std::string>& hashes,
+            Helper::Database::Connection* connection = nullptr );
+    virtual void readTransactionsFrom( std::basic_streambuf<char>& sb,
+            const std::vector<std::string>& hashes,
+            Helper::Database::Connection* connection = nullptr );
 
     // TODO: change the user format? it does not contain any verifiable data
     virtual void readUser( std::basic_streambuf<char>& sb, const std::string& user );
@@ -105,11 +121,11 @@ protected:
 
     // TODO: change many of these to use Database::Meta instead!
     virtual void trans( const Database::Transaction& transaction,
-            Helper::Database::Database* connection ) const;
+            Helper::Database::Connection* connection ) const;
     virtual void transBody( const Database::Transaction& transaction,
-            Helper::Database::Database* connection ) const;
+            Helper::Database::Connection* connection ) const;
     virtual void meta( const Database::Transaction& transaction,
-            Helper::Database::Database* connection ) const;
+            Helper::Database::Connection* connection ) const;
     virtual void hash( const Database::Transaction& transaction) const;
 
     virtual void changed( const Database::Object& object ) const;
@@ -122,7 +138,7 @@ protected:
             const std::string& permission,
             const std::string& publicKey ) const;
 
-    Database* db;
+    const Database* db;
     std::basic_streambuf<char>* sb;
 
     std::unique_ptr<JSON::Serialize> s;
@@ -131,7 +147,8 @@ protected:
 
 class Deserializer : public JSON::Event_handler {
 public:
-    Deserializer( Database* db );
+    // With a connection the transactions are written as part of a batch on it
+    Deserializer( Database* db, Helper::Database::Connection* connection = nullptr );
     virtual ~Deserializer() = default;
 
     virtual void write( std::basic_streambuf<char>& sb );
@@ -177,7 +194,15 @@ protected:
 
     virtual void pop();
 
+    // The canonical body of the transaction being written is hashed as it is
+    // parsed, so the hash can be verified without reading it back from the db
+    virtual void hashMetadata();
+    virtual void hashSection( unsigned section );
+    virtual CryptoHelper::SHA3 hashBody();
+    virtual void hashReset();
+
     Database* db; // TODO: refactor to use weak pointer instead?
+    Helper::Database::Connection* connection{ nullptr };
     bool alreadyExists{ false };
     map_meta_f cb;
     std::unique_ptr<JSON::Deserialize> d;
@@ -198,6 +223,13 @@ protected:
     std::string objId{}, attrName{};
     Database::Value value{};
     std::map<std::string, Database::Value> attributes{};
+
+    // Serializes the body in the same form as Serializer::transBody into the hasher
+    CryptoHelper::SHA3Hasher hasher{};
+    std::unique_ptr<StreamToString<>> hashStream{};
+    std::unique_ptr<std::basic_ostream<char>> hashOstream{};
+    std::unique_ptr<JSON::Serialize> body{};
+    unsigned bodySection{ 0 };
 };
 
 } /* namespace Mist */
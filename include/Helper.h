@@ -11,6 +11,8 @@
 #include <cassert>
 #include <ctime>
 #include <functional>
+#include <map>
+#include <mutex>
 #include <streambuf>
 #include <string>
 
@@ -37,10 +39,60 @@ const int OPEN_CREATE = SQLITE_OPEN_CREATE;
 const int OPEN_URI = SQLITE_OPEN_URI;
 const int OK = SQLITE_OK;
 
+using Blob = SQLite::Blob;
 using Exception = SQLite::Exception;
 using Statement = SQLite::Statement;
 using Transaction = SQLite::Transaction;
 
+class Connection;
+
+/**
+ * A prepared statement borrowed from the statement cache of a Connection.
+ * It is used like a Statement and is reset, has its bindings cleared and
+ * is handed back to the cache when it goes out of scope, so columns must
+ * not be kept after that.
+ */
+class CachedStatement : public Statement {
+public:
+    typedef Statement::Ptr Ptr;
+
+    CachedStatement( Connection& connection, const std::string& query );
+    virtual ~CachedStatement() noexcept;
+
+protected:
+    Connection& connection;
+};
+
+/**
+ * Database connection that keeps the statements used through
+ * CachedStatement prepared, keyed by their SQL text. The cache may be
+ * used from several threads, SQLite serializes the connection itself.
+ */
+class Connection : public Database {
+public:
+    using Database::Database;
+    virtual ~Connection() noexcept = default;
+
+    // Statements kept prepared, more statements are finalized when released
+    constexpr static std::size_t STATEMENT_CACHE_SIZE = 128;
+
+    unsigned long long getStatementCacheHits() const;
+    unsigned long long getStatementCacheMisses() const;
+
+protected:
+    friend class CachedStatement;
+
+    CachedStatement::Ptr takeStatement( const std::string& query );
+    void releaseStatement( const std::string& query, const CachedStatement::Ptr& statement );
+
+    // A statement is removed while it is borrowed so that nested uses of
+    // the same SQL get a statement of their own
+    std::multimap<std::string, CachedStatement::Ptr> statementCache;
+    unsigned long long statementCacheHits{ 0 };
+    unsigned long long statementCacheMisses{ 0 };
+    mutable std::mutex statementCacheMutex;
+};
+
 class SavePoint {
 protected:
     std::string name;
@@ -35,6 +35,7 @@ private:
 
   void getObject(const Nan::FunctionCallbackInfo<v8::Value>& info);
   void query(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  void mapQuery(const Nan::FunctionCallbackInfo<v8::Value>& info);
   void queryVersion(const Nan::FunctionCallbackInfo<v8::Value>& info);
   void subscribeObject(const Nan::FunctionCallbackInfo<v8::Value>& info);
   void subscribeQuery(const Nan::FunctionCallbackInfo<v8::Value>& info);
@@ -163,6 +164,8 @@ private:
     const Nan::PropertyCallbackInfo<v8::Value>& info);
   void getObjects(v8::Local<v8::String> name,
     const Nan::PropertyCallbackInfo<v8::Value>& info);
+  void getCursor(v8::Local<v8::String> name,
+    const Nan::PropertyCallbackInfo<v8::Value>& info);
 
 };
 
@@ -37,6 +37,7 @@ private:
 
   void getObject(const Nan::FunctionCallbackInfo<v8::Value>& info);
   void query(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  void mapQuery(const Nan::FunctionCallbackInfo<v8::Value>& info);
   void queryVersion(const Nan::FunctionCallbackInfo<v8::Value>& info);
 
 };
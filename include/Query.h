@@ -252,6 +252,8 @@ private:
 public:
     Filter();
     void parse( std::string str );
+    bool getNone() const { return none; }
+    std::set<std::string> getAttributes();
     void makeSQL( Query &res,
             const std::map<std::string,ArgumentVT> &args,
             int maxVersion,
@@ -276,7 +278,19 @@ public:
 class Query {
 private:
     std::string sqlQuery{};
+    // Per object values of a function, see getValuesSqlQuery
+    std::string valuesSqlQuery{};
+    std::string objectValueSqlQuery{};
     std::vector<ArgumentVT> args{};
+    // Position in args of each argument used by the filter
+    std::map<std::string,std::size_t> argumentIndex{};
+    // Attribute names compared by the filter
+    std::set<std::string> filterAttributes{};
+    int maxVersion{};
+    // Paged queries end with the cursor (when after one) and page size arguments
+    unsigned pageSize{};
+    bool afterCursor{};
+    std::size_t pageArgument{};
     Select select{};
     Filter filter{};
     Sort sort{};
@@ -286,6 +300,7 @@ private:
 
 public:
     static std::string printArg( int i );
+    static std::string objectTable( int maxVersion, bool versionsQuery );
 
     void parseQuery( int accessDomain,
             long long parent,
@@ -294,20 +309,50 @@ public:
             std::string sortStr,
             std::map<std::string,ArgumentVT> args,
             int maxVersion,
-            bool includeDeleted );
+            bool includeDeleted,
+            unsigned pageSize = 0,
+            bool afterCursor = false );
     void parseVersionQuery( int accessDomain,
             long long id,
             std::string selectStr,
             std::string filterStr,
             std::map<std::string,ArgumentVT> args,
             bool includeDeleted );
+    /**
+     * Replace the access domain, parent (or id for version queries) and
+     * filter arguments of a parsed query. The arguments must have the
+     * same types as when the query was parsed since the SQL depends on them.
+     */
+    void bindArguments( int accessDomain,
+            long long parent,
+            const std::map<std::string,ArgumentVT>& args );
+    /**
+     * Set the page size, and the sort value and id of the last object on
+     * the previous page, of a query parsed with a page size. The sort value
+     * is not used by unsorted queries. The cursor is ignored unless the
+     * query was parsed to continue after one.
+     */
+    void bindPage( unsigned pageSize, const ArgumentVT& sortValue, unsigned long id );
+    unsigned getPageSize() const { return pageSize; }
     std::string getSqlQuery() const { return sqlQuery; }
+    /**
+     * SQL listing the id and value of each object a function query
+     * aggregates, empty when the query is not a function of the current
+     * objects. getObjectValueSqlQuery lists a single object, given as an
+     * argument after getArgs().
+     */
+    std::string getValuesSqlQuery() const { return valuesSqlQuery; }
+    std::string getObjectValueSqlQuery() const { return objectValueSqlQuery; }
     std::vector<ArgumentVT> getArgs() const { return args; }
 
     bool isFunctionCall() const { return select.isFunctionCall(); }
     std::string getFunctionName() const { return select.getFunctionName(); }
     std::string getFunctionAttribute() const { return select.getFunctionAttribute(); }
     std::vector<std::string> getAttributes() const { return select.getAttributes(); }
+    bool getAll() const { return select.getAll(); }
+    const std::set<std::string>& getFilterAttributes() const { return filterAttributes; }
+    std::string getSortAttribute() const { return sort.getAttribute(); }
+    int getMaxVersion() const { return maxVersion; }
 };
 
 } /* namespace Mist */
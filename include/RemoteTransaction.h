@@ -26,7 +26,8 @@ public:
             Helper::Date timestamp,
             CryptoHelper::SHA3 userHash,
             CryptoHelper::SHA3 hash,
-            CryptoHelper::Signature signature
+            CryptoHelper::Signature signature,
+            Database::Connection* batchConnection = nullptr
     );
     virtual ~RemoteTransaction();
     virtual void init();
@@ -39,6 +40,8 @@ public:
     virtual void updateObject( unsigned long id, std::map<std::string, Database::Value> attributes );
     virtual void deleteObject( unsigned long id );
     virtual void commit();
+    // Commit with the hash of the body as it was written, see Deserializer
+    virtual void commit( const CryptoHelper::SHA3& bodyHash );
     virtual void rollback();
 
 protected:
@@ -57,8 +60,12 @@ protected:
 
 private:
     Database *db;
-    std::unique_ptr<Database::Connection> connection;
+    std::unique_ptr<Database::Connection> isolatedConnection;
+    // The isolated connection, or the connection of a batch, see Database::ingest
+    Database::Connection* connection;
     std::unique_ptr<Helper::Database::Transaction> transaction;
+    // Used instead of transaction when the transaction is part of a batch
+    std::unique_ptr<Helper::Database::SavePoint> savePoint;
     Database::AccessDomain accessDomain;
     unsigned version;
     std::vector<Database::Transaction> parents;
@@ -70,6 +77,8 @@ private:
     bool valid;
     std::map<Database::ObjectRef, unsigned long, Database::lessObjectRef> renumber;
     std::set<Database::ObjectRef, Database::lessObjectRef> affectedObjects;
+    // Added to the transaction graph on commit, parents is cleared by init
+    Database::GraphNode node;
 };
 
 } /* namespace Mist */
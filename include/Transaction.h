@@ -19,7 +19,8 @@ namespace Mist {
  */
 class Transaction {
 public:
-    Transaction( Database *db, Database::AccessDomain accessDomain, unsigned version );
+    Transaction( Database *db, Database::AccessDomain accessDomain, unsigned version,
+            Database::Connection* groupConnection = nullptr );
     virtual ~Transaction();
 private:
     void addAccessDomainDependency( Database::AccessDomain accessDomain, unsigned version );
@@ -47,7 +48,7 @@ public:
     virtual void deleteObject( unsigned long id );
     /**
      * Commit the transaction. It is stored and replicated to peers. May trigger subscribed queries to be
-     * reevaluated.
+     * reevaluated. Use Database::commitAsync to commit on the writer thread of the database instead.
      */
     virtual void commit();
     /**
@@ -69,6 +70,15 @@ public:
                 const std::map<std::string, Database::Value>& args,
                 int maxVersion, bool includeDeleted = false );
 
+    /**
+     * Map the objects of a query against the current transaction one at a time.
+     */
+    virtual void mapQuery( std::function<void(const Database::Object&)> fn,
+                int accessDomain, long long id, const std::string& select,
+                const std::string& filter, const std::string& sort,
+                const std::map<std::string, Database::Value>& args,
+                int maxVersion, bool includeDeleted = false );
+
     /**
      * Query version against the current transaction.
      */
@@ -78,8 +88,12 @@ public:
 
 private:
     Database *db;
-    std::unique_ptr<Database::Connection> connection;
+    std::unique_ptr<Database::Connection> isolatedConnection;
+    // The isolated connection, or the connection of a group commit
+    Database::Connection* connection;
     std::unique_ptr<Helper::Database::Transaction> transaction;
+    // Used instead of transaction when the transaction is part of a group commit
+    std::unique_ptr<Helper::Database::SavePoint> savePoint;
     Database::AccessDomain accessDomain;
     unsigned version;
 
@@ -12,6 +12,7 @@
 
 #include <SQLiteCpp/Exception.h>
 
+#include <atomic>
 #include <string>
 #include <map>
 
@@ -30,6 +31,17 @@ class Column;
 
 extern const int OK; ///< SQLITE_OK
 
+/**
+ * @brief A binary blob value to bind with Statement::operator <<
+ *
+ * A null apValue binds NULL.
+ */
+struct Blob
+{
+    const void* apValue;
+    int         aSize;
+};
+
 /**
  * @brief RAII encapsulation of a prepared SQLite Statement.
  *
@@ -332,6 +344,7 @@ public:
     Statement& operator <<( const double aValue );
     Statement& operator <<( const std::string& aValue );
     Statement& operator <<( const char* aValue );
+    Statement& operator <<( const Blob& aValue );
 
     ////////////////////////////////////////////////////////////////////////////
 
@@ -503,6 +516,8 @@ public:
     {
         return mColumnCount;
     }
+    /// Return the largest index of the parameters in the prepared statement
+    int getBindParameterCount() const noexcept; // nothrow
     /// true when a row has been fetched with executeStep()
     inline bool isOk() const
     {
@@ -521,7 +536,7 @@ public:
     /// Return UTF-8 encoded English language explanation of the most recent failed API call (if any).
     const char* getErrorMsg() const noexcept; // nothrow
 
-private:
+protected:
     /**
      * @brief Shared pointer to the sqlite3_stmt SQLite Statement Object.
      *
@@ -559,10 +574,24 @@ private:
     private:
         sqlite3*        mpSQLite;    //!< Pointer to SQLite Database Connection Handle
         sqlite3_stmt*   mpStmt;      //!< Pointer to SQLite Statement Object
-        unsigned int*   mpRefCount;  //!< Pointer to the heap allocated reference counter of the sqlite3_stmt
-                                     //!< (to share it with Column objects)
+        std::atomic<unsigned int>* mpRefCount; //!< Pointer to the heap allocated reference counter of the sqlite3_stmt
+                                               //!< (to share it with Column objects, and cached statements between threads)
     };
 
+    /**
+     * @brief Wrap an already prepared SQL query, used to reuse prepared statements
+     *
+     * @param[in] aQuery    the UTF-8 encoded query string the statement was prepared from
+     * @param[in] aStmtPtr  the prepared statement, sharing its reference counter
+     */
+    Statement(const std::string& aQuery, const Ptr& aStmtPtr);
+
+    /// Return the shared pointer to the prepared SQLite Statement Object
+    inline const Ptr& getStmtPtr() const
+    {
+        return mStmtPtr;
+    }
+
 private:
     /// @{ Statement must be non-copyable
     Statement(const Statement&);
@@ -44,6 +44,18 @@ Statement::Statement(Database &aDatabase, const std::string& aQuery) :
     mColumnCount = sqlite3_column_count(mStmtPtr);
 }
 
+// Wrap an already prepared SQL query
+Statement::Statement(const std::string& aQuery, const Ptr& aStmtPtr) :
+    mQuery(aQuery),
+    mStmtPtr(aStmtPtr),
+    mColumnCount(0),
+    mbOk(false),
+    mbDone(false),
+	mLastBoundIndex(0)
+{
+    mColumnCount = sqlite3_column_count(mStmtPtr);
+}
+
 
 // Finalize and unregister the SQL query from the SQLite Database Connection.
 Statement::~Statement() noexcept // nothrow
@@ -279,6 +291,11 @@ Statement& Statement::operator <<( const char* aValue ) {
 	return *this;
 }
 
+Statement& Statement::operator <<( const Blob& aValue ) {
+	bind( ++mLastBoundIndex, aValue.apValue, aValue.aSize );
+	return *this;
+}
+
 // Execute a step of the query to fetch one row of results
 bool Statement::executeStep()
 {
@@ -417,6 +434,12 @@ int Statement::getColumnIndex(const char* apName) const
     return (*iIndex).second;
 }
 
+// Return the largest index of the parameters in the prepared statement
+int Statement::getBindParameterCount() const noexcept // nothrow
+{
+    return sqlite3_bind_parameter_count(mStmtPtr);
+}
+
 // Return the numeric result code for the most recent failed API call (if any).
 int Statement::getErrorCode() const noexcept // nothrow
 {
@@ -456,7 +479,7 @@ Statement::Ptr::Ptr(sqlite3* apSQLite, std::string& aQuery) :
     // Initialize the reference counter of the sqlite3_stmt :
     // used to share the mStmtPtr between Statement and Column objects;
     // This is needed to enable Column objects to live longer than the Statement objet it refers to.
-    mpRefCount = new unsigned int(1);  // NOLINT(readability/casting)
+    mpRefCount = new std::atomic<unsigned int>(1);  // NOLINT(readability/casting)
 }
 
 /**
@@ -486,8 +509,7 @@ Statement::Ptr::~Ptr() noexcept // nothrow
     assert(0 != *mpRefCount);
 
     // Decrement and check the reference counter of the sqlite3_stmt
-    --(*mpRefCount);
-    if (0 == *mpRefCount)
+    if (0 == --(*mpRefCount))
     {
         // If count reaches zero, finalize the sqlite3_stmt, as no Statement nor Column objet use it anymore.
         // No need to check the return code, as it is the same as the last statement evaluation.
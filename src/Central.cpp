@@ -4,6 +4,7 @@
  * Free software licensed under GPLv3.
  */
 
+#include <algorithm>
 #include <condition_variable>
 #include <functional>
 #include <iostream>
@@ -79,16 +80,6 @@ void execInStream(mist::io::IOContext& ioCtx,
     //});
 }
 
-void execInStream(mist::io::IOContext& ioCtx,
-    mist::h2::ClientResponse res,
-    std::function<void(std::streambuf&)> fn) {
-    getAllData(res, [=](std::string data)
-    {
-        std::istringstream is(data);
-        fn(*is.rdbuf());
-    });
-}
-
 void execOutStream(mist::io::IOContext& ioCtx,
     mist::h2::ClientRequest req,
     std::function<void(std::streambuf&)> fn) {
@@ -138,6 +129,9 @@ Mist::Central::Central( std::string path, bool loggerAlreadyInitialized ) :
     // Initialize sync
     sync.started = false;
     sync.forceAnonymous = false;
+    syncSlots.perPeer = SYNC_DATABASES_PER_PEER;
+    syncSlots.total = SYNC_DATABASES;
+    syncSlots.active = 0;
 
     dbService.setOnPeerConnectionStatus(
         std::bind(&Mist::Central::onPeerConnectionStatus, this, _1, _2));
@@ -156,6 +150,21 @@ void Mist::Central::startEventLoop()
 
 namespace
 {
+Mist::PeerStatus peerStatusFromString(const std::string& status) {
+    if (status == "Direct")
+        return Mist::PeerStatus::Direct;
+    else if (status == "DirectAnonymous")
+        return Mist::PeerStatus::DirectAnonymous;
+    else if (status == "Indirect")
+        return Mist::PeerStatus::Indirect;
+    else if (status == "IndirectAnonymous")
+        return Mist::PeerStatus::IndirectAnonymous;
+    else if (status == "Blocked")
+        return Mist::PeerStatus::Blocked;
+    else
+        throw std::runtime_error("Invalid PeerStatus value");
+}
+
 char nibbleToHexadecimal(int c) {
     return c < 10 ? '0' + c : 'a' + c - 10;
 }
@@ -197,6 +206,57 @@ void Mist::Central::init( boost::optional<std::string> privKey ) {
     }
     sslCtx.loadPKCS12(*privKey, "");
     LOG(DBUG) << "My fingerprint is " << getPublicKey().fingerprint();
+
+    loadSettings();
+}
+
+void Mist::Central::loadSettings() {
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
+    settings.peers.clear();
+    settings.manifests.clear();
+    settings.localIds.clear();
+    settings.databasePermissions.clear();
+    settings.servicePermissions.clear();
+
+    Helper::Database::Statement user(*settingsDatabase,
+        "SELECT keyHash, publicKey, name, status, anonymous FROM User");
+    while (user.executeStep()) {
+        Mist::Peer peer;
+        peer.id = CryptoHelper::PublicKeyHash::fromString(user.getColumn("keyHash").getString());
+        peer.key = CryptoHelper::PublicKey::fromPem(user.getColumn("publicKey").getString());
+        peer.name = user.getColumn("name").getString();
+        peer.status = peerStatusFromString(user.getColumn("status").getString());
+        peer.anonymous = static_cast<bool>(user.getColumn("anonymous").getInt() != 0);
+        settings.peers.emplace(peer.id, peer);
+    }
+
+    using namespace std::placeholders;
+    Helper::Database::Statement database(*settingsDatabase,
+        "SELECT hash, localId, manifest FROM Database");
+    while (database.executeStep()) {
+        unsigned localId{ database.getColumn("localId").getUInt() };
+        settings.manifests.emplace(localId,
+            Database::Manifest::fromString(database.getColumn("manifest").getString(),
+                std::bind(&Central::verify, this, _1, _2, _3)));
+        settings.localIds.emplace(
+            CryptoHelper::SHA3::fromString(database.getColumn("hash").getString()), localId);
+    }
+
+    Helper::Database::Statement userDatabase(*settingsDatabase,
+        "SELECT userKeyHash, dbHash FROM UserDatabase ORDER BY rowid");
+    while (userDatabase.executeStep()) {
+        settings.databasePermissions.emplace(
+            CryptoHelper::PublicKeyHash::fromString(userDatabase.getColumn("userKeyHash").getString()),
+            CryptoHelper::SHA3::fromString(userDatabase.getColumn("dbHash").getString()));
+    }
+
+    Helper::Database::Statement userService(*settingsDatabase,
+        "SELECT userKeyHash, service FROM UserServicePermission ORDER BY rowid");
+    while (userService.executeStep()) {
+        settings.servicePermissions.emplace(
+            CryptoHelper::PublicKeyHash::fromString(userService.getColumn("userKeyHash").getString()),
+            userService.getColumn("service").getString());
+    }
 }
 
 void Mist::Central::create( boost::optional<std::string> privKey ) {
@@ -323,24 +383,50 @@ bool
 Mist::Central::verify(const CryptoHelper::PublicKey& key,
         const CryptoHelper::SHA3& hash,
         const CryptoHelper::Signature& sig) const {
-    return sslCtx.verify(key.toDer(), hash.data(), hash.size(),
-        sig.data(), sig.size());
+    verified_key_t verifiedKey{ key.hash(), hash };
+    std::vector<std::uint8_t> signature( sig.data(), sig.data() + sig.size() );
+    {
+        std::lock_guard<std::recursive_mutex> lock( verified.mux );
+        auto it = verified.index.find( verifiedKey );
+        if ( it != verified.index.end() && it->second->second == signature ) {
+            verified.signatures.splice( verified.signatures.begin(),
+                verified.signatures, it->second );
+            return true;
+        }
+    }
+
+    if (!sslCtx.verify(key.toDer(), hash.data(), hash.size(),
+            sig.data(), sig.size())) {
+        return false;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock( verified.mux );
+    auto it = verified.index.find( verifiedKey );
+    if ( it != verified.index.end() ) {
+        verified.signatures.erase( it->second );
+        verified.index.erase( it );
+    }
+    verified.signatures.emplace_front( verifiedKey, std::move( signature ) );
+    verified.index.emplace( verifiedKey, verified.signatures.begin() );
+    while ( verified.signatures.size() > VERIFIED_SIGNATURES_SIZE ) {
+        verified.index.erase( verified.signatures.back().first );
+        verified.signatures.pop_back();
+    }
+    return true;
 }
 
 Mist::Database* Mist::Central::getDatabase( CryptoHelper::SHA3 hash ) {
-    Helper::Database::Statement query(*settingsDatabase, "SELECT hash, localId, creator, name, manifest FROM Database WHERE hash=?");
-    query.bind(1, hash.toString());
-    if (query.executeStep()) {
-        try {
-            return getDatabase( query.getColumn( "localId" ).getUInt() );
-        } catch (Helper::Database::Exception &e) {
-            // TODO: could not get "localId" column from settingsDb
+    unsigned localId;
+    {
+        std::lock_guard<std::recursive_mutex> lock(settings.mux);
+        auto it = settings.localIds.find(hash);
+        if (it == settings.localIds.end()) {
+            // TODO: got no rows, handle this.
             return nullptr;
         }
-    } else {
-        // TODO: got no rows, handle this.
-        return nullptr;
+        localId = it->second;
     }
+    return getDatabase( localId );
 }
 
 Mist::Database* Mist::Central::getDatabase( unsigned localId ) {
@@ -348,21 +434,23 @@ Mist::Database* Mist::Central::getDatabase( unsigned localId ) {
     if (iter != databases.end()) { // found in databases
         return iter->second;
     } else {
-        Helper::Database::Statement query(*settingsDatabase, "SELECT hash FROM Database WHERE localId=?");
-        query.bind(1, localId);
-
-        if (query.executeStep()) {
-            try {
-                Mist::Database* db = new Mist::Database(this, path + "/" + std::to_string(localId) + ".db");
-                db->init( std::unique_ptr<Database::Manifest>(new Database::Manifest(getDatabaseManifest( CryptoHelper::SHA3::fromString( query.getColumn( "hash" ).getString() ) ))) );
-                databases.insert(std::make_pair(localId, db));
-                return db;
-            } catch (Helper::Database::Exception &e) {
-                // TODO: could not get "localId" column from settingsDb
+        std::unique_ptr<Database::Manifest> manifest;
+        {
+            std::lock_guard<std::recursive_mutex> lock(settings.mux);
+            auto it = settings.manifests.find(localId);
+            if (it == settings.manifests.end()) {
+                // TODO: got no rows, handle this.
                 return nullptr;
             }
-        } else {
-            // TODO: got no rows, handle this.
+            manifest.reset(new Database::Manifest(it->second));
+        }
+        try {
+            Mist::Database* db = new Mist::Database(this, path + "/" + std::to_string(localId) + ".db");
+            db->init( std::move( manifest ) );
+            databases.insert(std::make_pair(localId, db));
+            return db;
+        } catch (Helper::Database::Exception &e) {
+            // TODO: could not open the database
             return nullptr;
         }
     }
@@ -396,6 +484,11 @@ Mist::Database* Mist::Central::createDatabase( std::string name ) {
             query.bind( 5, manifest->toString() );
             query.exec();
             transaction.commit();
+            {
+                std::lock_guard<std::recursive_mutex> lock(settings.mux);
+                settings.manifests.emplace( localId, *manifest );
+                settings.localIds.emplace( manifest->getHash(), localId );
+            }
 
             // Add creator permission
             addDatabasePermission( manifest->getCreator().hash(), manifest->getHash() );
@@ -453,6 +546,11 @@ Mist::Database* Mist::Central::receiveDatabase( const Mist::Database::Manifest&
             query.bind( 5, manifest->toString() );
             query.exec();
             transaction.commit();
+            {
+                std::lock_guard<std::recursive_mutex> lock(settings.mux);
+                settings.manifests.emplace( localId, *manifest );
+                settings.localIds.emplace( manifest->getHash(), localId );
+            }
 
             // Add creator permission
             addDatabasePermission( manifest->getCreator().hash(), manifest->getHash() );
@@ -473,38 +571,19 @@ std::vector<Mist::Database::Manifest> Mist::Central::listDatabases() {
 
     std::vector<Mist::Database::Manifest> manifests;
 
-    Helper::Database::Statement query(*settingsDatabase,
-        "SELECT hash, localId, creator, name, manifest FROM Database");
-
-    while (query.executeStep()) {
-        try {
-            /* name */
-            std::string name(query.getColumn("name").getString());
-
-            using namespace std::placeholders;
-            manifests.push_back(
-                    Database::Manifest::fromString( query.getColumn( "manifest" ).getString(),
-                            std::bind( &Central::verify, this, _1, _2, _3)
-            ) );
-        } catch (Helper::Database::Exception& e) {
-            // TODO: column error on manifest
-            continue;
-        }
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
+    for (const auto& manifest : settings.manifests) {
+        manifests.push_back(manifest.second);
     }
 
     return manifests;
 }
 
 Mist::Database::Manifest Mist::Central::getDatabaseManifest( const CryptoHelper::SHA3& hash) {
-    std::vector<Mist::Database::Manifest> manifests;
-
-    Helper::Database::Statement query(*settingsDatabase,
-        "SELECT hash, localId, creator, name, manifest FROM Database WHERE hash=?");
-    query.bind( 1, hash.toString() );
-    if (query.executeStep()) {
-            using namespace std::placeholders;
-            return Database::Manifest::fromString( query.getColumn( "manifest" ).getString(),
-                            std::bind( &Central::verify, this, _1, _2, _3) );
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
+    auto it = settings.localIds.find(hash);
+    if (it != settings.localIds.end()) {
+        return settings.manifests.at(it->second);
     }
     throw std::runtime_error("Could not find database");
 }
@@ -553,6 +632,9 @@ void Mist::Central::addPeer( const Mist::CryptoHelper::PublicKey& key,
         query.bind(5, anonymous ? 1 : 0);
         query.exec();
         transaction.commit();
+
+        std::lock_guard<std::recursive_mutex> lock(settings.mux);
+        settings.peers.emplace(key.hash(), Mist::Peer{ key.hash(), key, name, status, anonymous });
     } catch(Helper::Database::Exception& e) {
         // TODO:
     }
@@ -584,6 +666,14 @@ void Mist::Central::changePeer( const Mist::CryptoHelper::PublicKeyHash& keyHash
     query.bind(4, keyHash.toString());
     query.exec();
     transaction.commit();
+
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
+    auto it = settings.peers.find(keyHash);
+    if (it != settings.peers.end()) {
+        it->second.name = name;
+        it->second.status = status;
+        it->second.anonymous = anonymous;
+    }
 }
 
 void Mist::Central::removePeer( const Mist::CryptoHelper::PublicKeyHash& keyHash ) {
@@ -593,47 +683,26 @@ void Mist::Central::removePeer( const Mist::CryptoHelper::PublicKeyHash& keyHash
     query.bind(1, keyHash.toString());
     query.exec();
     transaction.commit();
+
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
+    settings.peers.erase(keyHash);
 }
 
 std::vector<Mist::Peer> Mist::Central::listPeers() const {
-    Helper::Database::Statement query(*settingsDatabase,
-        "SELECT keyHash FROM User");
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
     std::vector<Mist::Peer> peerVector;
-    while (query.executeStep()) {
-        auto keyHash(Mist::CryptoHelper::PublicKeyHash::fromString(query.getColumn("keyHash").getString()));
-        peerVector.push_back(getPeer(keyHash));
+    for (const auto& peer : settings.peers) {
+        peerVector.push_back(peer.second);
     }
     return peerVector;
 }
 
 Mist::Peer Mist::Central::getPeer( const Mist::CryptoHelper::PublicKeyHash& keyHash ) const {
-    Helper::Database::Statement query(*settingsDatabase,
-        "SELECT keyHash, publicKey, name, status, anonymous"
-        " FROM User WHERE keyHash=?");
-    query.bind(1, keyHash.toString());
-    if (!query.executeStep())
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
+    auto it = settings.peers.find(keyHash);
+    if (it == settings.peers.end())
         throw std::runtime_error("Unable to find peer");
-    Mist::Peer peer;
-    peer.id = keyHash;
-    peer.key = Mist::CryptoHelper::PublicKey::fromPem(query.getColumn("publicKey").getString());
-    peer.name = query.getColumn("name").getString();
-    {
-        std::string status(query.getColumn("status").getString());
-        if (status == "Direct")
-            peer.status = Mist::PeerStatus::Direct;
-        else if (status == "DirectAnonymous")
-            peer.status = Mist::PeerStatus::DirectAnonymous;
-        else if (status == "Indirect")
-            peer.status = Mist::PeerStatus::Indirect;
-        else if (status == "IndirectAnonymous")
-            peer.status = Mist::PeerStatus::IndirectAnonymous;
-        else if (status == "Blocked")
-            peer.status = Mist::PeerStatus::Blocked;
-        else
-            throw std::runtime_error("Invalid PeerStatus value");
-    }
-    peer.anonymous = static_cast<bool>(query.getColumn("anonymous").getInt() != 0);
-    return peer;
+    return it->second;
 }
 
 std::vector<Mist::Database::Manifest>
@@ -656,6 +725,9 @@ Mist::Central::addDatabasePermission( const CryptoHelper::PublicKeyHash& keyHash
     query.bind(2, dbHash.toString());
     query.exec();
     transaction.commit();
+
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
+    settings.databasePermissions.emplace(keyHash, dbHash);
 }
 
 void
@@ -674,30 +746,37 @@ Mist::Central::removeDatabasePermission( const CryptoHelper::PublicKeyHash& keyH
     query.bind(2, dbHash.toString());
     query.exec();
     transaction.commit();
+
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
+    auto range = settings.databasePermissions.equal_range(keyHash);
+    for (auto it = range.first; it != range.second;) {
+        if (it->second == dbHash)
+            it = settings.databasePermissions.erase(it);
+        else
+            ++it;
+    }
 }
 
 std::vector<Mist::CryptoHelper::SHA3>
 Mist::Central::listDatabasePermissions( const CryptoHelper::PublicKeyHash& keyHash ) {
-    Helper::Database::Statement query(*settingsDatabase,
-        "SELECT dbHash"
-        " FROM UserDatabase WHERE userKeyHash=?");
-    query.bind(1, keyHash.toString());
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
     std::vector<CryptoHelper::SHA3> dbHashes;
-    while (query.executeStep()) {
-        auto dbHash = query.getColumn("dbHash").getString();
-	dbHashes.push_back(CryptoHelper::SHA3(dbHash));
+    auto range = settings.databasePermissions.equal_range(keyHash);
+    for (auto it = range.first; it != range.second; ++it) {
+        dbHashes.push_back(it->second);
     }
     return dbHashes;
 }
 
 bool
 Mist::Central::hasDatabasePermission( const CryptoHelper::PublicKeyHash& keyHash, const CryptoHelper::SHA3& dbHash ) {
-    Helper::Database::Statement query(*settingsDatabase,
-        "SELECT dbHash"
-        " FROM UserDatabase WHERE userKeyHash=? AND dbHash=?");
-    query.bind(1, keyHash.toString());
-    query.bind(2, dbHash.toString());
-    return static_cast<bool>(query.executeStep());
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
+    auto range = settings.databasePermissions.equal_range(keyHash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == dbHash)
+            return true;
+    }
+    return false;
 }
 
 void
@@ -710,6 +789,9 @@ Mist::Central::addServicePermission( const CryptoHelper::PublicKeyHash& keyHash,
     query.bind(2, service);
     query.exec();
     transaction.commit();
+
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
+    settings.servicePermissions.emplace(keyHash, service);
 }
 
 void
@@ -723,17 +805,24 @@ Mist::Central::removeServicePermission( const CryptoHelper::PublicKeyHash& keyHa
     query.bind(2, service);
     query.exec();
     transaction.commit();
+
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
+    auto range = settings.servicePermissions.equal_range(keyHash);
+    for (auto it = range.first; it != range.second;) {
+        if (it->second == service)
+            it = settings.servicePermissions.erase(it);
+        else
+            ++it;
+    }
 }
 
 std::vector<std::string>
 Mist::Central::listServicePermissions( const CryptoHelper::PublicKeyHash& keyHash ) {
-    Helper::Database::Statement query(*settingsDatabase,
-        "SELECT service"
-        " FROM UserServicePermission WHERE userKeyHash=?");
-    query.bind(1, keyHash.toString());
+    std::lock_guard<std::recursive_mutex> lock(settings.mux);
     std::vector<std::string> services;
-    while (query.executeStep()) {
-        services.push_back(query.getColumn("service").getString());
+    auto range = settings.servicePermissions.equal_range(keyHash);
+    for (auto it = range.first; it != range.second; ++it) {
+        services.push_back(it->second);
     }
     return services;
 }
@@ -920,12 +1009,22 @@ void Mist::Central::authenticatePeer( mist::Peer& peer ) {
  * Per-peer sync state
  */
 
+namespace
+{
+
+// Time between passes through all databases of a peer that is synced,
+// which is one request when the peer lists head digests
+const std::chrono::minutes SYNC_POLL_INTERVAL{ 1 };
+
+} // namespace
+
 Mist::Central::PeerSyncState::PeerSyncState( Mist::Central& central,
     const CryptoHelper::PublicKey& publicKey )
     : state(State::Reset), central(central), pubKey(publicKey),
       keyHash(pubKey.hash()),
       peer(central.connCtx.addAuthenticatedPeer(pubKey.toDer())),
-      anonymous(true)
+      anonymous(true),
+      capabilitiesKnown(false)
 {
 }
 
@@ -936,6 +1035,11 @@ Mist::Central::PeerSyncState::startSync()
     if (state == State::Reset || state == State::Disconnected) {
         LOG(INFO) << shortFinger() << "Starting sync";
         queryAddressServers();
+    } else if (state == State::Synced
+            && std::chrono::steady_clock::now() - lastSync >= SYNC_POLL_INTERVAL) {
+        // Announced transactions are fetched right away, this only catches
+        // what was missed
+        queryTransactions();
     }
 }
 
@@ -947,6 +1051,69 @@ Mist::Central::PeerSyncState::stopSync()
     // TODO:
 }
 
+void
+Mist::Central::PeerSyncState::continueSync()
+{
+    std::lock_guard<std::recursive_mutex> lock(mux);
+    queryTransactionsNext();
+}
+
+void
+Mist::Central::PeerSyncState::announceTransactions(const CryptoHelper::SHA3& dbHash,
+    const std::vector<CryptoHelper::SHA3>& hashes)
+{
+    std::lock_guard<std::recursive_mutex> lock(mux);
+    // Only peers we are connected to, that take announcements
+    if (state != State::QueryTransactions && state != State::QueryInvites
+            && state != State::Synced) {
+        return;
+    } else if (!capabilitiesKnown || !capabilities.count("new")) {
+        return;
+    }
+    std::string body("[");
+    for (auto& hash : hashes) {
+        if (body.length() > 1)
+            body += ",";
+        body += "\"" + hash.toString() + "\"";
+    }
+    body += "]";
+
+    LOG(DBUG) << shortFinger() << "announceTransactions " << dbHash.toString();
+    central.dbService.submitRequest(peer, "POST", "/transactions/"
+        + mist::h2::urlEncode(dbHash.toString()) + "/new",
+        [=](mist::Peer& _peer, mist::h2::ClientRequest request)
+    {
+        request.setOnResponse(
+            [=](mist::h2::ClientResponse response)
+        {
+            if (*response.statusCode() != 200) {
+                LOG(DBUG) << shortFinger() << "Announcement refused";
+            }
+        });
+        request.end(body);
+    });
+}
+
+void
+Mist::Central::PeerSyncState::syncDatabase(const CryptoHelper::SHA3& dbHash)
+{
+    std::lock_guard<std::recursive_mutex> lock(mux);
+    if (state == State::QueryInvites || state == State::Synced) {
+        state = State::QueryTransactions;
+    } else if (state != State::QueryTransactions) {
+        // Not connected yet, the first pass syncs all databases
+        return;
+    }
+    LOG(DBUG) << shortFinger() << "syncDatabase " << dbHash.toString();
+    if (std::find(databaseQueue.begin(), databaseQueue.end(), dbHash) == databaseQueue.end()) {
+        databaseQueue.push_back(dbHash);
+    }
+    // Otherwise the queue is taken up once the capabilities are known
+    if (capabilitiesKnown) {
+        queryTransactionsNext();
+    }
+}
+
 /*void
 Mist::Central::PeerSyncState::queryDatabases()
 {
@@ -992,20 +1159,151 @@ Mist::Central::PeerSyncState::queryTransactions()
     LOG(INFO) << shortFinger() << "queryTransactions";
     std::lock_guard<std::recursive_mutex> lock(mux);
     state = State::QueryTransactions;
+    lastSync = std::chrono::steady_clock::now();
 
-    // Try all databases in case user permissions are not up to date
-    databaseHashes.clear();
-    for (auto& manifest : central.listDatabases()) {
-        databaseHashes.push_back(manifest.getHash());
+    if (!capabilitiesKnown) {
+        queryCapabilities();
+    } else {
+        queryDatabaseHeads();
     }
+}
 
-    databaseHashesIterator = databaseHashes.begin();
-    queryTransactionsNext();
+void
+Mist::Central::PeerSyncState::queryDatabaseHeads()
+{
+    // Queue the databases that may differ from those of the peer
+    std::lock_guard<std::recursive_mutex> lock(mux);
+    auto queue = [this](const CryptoHelper::SHA3& hash)
+    {
+        if (std::find(databaseQueue.begin(), databaseQueue.end(), hash) == databaseQueue.end()) {
+            databaseQueue.push_back(hash);
+        }
+    };
+    auto queueAll = [this, queue]()
+    {
+        // Try all databases in case user permissions are not up to date
+        for (auto& manifest : central.listDatabases()) {
+            queue(manifest.getHash());
+        }
+    };
+    if (!capabilities.count("heads")) {
+        queueAll();
+        queryTransactionsNext();
+        return;
+    }
+
+    LOG(DBUG) << shortFinger() << "queryDatabaseHeads";
+    central.dbService.submitRequest(peer, "GET", "/databases/heads",
+        [=](mist::Peer& _peer, mist::h2::ClientRequest request)
+    {
+        request.setOnResponse(
+            [=](mist::h2::ClientResponse response)
+        {
+            if (*response.statusCode() != 200) {
+                std::lock_guard<std::recursive_mutex> lock(mux);
+                queueAll();
+                queryTransactionsNext();
+                return;
+            }
+            innerGetJsonResponse(response,
+                [=](boost::optional<const JSON::Value&> value)
+            {
+                std::lock_guard<std::recursive_mutex> lock(mux);
+                if (!value || !value->is_object()) {
+                    LOG(INFO) << shortFinger() << "Malformed JSON response";
+                    queueAll();
+                    queryTransactionsNext();
+                    return;
+                }
+                listedDigests.clear();
+                for (auto& manifest : central.listDatabases()) {
+                    auto hash(manifest.getHash());
+                    auto listed(value->object.find(hash.toString()));
+                    if (listed == value->object.end() || !listed->second.is_string()) {
+                        // The peer does not share it with us
+                        continue;
+                    }
+                    CryptoHelper::SHA3 digest(listed->second.get_string());
+                    auto database(central.getDatabase(hash));
+                    auto synced(syncedDigests.find(hash));
+                    if (database && database->getHeadDigest() == digest) {
+                        // Same transactions on both sides
+                        continue;
+                    } else if (synced != syncedDigests.end() && synced->second == digest) {
+                        // Nothing new on the peer since the last sync
+                        continue;
+                    }
+                    listedDigests[hash] = digest;
+                    queue(hash);
+                }
+                queryTransactionsNext();
+            });
+        });
+        request.end();
+    });
+}
+
+void
+Mist::Central::PeerSyncState::queryCapabilities()
+{
+    LOG(DBUG) << shortFinger() << "queryCapabilities";
+    std::lock_guard<std::recursive_mutex> lock(mux);
+    central.dbService.submitRequest(peer, "GET", "/capabilities",
+        [=](mist::Peer& _peer, mist::h2::ClientRequest request)
+    {
+        request.setOnResponse(
+            [=](mist::h2::ClientResponse response)
+        {
+            if (*response.statusCode() != 200) {
+                // Peers from before /capabilities reply 404
+                std::lock_guard<std::recursive_mutex> lock(mux);
+                capabilitiesKnown = true;
+                capabilities.clear();
+                queryDatabaseHeads();
+                return;
+            }
+            innerGetJsonResponse(response,
+                [=](boost::optional<const JSON::Value&> value)
+            {
+                std::lock_guard<std::recursive_mutex> lock(mux);
+                capabilitiesKnown = true;
+                capabilities.clear();
+                if (value && value->is_array()) {
+                    for (const auto& capability : value->array) {
+                        if (capability.is_string())
+                            capabilities.insert(capability.get_string());
+                    }
+                }
+                queryDatabaseHeads();
+            });
+        });
+        request.end();
+    });
 }
 
 namespace
 {
 
+// Cells of the first sketch sent to a peer, and the largest one before
+// falling back to walking the transactions one by one
+const std::size_t SKETCH_CELLS_MIN{ 96 };
+const std::size_t SKETCH_CELLS_LIMIT{ 6144 };
+// Transactions requested at a time from peers that serve batches
+const std::size_t DOWNLOAD_BATCH_SIZE{ 1000 };
+
+// Hashes of a ?from= list
+std::vector<Mist::CryptoHelper::SHA3> parseHashList(const std::string& from) {
+    std::vector<Mist::CryptoHelper::SHA3> res;
+    std::size_t last = 0, pos = from.find(",");
+    while (pos != std::string::npos) {
+        res.push_back(Mist::CryptoHelper::SHA3(from.substr(last, pos - last)));
+        last = pos + 1;
+        pos = from.find(",", last);
+    }
+    res.push_back(Mist::CryptoHelper::SHA3(from.substr(last)));
+    return res;
+}
+
 boost::optional<Mist::CryptoHelper::SHA3> getMetadataHash(
         const JSON::Value& transaction) {
     try {
@@ -1018,6 +1316,7 @@ boost::optional<Mist::CryptoHelper::SHA3> getMetadataHash(
     } catch (std::out_of_range&) {
         // id not found in object
     }
+    return boost::none;
 }
 
 std::vector<Mist::CryptoHelper::SHA3> getMetadataParents(
@@ -1046,168 +1345,250 @@ std::vector<Mist::CryptoHelper::SHA3> getMetadataParents(
 void
 Mist::Central::PeerSyncState::queryTransactionsNext()
 {
-    // Find if the peer has any transactions we are missing
+    // Start syncing databases until the peer or all peers together sync as
+    // many as they may, each database finishing continues with the next
     std::lock_guard<std::recursive_mutex> lock(mux);
-    if (databaseHashesIterator == databaseHashes.end()) {
-        queryTransactionsDone();
-    } else {
-        auto hash = *databaseHashesIterator;
-
-        LOG(INFO) << shortFinger() << "queryTransactionsNext " << hash.toString();
-        currentDatabase = central.getDatabase( hash );
-        if (!currentDatabase) {
+    if (state != State::QueryTransactions)
+        return;
+    auto next = databaseQueue.begin();
+    while (next != databaseQueue.end()) {
+        auto hash = *next;
+        auto database = central.getDatabase( hash );
+        if (!database) {
             // TODO Log error
             LOG(INFO) << shortFinger() << "could not find database";
-            databaseHashesIterator = std::next(databaseHashesIterator);
-            queryTransactionsNext();
-            return;
+            next = databaseQueue.erase(next);
+            continue;
+        }
+        if (std::any_of(databaseSyncs.begin(), databaseSyncs.end(),
+                [database](const database_sync_ptr& sync) { return sync->database == database; })) {
+            // Queued again while it was synced, wait for that to be done
+            ++next;
+            continue;
         }
+        if (!central.acquireSyncSlot(*this, databaseSyncs.size()))
+            return;
+        databaseQueue.erase(next);
 
-        transactionsToDownload.clear();
-        transactionParentsToDownload.clear();
-        transactionToDownloadInOrder.clear();
+        LOG(INFO) << shortFinger() << "queryTransactionsNext " << hash.toString();
+        auto sync(std::make_shared<DatabaseSync>(database));
+        databaseSyncs.insert(sync);
+        queryTransactionsDatabase(sync);
+        next = databaseQueue.begin();
+    }
+    if (databaseSyncs.empty()) {
+        queryTransactionsDone();
+    }
+}
 
-        std::string requestUrl;
-        auto transactionList(currentDatabase->getTransactionLatest());
-        if (transactionList.empty()) {
-            // First time, get all transactions
-            requestUrl = "/transactions/"
-                + mist::h2::urlEncode(hash.toString());
-        } else {
-            std::string transactionList;
-            for (auto& tran : currentDatabase->getTransactionLatest()) {
-                if (transactionList.length())
-                    transactionList += ",";
-                transactionList += mist::h2::urlEncode(tran.hash.toString());
-            }
-            requestUrl = "/transactions/"
-                + mist::h2::urlEncode(hash.toString())
-                + "/?from=" + transactionList;
+void
+Mist::Central::PeerSyncState::queryTransactionsDatabase(database_sync_ptr sync)
+{
+    // Find if the peer has any transactions we are missing
+    std::lock_guard<std::recursive_mutex> lock(mux);
+    auto hash = sync->database->getManifest()->getHash();
+
+    sync->transactionsToDownload.clear();
+    sync->transactionParentsToDownload.clear();
+    sync->transactionToDownloadInOrder.clear();
+
+    std::string requestUrl;
+    auto heads(sync->database->getTransactionHeads());
+    if (!heads.empty() && capabilities.count("reconcile") && !sync->reconcileFallback) {
+        queryTransactionsReconcile(sync, SKETCH_CELLS_MIN);
+        return;
+    }
+    sync->reconcileFallback = false;
+    if (heads.empty()) {
+        // First time, get all transactions
+        requestUrl = "/transactions/"
+            + mist::h2::urlEncode(hash.toString());
+    } else {
+        std::string transactionList;
+        for (auto& head : heads) {
+            if (transactionList.length())
+                transactionList += ",";
+            transactionList += mist::h2::urlEncode(head.toString());
         }
+        requestUrl = "/transactions/"
+            + mist::h2::urlEncode(hash.toString())
+            + "/?from=" + transactionList;
+    }
 
-        LOG(INFO) << shortFinger() << "Getting transaction " << hash.toString();
-        central.dbService.submitRequest(peer, "GET", requestUrl,
-            [=](mist::Peer& _peer, mist::h2::ClientRequest request)
-        {
-            // Not found
-            // Peer does not have all my latest transactions. We need to ask for its latest
-            // transactions to find out if it has any transactions that we do not have
+    LOG(INFO) << shortFinger() << "Getting transaction " << hash.toString();
+    central.dbService.submitRequest(peer, "GET", requestUrl,
+        [=](mist::Peer& _peer, mist::h2::ClientRequest request)
+    {
+        // Not found
+        // Peer does not have all my latest transactions. We need to ask for its latest
+        // transactions to find out if it has any transactions that we do not have
 
-            // Get status of request befo
-            request.setOnResponse(
-                [=](mist::h2::ClientResponse response)
-            {
-                if (*response.statusCode() == 404) {
-                    LOG(INFO) << shortFinger() << "Transaction not found";
-                    central.dbService.submitRequest(peer, "GET",
-                        "/transactions/" + mist::h2::urlEncode(hash.toString())
-                        + "/latest",
-                        [=](mist::Peer& peer, mist::h2::ClientRequest request)
+        // Get status of request befo
+        request.setOnResponse(
+            [=](mist::h2::ClientResponse response)
+        {
+            if (*response.statusCode() == 404) {
+                LOG(INFO) << shortFinger() << "Transaction not found";
+                central.dbService.submitRequest(peer, "GET",
+                    "/transactions/" + mist::h2::urlEncode(hash.toString())
+                    + "/latest",
+                    [=](mist::Peer& peer, mist::h2::ClientRequest request)
+                {
+                    getJsonResponse(request,
+                        //[=](std::unique_ptr<JSON::basic_json_value> value)
+                        [=](boost::optional<const JSON::Value&> value)
                     {
-                        getJsonResponse(request,
-                            //[=](std::unique_ptr<JSON::basic_json_value> value)
-                            [=](boost::optional<const JSON::Value&> value)
-                        {
-                            if (value && value->is_array()) {
-                                //JSON::Array& arr = static_cast<JSON::Array&>(*value);
-                                const std::vector<JSON::Value>& arr = value->array;
-                                for (const auto& transaction : arr) {
-                                    // If transaction exists, do nothing
-
-                                    // If transaction does not exists, add it to transactions to download
-
-                                    // If a transaction parent transaction does not exist, add it to transactions to download and transactionParentsToDownload
-
-                                    auto tranHash = getMetadataHash(transaction);
-                                    bool tranExists = true;
-                                    if (tranHash) {
-                                        try {
-                                            currentDatabase->getTransactionMeta(*tranHash);
-                                            LOG(INFO) << shortFinger() << "Transaction exists";
-                                        } catch (std::runtime_error&) {
-                                            // Transaction does not exist
-                                            transactionsToDownload[tranHash->toString()] = transaction;
-                                            tranExists = false;
-                                        }
+                        if (value && value->is_array()) {
+                            //JSON::Array& arr = static_cast<JSON::Array&>(*value);
+                            const std::vector<JSON::Value>& arr = value->array;
+                            for (const auto& transaction : arr) {
+                                // If transaction exists, do nothing
+
+                                // If transaction does not exists, add it to transactions to download
+
+                                // If a transaction parent transaction does not exist, add it to transactions to download and transactionParentsToDownload
+
+                                auto tranHash = getMetadataHash(transaction);
+                                bool tranExists = true;
+                                if (tranHash) {
+                                    if (sync->database->haveTransaction(*tranHash)) {
+                                        LOG(INFO) << shortFinger() << "Transaction exists";
+                                    } else {
+                                        // Transaction does not exist
+                                        sync->transactionsToDownload[tranHash->toString()] = transaction;
+                                        tranExists = false;
                                     }
-                                    if (!tranExists) {
-                                        LOG(INFO) << shortFinger() << "Transaction does not exist";
-                                        auto parentHashes = getMetadataParents(transaction);
-                                        for (auto& parentHash : parentHashes) {
-                                            try {
-                                                currentDatabase->getTransactionMeta(parentHash);
-                                                LOG(INFO) << shortFinger() << "Parent exists: " << parentHash.toString();
-                                            } catch (std::runtime_error&) {
-                                                // Parent does not exist
-                                                transactionParentsToDownload.insert(parentHash.toString());
-                                                LOG(INFO) << shortFinger() << "Parent does not exist: " << parentHash.toString();
-                                            }
+                                }
+                                if (!tranExists) {
+                                    LOG(INFO) << shortFinger() << "Transaction does not exist";
+                                    auto parentHashes = getMetadataParents(transaction);
+                                    for (auto& parentHash : parentHashes) {
+                                        if (sync->database->haveTransaction(parentHash)) {
+                                            LOG(INFO) << shortFinger() << "Parent exists: " << parentHash.toString();
+                                        } else {
+                                            // Parent does not exist
+                                            sync->transactionParentsToDownload.insert(parentHash.toString());
+                                            LOG(INFO) << shortFinger() << "Parent does not exist: " << parentHash.toString();
                                         }
                                     }
                                 }
-                                if (!transactionParentsToDownload.empty() || !transactionsToDownload.empty()) {
-                                    queryTransactionsGetNextParent();
-                                } else {
-                                    // Nothing to do
-                                    databaseHashesIterator = std::next(databaseHashesIterator);
-                                    queryTransactionsNext();
-                                }
+                            }
+                            if (!sync->transactionParentsToDownload.empty() || !sync->transactionsToDownload.empty()) {
+                                queryTransactionsGetNextParent(sync);
                             } else {
-                                LOG(INFO) << shortFinger() << "Malformed JSON response";
-                                databaseHashesIterator = std::next(databaseHashesIterator);
-                                queryTransactionsNext();
+                                // Nothing to do
+                                sync->complete = true;
+                                queryTransactionsDatabaseDone(sync);
                             }
-                        });
+                        } else {
+                            LOG(INFO) << shortFinger() << "Malformed JSON response";
+                            queryTransactionsDatabaseDone(sync);
+                        }
                     });
-                } else if (*response.statusCode() == 200) {
-                    LOG(INFO) << shortFinger() << "Transaction found";
-                    innerGetJsonResponse(response,
-                        //[=](std::unique_ptr<JSON::basic_json_value> value)
-                        [=](boost::optional<const JSON::Value&> value)
-                    {
-                        assert(value);
-                        if (value->is_array()) {
-                            const std::vector<JSON::Value>& arr = value->array;
-                            for (const auto& transaction : arr) {
-                                auto hash = getMetadataHash(transaction);
-                                if (hash) {
-                                    transactionToDownloadInOrder.push_back(hash->toString());
-                                }
+                });
+            } else if (*response.statusCode() == 200) {
+                LOG(INFO) << shortFinger() << "Transaction found";
+                innerGetJsonResponse(response,
+                    //[=](std::unique_ptr<JSON::basic_json_value> value)
+                    [=](boost::optional<const JSON::Value&> value)
+                {
+                    assert(value);
+                    if (value->is_array()) {
+                        const std::vector<JSON::Value>& arr = value->array;
+                        for (const auto& transaction : arr) {
+                            auto hash = getMetadataHash(transaction);
+                            if (hash) {
+                                sync->transactionToDownloadInOrder.push_back(hash->toString());
                             }
-                        } else {
-                            throw std::runtime_error("Malformed JSON response");
                         }
-                        if (transactionToDownloadInOrder.empty()) {
-                            databaseHashesIterator = std::next(databaseHashesIterator);
-                            queryTransactionsNext();
-                        } else {
-                            queryTransactionsDownloadNextTransaction(transactionToDownloadInOrder.begin());
+                    } else {
+                        throw std::runtime_error("Malformed JSON response");
+                    }
+                    if (sync->transactionToDownloadInOrder.empty()) {
+                        sync->complete = true;
+                        queryTransactionsDatabaseDone(sync);
+                    } else {
+                        queryTransactionsDownloadNextTransaction(sync, sync->transactionToDownloadInOrder.begin());
+                    }
+                });
+            } else {
+                // If we are here it probably means that the user has not
+                // yet accepted an invite to the database.
+                LOG(INFO) << shortFinger() << "Transaction refused";
+                queryTransactionsDatabaseDone(sync);
+            }
+        });
+        request.end();
+    });
+}
+
+void
+Mist::Central::PeerSyncState::queryTransactionsReconcile(database_sync_ptr sync,
+    std::size_t cells)
+{
+    // Send a sketch of our transactions, the peer replies with the metadata
+    // of the ones we are missing in the order they are to be written
+    std::lock_guard<std::recursive_mutex> lock(mux);
+    LOG(DBUG) << shortFinger() << "queryTransactionsReconcile " << cells << " cells";
+    auto sketch(sync->database->getTransactionSketch(cells).toString());
+
+    central.dbService.submitRequest(peer, "POST", "/transactions/"
+        + mist::h2::urlEncode(sync->database->getManifest()->getHash().toString())
+        + "/reconcile",
+        [=](mist::Peer& _peer, mist::h2::ClientRequest request)
+    {
+        request.setOnResponse(
+            [=](mist::h2::ClientResponse response)
+        {
+            std::lock_guard<std::recursive_mutex> lock(mux);
+            if (*response.statusCode() == 409 && cells < SKETCH_CELLS_LIMIT) {
+                // Too many differences for the sketch
+                queryTransactionsReconcile(sync, cells * 4);
+                return;
+            } else if (*response.statusCode() != 200) {
+                LOG(INFO) << shortFinger() << "Reconciliation failed, walking transactions";
+                sync->reconcileFallback = true;
+                queryTransactionsDatabase(sync);
+                return;
+            }
+            innerGetJsonResponse(response,
+                [=](boost::optional<const JSON::Value&> value)
+            {
+                std::lock_guard<std::recursive_mutex> lock(mux);
+                if (value && value->is_array()) {
+                    for (const auto& transaction : value->array) {
+                        auto tranHash = getMetadataHash(transaction);
+                        if (tranHash && !sync->database->haveTransaction(*tranHash)) {
+                            sync->transactionToDownloadInOrder.push_back(tranHash->toString());
                         }
-                    });
+                    }
                 } else {
-                    // If we are here it probably means that the user has not
-                    // yet accepted an invite to the database.
-                    LOG(INFO) << shortFinger() << "Transaction refused";
-                    queryTransactionsNext();
+                    LOG(INFO) << shortFinger() << "Malformed JSON response";
+                }
+                if (sync->transactionToDownloadInOrder.empty()) {
+                    sync->complete = true;
+                    queryTransactionsDatabaseDone(sync);
+                } else {
+                    queryTransactionsDownloadNextTransaction(sync, sync->transactionToDownloadInOrder.begin());
                 }
             });
-            request.end();
         });
-    }
+        request.end(sketch);
+    });
 }
 
 void
-Mist::Central::PeerSyncState::queryTransactionsGetNextParent()
+Mist::Central::PeerSyncState::queryTransactionsGetNextParent(database_sync_ptr sync)
 {
-    if (!transactionParentsToDownload.empty()) {
-        auto trHash = *(transactionParentsToDownload.begin());
+    if (!sync->transactionParentsToDownload.empty()) {
+        auto trHash = *(sync->transactionParentsToDownload.begin());
 
-        transactionParentsToDownload.erase( trHash );
+        sync->transactionParentsToDownload.erase( trHash );
 
         LOG(DBUG) << shortFinger() << "queryTransactionsGetNextParent get parent " << trHash;
 
         central.dbService.submitRequest(peer, "HEAD", "/transactions/"
-            + mist::h2::urlEncode(currentDatabase->getManifest()->getHash().toString()
+            + mist::h2::urlEncode(sync->database->getManifest()->getHash().toString()
             + "/" + mist::h2::urlEncode(trHash)),
             [=](mist::Peer& peer, mist::h2::ClientRequest request)
         {
@@ -1221,27 +1602,23 @@ Mist::Central::PeerSyncState::queryTransactionsGetNextParent()
                     auto tranHash = getMetadataHash(*value);
                     bool tranExists = true;
                     if (tranHash) {
-                        try {
-                            currentDatabase->getTransactionMeta(*tranHash);
-                        } catch (std::runtime_error&) {
+                        if (!sync->database->haveTransaction(*tranHash)) {
                             // Transaction does not exist
-                            transactionsToDownload[tranHash->toString()] = *value;
+                            sync->transactionsToDownload[tranHash->toString()] = *value;
                             tranExists = false;
                         }
                     }
                     if (!tranExists) {
                         auto parentHashes = getMetadataParents(*value);
                         for (auto& parentHash : parentHashes) {
-                            try {
-                                currentDatabase->getTransactionMeta(parentHash);
-                            } catch (std::runtime_error&) {
+                            if (!sync->database->haveTransaction(parentHash)) {
                                 // Parent does not exist
-                                transactionParentsToDownload.insert(parentHash.toString());
+                                sync->transactionParentsToDownload.insert(parentHash.toString());
                             }
                         }
                     }
                 }
-                queryTransactionsGetNextParent();
+                queryTransactionsGetNextParent(sync);
             });
             request.end();
         });
@@ -1252,7 +1629,7 @@ Mist::Central::PeerSyncState::queryTransactionsGetNextParent()
         LOG(DBUG) << shortFinger() << "queryTransactionsGetNextParent download " << trHash;
 
         central.dbService.submitRequest(peer, "GET",
-            "/transactions/" + mist::h2::urlEncode(currentDatabase->getManifest()->getHash().toString())
+            "/transactions/" + mist::h2::urlEncode(sync->database->getManifest()->getHash().toString())
             + "/?from=[" + mist::h2::urlEncode(trHash) + "]",
             [=](mist::Peer& peer, mist::h2::ClientRequest request)
         {
@@ -1264,15 +1641,13 @@ Mist::Central::PeerSyncState::queryTransactionsGetNextParent()
                 if (value) {
                     auto tranHash = getMetadataHash(*value);
                     if (tranHash) {
-                        try {
-                            currentDatabase->getTransactionMeta(*tranHash);
-                        } catch (std::runtime_error&) {
+                        if (!sync->database->haveTransaction(*tranHash)) {
                             // Transaction does not exist
-                            transactionToDownloadInOrder.push_back(tranHash->toString());
+                            sync->transactionToDownloadInOrder.push_back(tranHash->toString());
                         }
                     }
                 }
-                queryTransactionsGetNextParent();
+                queryTransactionsGetNextParent(sync);
             });
             request.end();
         });
@@ -1281,40 +1656,148 @@ Mist::Central::PeerSyncState::queryTransactionsGetNextParent()
 }
 
 void
-Mist::Central::PeerSyncState::queryTransactionsDownloadNextTransaction(std::vector<std::string>::iterator it)
+Mist::Central::PeerSyncState::queryTransactionsDownloadNextTransaction(database_sync_ptr sync,
+    std::vector<std::string>::iterator it)
 {
     // Find if the peer has any transactions we are missing
     std::lock_guard<std::recursive_mutex> lock(mux);
-    if (it == transactionToDownloadInOrder.end()) {
-        databaseHashesIterator = std::next(databaseHashesIterator);
-        queryTransactionsNext();
+    if (!databaseSyncs.count(sync)) {
+        // Dropped by a disconnect
+        return;
+    } else if (it == sync->transactionToDownloadInOrder.end()) {
+        sync->complete = true;
+        queryTransactionsDatabaseDone(sync);
+    } else if (capabilities.count("batch")) {
+        queryTransactionsDownloadBatch(sync, it);
     } else {
         auto hash = *it;
 
         LOG(DBUG) << shortFinger() << "queryTransactionsDownloadNextTransaction " << hash;
 
         central.dbService.submitRequest(peer, "GET",
-            "/transactions/" + mist::h2::urlEncode(currentDatabase->getManifest()->getHash().toString())
+            "/transactions/" + mist::h2::urlEncode(sync->database->getManifest()->getHash().toString())
             + "/" + mist::h2::urlEncode(hash),
             [=](mist::Peer& peer, mist::h2::ClientRequest request)
         {
-            // INSERT transaction into currentDatabase
-            execInStream(central.ioCtx, request.stream().response(),
-                [=](std::streambuf& is)
+            // INSERT transaction into the database, on its writer
+            // thread so that the event loop is not held up by the commit
+            getAllData(request.stream().response(), [=](std::string data)
             {
-                currentDatabase->writeToDatabase(is);
-                queryTransactionsDownloadNextTransaction(std::next(it));
+                sync->database->writeToDatabaseAsync(data,
+                    [=](std::exception_ptr error)
+                {
+                    if (error) {
+                        LOG(WARNING) << shortFinger() << "Could not write transaction " << hash;
+                        central.post([=]()
+                        {
+                            queryTransactionsDatabaseDone(sync);
+                        });
+                        return;
+                    }
+                    central.post([=]()
+                    {
+                        queryTransactionsDownloadNextTransaction(sync, std::next(it));
+                    });
+                });
             });
             request.end();
         });
     }
 }
 
+void
+Mist::Central::PeerSyncState::queryTransactionsDownloadBatch(database_sync_ptr sync,
+    std::vector<std::string>::iterator it)
+{
+    // Download the next transactions in one request, and write them while
+    // they arrive
+    std::lock_guard<std::recursive_mutex> lock(mux);
+    auto count(std::min<std::size_t>(DOWNLOAD_BATCH_SIZE,
+        std::distance(it, sync->transactionToDownloadInOrder.end())));
+    auto last(std::next(it, count));
+    std::string hashes("[");
+    for (auto hash = it; hash != last; ++hash) {
+        if (hash != it)
+            hashes += ",";
+        hashes += "\"" + *hash + "\"";
+    }
+    hashes += "]";
+
+    LOG(DBUG) << shortFinger() << "queryTransactionsDownloadBatch " << count << " transactions";
+
+    auto stream(sync->database->openWriteStream());
+    // The writes of a stream are made one at a time on the writer thread
+    auto failed(std::make_shared<std::exception_ptr>());
+    central.dbService.submitRequest(peer, "POST",
+        "/transactions/" + mist::h2::urlEncode(sync->database->getManifest()->getHash().toString())
+        + "/batch",
+        [=](mist::Peer& _peer, mist::h2::ClientRequest request)
+    {
+        request.setOnResponse(
+            [=](mist::h2::ClientResponse response)
+        {
+            if (*response.statusCode() != 200) {
+                LOG(WARNING) << shortFinger() << "Could not download transactions";
+                std::lock_guard<std::recursive_mutex> lock(mux);
+                queryTransactionsDatabaseDone(sync);
+                return;
+            }
+            response.setOnData(
+                [=](const std::uint8_t* data, std::size_t length)
+            {
+                std::string part;
+                if (data)
+                    part.assign(reinterpret_cast<const char*>(data), length);
+                sync->database->writeToStreamAsync(stream, part,
+                    [=](std::exception_ptr error)
+                {
+                    if (error && !*failed) {
+                        *failed = error;
+                        LOG(WARNING) << shortFinger() << "Could not write transactions";
+                    }
+                    if (data) {
+                        return;
+                    }
+                    central.post([=]()
+                    {
+                        if (*failed) {
+                            queryTransactionsDatabaseDone(sync);
+                        } else {
+                            queryTransactionsDownloadNextTransaction(sync, last);
+                        }
+                    });
+                });
+            });
+        });
+        request.end(hashes);
+    });
+}
+
+void
+Mist::Central::PeerSyncState::queryTransactionsDatabaseDone(database_sync_ptr sync)
+{
+    std::lock_guard<std::recursive_mutex> lock(mux);
+    // Syncs dropped by a disconnect have already released their slot
+    if (databaseSyncs.erase(sync)) {
+        auto hash(sync->database->getManifest()->getHash());
+        auto listed(listedDigests.find(hash));
+        if (listed != listedDigests.end()) {
+            // Skipped in later passes until the peer lists another digest
+            if (sync->complete)
+                syncedDigests[hash] = listed->second;
+            listedDigests.erase(listed);
+        }
+        central.releaseSyncSlot();
+        queryTransactionsNext();
+    }
+}
+
 void
 Mist::Central::PeerSyncState::queryTransactionsDone()
 {
     LOG(DBUG) << shortFinger() << "queryTransactionsDone";
     std::lock_guard<std::recursive_mutex> lock(mux);
+    state = State::QueryInvites;
     queryInvites();
 }
 
@@ -1376,6 +1859,9 @@ Mist::Central::PeerSyncState::queryInvitesDone()
 {
     LOG(DBUG) << shortFinger() << "queryInvitesDone";
     std::lock_guard<std::recursive_mutex> lock(mux);
+    if (state == State::QueryInvites) {
+        state = State::Synced;
+    }
 }
 
 void
@@ -1532,6 +2018,20 @@ void
 Mist::Central::PeerSyncState::onDisconnect()
 {
     std::lock_guard<std::recursive_mutex> lock(mux);
+    // The peer may come back with another version
+    capabilitiesKnown = false;
+
+    // The requests in flight are lost, sync again when the peer is back
+    if (state == State::QueryTransactions || state == State::QueryInvites
+            || state == State::Synced) {
+        state = State::Disconnected;
+        databaseQueue.clear();
+        central.cancelSyncSlot(*this);
+        for (std::size_t i = 0; i < databaseSyncs.size(); ++i) {
+            central.releaseSyncSlot();
+        }
+        databaseSyncs.clear();
+    }
 }
 
 void
@@ -1598,6 +2098,73 @@ Mist::Central::getPeerSyncState( const CryptoHelper::PublicKeyHash& keyHash )
     return *it->second;
 }
 
+void Mist::Central::post( std::function<void()> job ) {
+    ioCtx.setTimeout(0, job);
+    // A queued timeout alone waits for the poll of the loop to time out
+    ioCtx.signal();
+}
+
+void Mist::Central::announceTransactions( const CryptoHelper::SHA3& dbHash,
+        const std::vector<CryptoHelper::SHA3>& hashes ) {
+    // The database may be locked by the caller, tell the peers from the
+    // event loop
+    post([this, dbHash, hashes]()
+    {
+        std::lock_guard<std::recursive_mutex> lock(sync.mux);
+        if (!sync.started)
+            return;
+        for (auto& peer : listPeers()) {
+            if (hasDatabasePermission(peer.id, dbHash)) {
+                getPeerSyncState(peer.id).announceTransactions(dbHash, hashes);
+            }
+        }
+    });
+}
+
+void Mist::Central::setSyncConcurrency( std::size_t databasesPerPeer, std::size_t databases ) {
+    std::lock_guard<std::mutex> lock(syncSlots.mux);
+    syncSlots.perPeer = std::max<std::size_t>(databasesPerPeer, 1);
+    syncSlots.total = std::max<std::size_t>(databases, 1);
+}
+
+bool Mist::Central::acquireSyncSlot( PeerSyncState& peerState, std::size_t peerActive ) {
+    std::lock_guard<std::mutex> lock(syncSlots.mux);
+    if (peerActive >= syncSlots.perPeer) {
+        // The peer continues when one of its databases is done
+        return false;
+    } else if (syncSlots.active >= syncSlots.total) {
+        if (std::find(syncSlots.waiting.begin(), syncSlots.waiting.end(), &peerState)
+                == syncSlots.waiting.end()) {
+            syncSlots.waiting.push_back(&peerState);
+        }
+        return false;
+    }
+    ++syncSlots.active;
+    return true;
+}
+
+void Mist::Central::releaseSyncSlot() {
+    PeerSyncState* next{ nullptr };
+    {
+        std::lock_guard<std::mutex> lock(syncSlots.mux);
+        --syncSlots.active;
+        if (!syncSlots.waiting.empty()) {
+            next = syncSlots.waiting.front();
+            syncSlots.waiting.pop_front();
+        }
+    }
+    // The caller holds the lock of its own peer
+    if (next) {
+        post([next]() { next->continueSync(); });
+    }
+}
+
+void Mist::Central::cancelSyncSlot( PeerSyncState& peerState ) {
+    std::lock_guard<std::mutex> lock(syncSlots.mux);
+    syncSlots.waiting.erase(std::remove(syncSlots.waiting.begin(),
+        syncSlots.waiting.end(), &peerState), syncSlots.waiting.end());
+}
+
 void
 Mist::Central::listServices(const Mist::CryptoHelper::PublicKeyHash& keyHash,
     Mist::Central::peer_service_list_callback callback)
@@ -1695,6 +2262,8 @@ void Mist::Central::RestRequest::entry( const std::string& path ) {
         users(elts);
     } else if (elts[0] == "services") {
         services(elts);
+    } else if (elts[0] == "capabilities") {
+        capabilities(elts);
     } else {
         replyNotFound();
     }
@@ -1723,18 +2292,13 @@ void Mist::Central::RestRequest::transactions(
         } else if (elts[2] == "latest") {
             transactionsLatest( dbHash );
         } else if (boost::starts_with( elts[2], "?from=" )) {
-            std::string from = elts[2].substr( 6 );
-            int last = 0, pos = 0;
-            std::vector<CryptoHelper::SHA3> res;
-
-            pos = from.find( ",", last );
-            while (pos != std::string::npos) {
-                res.push_back( CryptoHelper::SHA3( from.substr( last, pos-last ) ) );
-                last = pos+1;
-                pos = from.find( ",", last );
+            transactionsFrom( dbHash, parseHashList( elts[2].substr( 6 ) ) );
+        } else if (elts[2] == "batch") {
+            if (eltCount == 4 && boost::starts_with( elts[3], "?from=" )) {
+                transactionsBatchFrom( dbHash, parseHashList( elts[3].substr( 6 ) ) );
+            } else {
+                replyBadRequest();
             }
-            res.push_back( CryptoHelper::SHA3( from.substr( last, from.length()-last ) ) );
-            transactionsFrom( dbHash, res );
         } else {
             CryptoHelper::SHA3 trHash( elts[2] );
             transaction( dbHash, trHash );
@@ -1742,8 +2306,13 @@ void Mist::Central::RestRequest::transactions(
     } else if (method == "POST") {
         if (eltCount == 3) {
             if (elts[2] == "new") {
-                // TODO Read transaction metadata from JSON body
                 transactionsNew( dbHash );
+            } else if (elts[2] == "reconcile") {
+                transactionsReconcile( dbHash );
+            } else if (elts[2] == "batch") {
+                transactionsBatch( dbHash );
+            } else {
+                replyNotFound();
             }
         } else {
             replyBadRequest();
@@ -1835,21 +2404,8 @@ void Mist::Central::RestRequest::transactionsFrom(
         const CryptoHelper::SHA3& dbHash,
         const std::vector<CryptoHelper::SHA3>& fromTrHashes ) {
 
-    auto db(central.getDatabase(dbHash));
+    auto db(readableDatabase(dbHash));
     if (db == nullptr) {
-        replyNotFound();
-        return;
-    }
-
-    auto user(db->getUser(keyHash.toString()));
-    if (!user) {
-        replyNotAuthorized();
-        return;
-    }
-
-    auto perm(user->getPermission());
-    if (perm != Permission::P::admin && perm != Permission::P::read) {
-        replyNotAuthorized();
         return;
     }
 
@@ -1872,7 +2428,177 @@ void Mist::Central::RestRequest::transactionsFrom(
 
 void Mist::Central::RestRequest::transactionsNew(
         const CryptoHelper::SHA3& dbHash ) {
-    // TODO Start syncing the transaction if we need the transaction
+    // POST /transactions/[SHA3]/new
+    // The body is a JSON array of transactions the peer has committed, sync
+    // the database with the peer if any of them are missing here
+    if (!central.hasDatabasePermission(keyHash, dbHash)) {
+        replyNotAuthorized();
+        return;
+    }
+    auto db(central.getDatabase(dbHash));
+    if (db == nullptr) {
+        replyNotFound();
+        return;
+    }
+
+    auto anchor(shared_from_this());
+    getAllData(request, [this, anchor, db, dbHash](std::string data)
+    {
+        bool missing(false);
+        try {
+            JSON::Value value(JSON::Deserialize::generate_json_value(data));
+            if (!value.is_array()) {
+                replyBadRequest();
+                return;
+            }
+            for (const auto& hash : value.array) {
+                if (!db->haveTransaction(CryptoHelper::SHA3(hash.get_string())))
+                    missing = true;
+            }
+        } catch (const std::exception&) {
+            replyBadRequest();
+            return;
+        }
+        request.stream().submitResponse(200, {});
+        request.stream().response().end();
+        if (missing) {
+            central.getPeerSyncState(keyHash).syncDatabase(dbHash);
+        }
+    });
+}
+
+void Mist::Central::RestRequest::transactionsReconcile(
+        const CryptoHelper::SHA3& dbHash ) {
+    // POST /transactions/[SHA3]/reconcile
+    // The body is a sketch of the transactions of the peer, reply with the
+    // metadata of the transactions it is missing, see Database::Sketch
+    auto db(readableDatabase(dbHash));
+    if (db == nullptr) {
+        return;
+    }
+
+    auto anchor(shared_from_this());
+    getAllData(request, [this, anchor, db](std::string data)
+    {
+        std::vector<std::string> missing;
+        try {
+            missing = db->getTransactionsMissingFrom(Database::Sketch::fromString(data));
+        } catch (const Mist::Exception&) {
+            replyConflict();
+            return;
+        } catch (const std::exception&) {
+            replyBadRequest();
+            return;
+        }
+        request.stream().submitResponse(200, {});
+        execOutStream(central.ioCtx, request.stream().response(),
+                [this, anchor, db, missing](std::streambuf& os) {
+            db->readTransactionMetadataOf(os, missing);
+        });
+    });
+}
+
+void Mist::Central::RestRequest::transactionsBatch(
+        const CryptoHelper::SHA3& dbHash ) {
+    // POST /transactions/[SHA3]/batch
+    // The body is a JSON array of at most DOWNLOAD_BATCH_SIZE transaction
+    // hashes, reply with the transactions in the same order
+    auto db(readableDatabase(dbHash));
+    if (db == nullptr) {
+        return;
+    }
+
+    auto anchor(shared_from_this());
+    getAllData(request, [this, anchor, db](std::string data)
+    {
+        std::vector<std::string> hashes;
+        try {
+            JSON::Value value(JSON::Deserialize::generate_json_value(data));
+            if (!value.is_array()
+                    || value.array.size() > DOWNLOAD_BATCH_SIZE) {
+                replyBadRequest();
+                return;
+            }
+            for (const auto& hash : value.array) {
+                hashes.push_back(hash.get_string());
+                if (!db->haveTransaction(CryptoHelper::SHA3(hashes.back()))) {
+                    replyNotFound();
+                    return;
+                }
+            }
+        } catch (const std::exception&) {
+            replyBadRequest();
+            return;
+        }
+        request.stream().submitResponse(200, {});
+        execOutStream(central.ioCtx, request.stream().response(),
+                [this, anchor, db, hashes](std::streambuf& os) {
+            db->readTransactions(os, hashes);
+        });
+    });
+}
+
+void Mist::Central::RestRequest::transactionsBatchFrom(
+        const CryptoHelper::SHA3& dbHash,
+        const std::vector<CryptoHelper::SHA3>& fromTrHashes ) {
+    // GET /transactions/[SHA3]/batch/?from=[SHA3],...
+    // Reply with the transactions from the most recent of the given ones
+    auto db(readableDatabase(dbHash));
+    if (db == nullptr) {
+        return;
+    }
+
+    std::vector<std::string> from;
+    for (const CryptoHelper::SHA3& trHash : fromTrHashes) {
+        if (!db->haveTransaction(trHash)) {
+            replyNotFound();
+            return;
+        }
+        from.push_back(trHash.toString());
+    }
+
+    auto anchor(shared_from_this());
+    request.stream().submitResponse(200, {});
+    execOutStream(central.ioCtx, request.stream().response(),
+            [this, anchor, db, from](std::streambuf& os) {
+        db->readTransactionsFrom(os, from);
+    });
+}
+
+Mist::Database* Mist::Central::RestRequest::readableDatabase(
+        const CryptoHelper::SHA3& dbHash ) {
+    auto db(central.getDatabase(dbHash));
+    if (db == nullptr) {
+        replyNotFound();
+        return nullptr;
+    }
+
+    auto user(db->getUser(keyHash.toString()));
+    if (!user) {
+        replyNotAuthorized();
+        return nullptr;
+    }
+
+    auto perm(user->getPermission());
+    if (perm != Permission::P::admin && perm != Permission::P::read) {
+        replyNotAuthorized();
+        return nullptr;
+    }
+    return db;
+}
+
+void Mist::Central::RestRequest::capabilities(
+        const std::vector<std::string>& elts ) {
+    // GET /capabilities
+    // Requests served beyond those of the first version of the protocol
+    if (elts.size() > 1) {
+        replyNotFound();
+    } else if (*request.method() != "GET") {
+        replyBadMethod();
+    } else {
+        request.stream().submitResponse(200, {});
+        request.stream().response().end(R"(["reconcile","batch","new","heads"])");
+    }
 }
 
 void Mist::Central::RestRequest::databases( const std::vector<std::string>& elts ) {
@@ -1886,6 +2612,12 @@ void Mist::Central::RestRequest::databases( const std::vector<std::string>& elts
         } else {
             replyBadMethod();
         }
+    } else if (eltCount == 2 && elts[1] == "heads") {
+        if (method == "GET") {
+            databasesHeads();
+        } else {
+            replyBadMethod();
+        }
     } else if (eltCount == 3 && elts[2] == "invite") {
         if (method == "POST") {
             // POST /databases/[SHA3]/invite
@@ -1926,6 +2658,25 @@ void Mist::Central::RestRequest::databasesAll() {
     });
 }
 
+void Mist::Central::RestRequest::databasesHeads() {
+    // GET /databases/heads
+    // The head digest of each database the peer has permission to, so that
+    // it only syncs those that changed
+    std::string body("{");
+    for (const CryptoHelper::SHA3& dbHash : central.listDatabasePermissions( keyHash )) {
+        auto db(central.getDatabase(dbHash));
+        if (db == nullptr)
+            continue;
+        if (body.length() > 1)
+            body += ",";
+        body += "\"" + dbHash.toString() + "\":\"" + db->getHeadDigest().toString() + "\"";
+    }
+    body += "}";
+
+    request.stream().submitResponse(200, {});
+    request.stream().response().end(body);
+}
+
 void Mist::Central::RestRequest::users( const std::vector<std::string>& elts ) {
     auto eltCount(elts.size());
     auto method(*request.method());
@@ -2042,3 +2793,9 @@ void Mist::Central::RestRequest::replyNotAuthorized() {
     request.stream().submitResponse(403, {});
     request.stream().response().end();
 }
+
+void Mist::Central::RestRequest::replyConflict() {
+    // 409 Conflict
+    request.stream().submitResponse(409, {});
+    request.stream().response().end();
+}
@@ -4,8 +4,12 @@
  * Free software licensed under GPLv3.
  */
 
+#include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <iterator>
+#include <limits>
+#include <sstream>
 #include <string>
 #include <thread>
 //#include <unistd.h>
@@ -22,6 +26,13 @@ namespace Mist {
 
 // Initialize static member
 unsigned Database::Database::subId = 0u;
+constexpr unsigned Database::VERSION_STRIDE;
+constexpr unsigned Database::VERSION_MIN_GAP;
+constexpr int Database::SCHEMA_VERSION;
+constexpr std::size_t Database::QUERY_CACHE_SIZE;
+constexpr std::size_t Database::READ_CONNECTION_POOL_SIZE;
+constexpr std::size_t Database::INGEST_BATCH_SIZE;
+constexpr std::size_t Database::SKETCH_CELLS_MAX;
 
 namespace {
 
@@ -53,6 +64,126 @@ std::map<std::string,ArgumentVT> valueMapToArgumentMap( const std::map<std::stri
     return res;
 }
 
+// A query cursor is the id of the last object on a page. Sorted queries
+// add the type and value of its sort attribute, "id:type:value".
+std::string makeCursor( unsigned long id ) {
+    return std::to_string( id );
+}
+
+std::string makeCursor( unsigned long id, const Database::Value& sortValue ) {
+    using T = Database::Value::Type;
+    std::string cursor{ makeCursor( id ) + ":" + std::to_string( static_cast<int>( sortValue.type() ) ) + ":" };
+    switch ( sortValue.type() ) {
+    case T::Boolean:
+        cursor += sortValue.boolean() ? "1" : "0";
+        break;
+    case T::Number: {
+        std::ostringstream number{};
+        number.precision( std::numeric_limits<double>::max_digits10 );
+        number << sortValue.number();
+        cursor += number.str();
+        break;
+    }
+    case T::String:
+    case T::Json:
+        cursor += sortValue.string();
+        break;
+    default:
+        break;
+    }
+    return cursor;
+}
+
+std::pair<ArgumentVT, unsigned long> parseCursor( const std::string& cursor, bool sorted ) {
+    using T = Database::Value::Type;
+    std::size_t separator{ cursor.find( ':' ) };
+    std::size_t valueSeparator{ std::string::npos == separator ? separator : cursor.find( ':', separator + 1 ) };
+    if ( sorted == ( std::string::npos != valueSeparator ) ) {
+        try {
+            std::size_t end{};
+            unsigned long id{ std::stoul( cursor.substr( 0, separator ), &end ) };
+            if ( end == cursor.substr( 0, separator ).size() ) {
+                if ( !sorted ) {
+                    return std::make_pair( ArgumentVT( nullptr ), id );
+                }
+                std::string value{ cursor.substr( valueSeparator + 1 ) };
+                switch ( static_cast<T>( std::stoi( cursor.substr( separator + 1, valueSeparator - separator - 1 ) ) ) ) {
+                case T::Typeless:
+                case T::Null:
+                    return std::make_pair( ArgumentVT( nullptr ), id );
+                case T::Boolean:
+                    return std::make_pair( ArgumentVT( "1" == value ), id );
+                case T::Number:
+                    return std::make_pair( ArgumentVT( std::stod( value ) ), id );
+                case T::String:
+                    return std::make_pair( ArgumentVT( value ), id );
+                case T::Json:
+                    return std::make_pair( ArgumentVT( value, true ), id );
+                default:
+                    break;
+                }
+            }
+        } catch ( const std::logic_error& ) {
+            // Not a number
+        }
+    }
+    throw std::runtime_error( "Invalid cursor" );
+}
+
+// Number of cells each hash is added to in a Database::Sketch
+const std::size_t SKETCH_HASHES{ 3 };
+
+// Checksum of a hash in a Database::Sketch. It must not be linear in the
+// hash, so that the sum of several hashes does not pass as one (FNV-1a).
+std::uint32_t sketchCheck( const std::array<std::uint8_t, 32>& key ) {
+    std::uint32_t check{ 2166136261u };
+    for ( std::uint8_t b : key ) {
+        check = ( check ^ b ) * 16777619u;
+    }
+    return check;
+}
+
+// Split a stream of exchange format transactions into one string per
+// transaction, they may be separated by newlines or nothing at all
+std::vector<std::string> splitTransactions( std::basic_streambuf<char>& sb ) {
+    std::vector<std::string> transactions{};
+    std::string current{};
+    unsigned depth{ 0 };
+    bool inString{ false }, escaped{ false };
+    for ( std::istreambuf_iterator<char> it( &sb ), end; it != end; ++it ) {
+        char c{ *it };
+        if ( 0 == depth && '{' != c ) {
+            continue;
+        }
+        current += c;
+        if ( inString ) {
+            if ( escaped ) {
+                escaped = false;
+            } else if ( '\\' == c ) {
+                escaped = true;
+            } else if ( '"' == c ) {
+                inString = false;
+            }
+        } else if ( '"' == c ) {
+            inString = true;
+        } else if ( '{' == c ) {
+            ++depth;
+        } else if ( '}' == c && 0 == --depth ) {
+            transactions.push_back( std::move( current ) );
+            current.clear();
+        }
+    }
+    if ( depth ) {
+        throw FormatException( "Incomplete transaction at the end of the stream." );
+    }
+    return transactions;
+}
+
+// Results of Database::verifySignatures
+const char SIGNATURE_UNKNOWN{ 0 };
+const char SIGNATURE_VALID{ 1 };
+const char SIGNATURE_INVALID{ 2 };
+
 } /* anonymous namespace */
 
 Database::Database( Central *central, std::string path ) :
@@ -74,6 +205,12 @@ Database::Database( Central *central, std::string path ) :
 }
 
 Database::~Database() {
+    try {
+        flushGroupCommit();
+    } catch (...) {
+        LOG ( WARNING ) << "Group commit failed.";
+    }
+    stopWriter();
 }
 
 bool Database::isOK() {
@@ -131,18 +268,25 @@ void Database::create( unsigned localId, std::unique_ptr<Manifest> manifest ) {
         db->exec( "CREATE TABLE Object (accessDomain INTEGER, id INTEGER, version INTEGER, status INTEGER, parent INTEGER, parentAccessDomain INTEGER, transactionAction INTEGER, "
                 "PRIMARY KEY ( accessDomain, id, version ) ) " );
         db->exec( "CREATE INDEX status_index ON Object ( accessDomain, id, status ) " );
-        db->exec( "CREATE INDEX parent_index ON Object ( accessDomain, id, parent, status ) " );
 
         db->exec( "CREATE TABLE Attribute (accessDomain INTEGER, id INTEGER, version INTEGER, name TEXT, type INTEGER, value, "
                 "PRIMARY KEY ( accessDomain, id, version, name ) ) " );
-        db->exec( "CREATE TABLE 'Transaction' (accessDomain INTEGER, version INTEGER, timestamp DATETIME, userHash TEXT, hash TEXT, signature TEXT, "
+        createObjectHeadTable();
+        db->exec( "CREATE TABLE 'Transaction' (accessDomain INTEGER, version INTEGER, timestamp DATETIME, userHash BLOB, hash BLOB, signature BLOB, "
                 "PRIMARY KEY ( accessDomain, version ) ) " );
         db->exec( "CREATE TABLE TransactionParent (accessDomain INTEGER, version INTEGER, parentAccessDomain INTEGER, parentVersion INTEGER, "
                 "PRIMARY KEY ( accessDomain, version ) ) " );
         db->exec( "CREATE TABLE Renumber (accessDomain INTEGER, version INTEGER, oldId INTEGER, newId INTEGER, "
                 "PRIMARY KEY ( accessDomain, version ) ) " );
+        createIndexes();
+        db->exec( "PRAGMA user_version=" + std::to_string( SCHEMA_VERSION ) );
 
         transaction.commit();
+        {
+            std::lock_guard<std::mutex> lock( graphMutex );
+            graph.clear();
+            graphHeads.clear();
+        }
     /*
     } catch ( Helper::Database::Exception &e ) {
         // TODO: handle errors
@@ -165,6 +309,8 @@ void Database::init( std::unique_ptr<Manifest> manifest ) {
         if ( !db ) { // TODO: what to do if this.create() have been called?
             db.reset( new Connection( path, Helper::Database::OPEN_READWRITE ) );
         }
+        migrate();
+        loadGraph();
     } catch ( Helper::Database::Exception &e ) {
         // TODO: handle errors.
         _isOK = false;
@@ -172,6 +318,186 @@ void Database::init( std::unique_ptr<Manifest> manifest ) {
     }
 }
 
+void Database::loadGraph() {
+    std::lock_guard<std::mutex> lock( graphMutex );
+    graph.clear();
+    graphHeads.clear();
+
+    Database::Statement transactions( *db,
+            "SELECT hash, timestamp "
+            "FROM 'Transaction' "
+            "WHERE hash IS NOT NULL " );
+    while ( transactions.executeStep() ) {
+        GraphNode node{};
+        node.timestamp = transactions.getColumn( "timestamp" ).getString();
+        graph.emplace( columnToHash( transactions.getColumn( "hash" ) ), std::move( node ) );
+    }
+
+    Database::Statement parents( *db,
+            "SELECT t.hash AS hash, p.hash AS parentHash "
+            "FROM TransactionParent AS tp, 'Transaction' AS t, 'Transaction' AS p "
+            "WHERE t.accessDomain=tp.accessDomain AND t.version=tp.version "
+                "AND p.accessDomain=tp.parentAccessDomain AND p.version=tp.parentVersion "
+            "ORDER BY p.hash " );
+    while ( parents.executeStep() ) {
+        CryptoHelper::SHA3 hash{ columnToHash( parents.getColumn( "hash" ) ) };
+        CryptoHelper::SHA3 parentHash{ columnToHash( parents.getColumn( "parentHash" ) ) };
+        auto child = graph.find( hash );
+        auto parent = graph.find( parentHash );
+        if ( child == graph.end() || parent == graph.end() ) {
+            continue;
+        }
+        child->second.parents.push_back( parentHash );
+        parent->second.children.push_back( hash );
+    }
+
+    for ( const auto& node : graph ) {
+        if ( node.second.children.empty() ) {
+            graphHeads.insert( node.first );
+        }
+    }
+    LOG( DBUG ) << "Loaded " << graph.size() << " transactions, " << graphHeads.size() << " heads";
+}
+
+void Database::addToGraph( const graph_nodes_t& nodes ) {
+    std::lock_guard<std::mutex> lock( graphMutex );
+    for ( const auto& added : nodes ) {
+        if ( !graph.emplace( added.first, added.second ).second ) {
+            continue;
+        }
+        for ( const CryptoHelper::SHA3& parentHash : added.second.parents ) {
+            auto parent = graph.find( parentHash );
+            if ( parent != graph.end() ) {
+                parent->second.children.push_back( added.first );
+                graphHeads.erase( parentHash );
+            }
+        }
+        graphHeads.insert( added.first );
+    }
+}
+
+void Database::announceTransactions( const std::vector<CryptoHelper::SHA3>& hashes ) {
+    if ( central && manifest && !hashes.empty() ) {
+        central->announceTransactions( manifest->getHash(), hashes );
+    }
+}
+
+void Database::createIndexes() {
+    // Transactions are looked up by hash during sync
+    db->exec( "CREATE UNIQUE INDEX IF NOT EXISTS transaction_hash_index ON 'Transaction' ( hash ) " );
+    // Transactions are ordered and renumbered by version, see reorderTransaction
+    db->exec( "CREATE INDEX IF NOT EXISTS transaction_version_index ON 'Transaction' ( version ) " );
+    db->exec( "CREATE INDEX IF NOT EXISTS transaction_timestamp_index ON 'Transaction' ( timestamp, version ) " );
+    db->exec( "CREATE INDEX IF NOT EXISTS transaction_parent_version_index ON TransactionParent ( version ) " );
+    db->exec( "CREATE INDEX IF NOT EXISTS transaction_parent_parent_version_index ON TransactionParent ( parentVersion ) " );
+    db->exec( "CREATE INDEX IF NOT EXISTS object_version_index ON Object ( version ) " );
+    db->exec( "CREATE INDEX IF NOT EXISTS attribute_version_index ON Attribute ( version ) " );
+    db->exec( "CREATE INDEX IF NOT EXISTS renumber_version_index ON Renumber ( version ) " );
+    // Queries list the children of a parent, see Query::parseQuery. The
+    // version limited queries group on id and pick MAX(version) straight
+    // from the index, and unsorted pages are read in id order.
+    db->exec( "CREATE INDEX IF NOT EXISTS object_parent_index ON Object ( accessDomain, parent, id, version, status ) " );
+    db->exec( "CREATE INDEX IF NOT EXISTS object_head_parent_index ON ObjectHead ( accessDomain, parent, status, id ) " );
+    db->exec( "CREATE INDEX IF NOT EXISTS object_head_version_index ON ObjectHead ( version ) " );
+}
+
+void Database::createObjectHeadTable() {
+    // The latest version of every object, kept up to date by updateObjectHeads
+    db->exec( "CREATE TABLE ObjectHead (accessDomain INTEGER, id INTEGER, version INTEGER, status INTEGER, parent INTEGER, parentAccessDomain INTEGER, transactionAction INTEGER, "
+            "PRIMARY KEY ( accessDomain, id ) ) " );
+}
+
+void Database::updateObjectHeads( unsigned version, Connection* connection ) {
+    Connection* conn{ db.get() };
+    if ( nullptr != connection ) {
+        conn = connection;
+    }
+    // Only the objects changed in the transaction can have a new head. The
+    // transaction may have been placed before newer ones, so look up the
+    // latest version of each object rather than assuming it is this one.
+    CachedStatement heads( *conn,
+            "INSERT OR REPLACE INTO ObjectHead (accessDomain, id, version, status, parent, parentAccessDomain, transactionAction) "
+            "SELECT o.accessDomain, o.id, o.version, o.status, o.parent, o.parentAccessDomain, o.transactionAction "
+            "FROM Object AS t, Object AS o "
+            "WHERE t.version=? AND o.accessDomain=t.accessDomain AND o.id=t.id "
+                "AND o.version=( SELECT MAX(version) FROM Object WHERE accessDomain=t.accessDomain AND id=t.id ) " );
+    heads << version;
+    heads.exec();
+}
+
+void Database::migrate() {
+    int schemaVersion{ db->execAndGet( "PRAGMA user_version" ).getInt() };
+    if ( SCHEMA_VERSION == schemaVersion ) {
+        return;
+    }
+    if ( SCHEMA_VERSION < schemaVersion ) {
+        _isOK = false;
+        LOG ( WARNING ) << "Database schema version " << schemaVersion << " is newer than supported";
+        throw std::runtime_error( "Database schema version is newer than supported" );
+    }
+
+    LOG ( INFO ) << "Migrating database from schema version " << schemaVersion;
+    Helper::Database::Transaction transaction( *db.get() );
+    if ( schemaVersion < 1 ) {
+        // Spread out the dense version numbers so that reorderTransaction
+        // has room to place late transactions between existing ones.
+        // Negate first to avoid primary key collisions while renumbering.
+        const std::string stride{ std::to_string( VERSION_STRIDE ) };
+        for ( const char* table : { "Attribute", "Object", "'Transaction'", "Renumber" } ) {
+            db->exec( std::string( "UPDATE " ) + table + " SET version=-version*" + stride );
+            db->exec( std::string( "UPDATE " ) + table + " SET version=-version" );
+        }
+        db->exec( "UPDATE TransactionParent SET version=-version*" + stride + ", parentVersion=-parentVersion*" + stride );
+        db->exec( "UPDATE TransactionParent SET version=-version, parentVersion=-parentVersion" );
+    }
+    if ( schemaVersion < 2 ) {
+        // Hashes and signatures used to be stored as base64 TEXT, rebuild
+        // the table with BLOB columns and decode the existing values.
+        db->exec( "CREATE TABLE TransactionBlob (accessDomain INTEGER, version INTEGER, timestamp DATETIME, userHash BLOB, hash BLOB, signature BLOB, "
+                "PRIMARY KEY ( accessDomain, version ) ) " );
+        {
+            Statement select( *db,
+                    "SELECT accessDomain, version, timestamp, userHash, hash, signature "
+                    "FROM 'Transaction' " );
+            Statement insert( *db,
+                    "INSERT INTO TransactionBlob (accessDomain, version, timestamp, userHash, hash, signature) "
+                    "VALUES (?, ?, ?, ?, ?, ?) " );
+            while ( select.executeStep() ) {
+                insert << select.getColumn( "accessDomain" ).getInt()
+                        << select.getColumn( "version" ).getUInt()
+                        << select.getColumn( "timestamp" ).getString()
+                        << toBlob( CryptoHelper::SHA3::fromString( select.getColumn( "userHash" ).getString() ) )
+                        << toBlob( CryptoHelper::SHA3::fromString( select.getColumn( "hash" ).getString() ) )
+                        << toBlob( CryptoHelper::Signature::fromString( select.getColumn( "signature" ).getString() ) );
+                insert.exec();
+                insert.reset();
+                insert.clearBindings();
+            }
+        }
+        db->exec( "DROP TABLE 'Transaction'" );
+        db->exec( "ALTER TABLE TransactionBlob RENAME TO 'Transaction'" );
+    }
+    if ( schemaVersion < 3 ) {
+        createObjectHeadTable();
+        db->exec( "INSERT INTO ObjectHead (accessDomain, id, version, status, parent, parentAccessDomain, transactionAction) "
+                "SELECT o.accessDomain, o.id, o.version, o.status, o.parent, o.parentAccessDomain, o.transactionAction "
+                "FROM Object AS o "
+                "WHERE o.version=( SELECT MAX(version) FROM Object WHERE accessDomain=o.accessDomain AND id=o.id ) " );
+    }
+    if ( schemaVersion < 4 ) {
+        // Led with id and could not be used to find children, replaced by
+        // object_parent_index
+        db->exec( "DROP INDEX IF EXISTS parent_index" );
+    }
+    if ( schemaVersion < 5 ) {
+        // Recreated with the id, so that pages need not be sorted
+        db->exec( "DROP INDEX IF EXISTS object_head_parent_index" );
+    }
+    createIndexes();
+    db->exec( "PRAGMA user_version=" + std::to_string( SCHEMA_VERSION ) );
+    transaction.commit();
+}
+
 /*
 void Database::load() {
     LOG( DBUG ) << "Loading transactions from disk.";
@@ -185,6 +511,21 @@ void Database::load() {
 
 void Database::close() {
     LOG ( DBUG ) << "Closing database";
+    flushGroupCommit();
+    stopWriter();
+    {
+        std::lock_guard<std::recursive_mutex> lock( mux );
+        groupTransaction.reset();
+        groupConnection.reset();
+    }
+    if ( db ) {
+        LOG ( DBUG ) << "Statement cache hits " << db->getStatementCacheHits()
+                << ", misses " << db->getStatementCacheMisses();
+    }
+    {
+        std::lock_guard<std::mutex> lock( readConnectionsMutex );
+        readConnections.clear();
+    }
     db.reset();
 }
 
@@ -207,22 +548,425 @@ std::unique_ptr<Mist::Transaction> Database::beginTransaction() {
     return std::move( beginTransaction( AccessDomain::Normal ) );
 }
 
+std::future<void> Database::commitAsync( std::unique_ptr<Mist::Transaction> transaction ) {
+    std::shared_ptr<Mist::Transaction> pending{ std::move( transaction ) };
+    return submitWrite( [pending]() -> void {
+        pending->commit();
+    } );
+}
+
+std::future<void> Database::commitAsync( std::unique_ptr<Mist::RemoteTransaction> transaction ) {
+    std::shared_ptr<Mist::RemoteTransaction> pending{ std::move( transaction ) };
+    return submitWrite( [pending]() -> void {
+        pending->commit();
+    } );
+}
+
+void Database::setGroupCommit( unsigned maxTransactions, unsigned windowMilliseconds ) {
+    std::lock_guard<std::recursive_mutex> lock( mux );
+    if ( groupMemberOpen ) {
+        throw std::runtime_error( "Can not change group commit during a transaction" );
+    }
+    flushGroupCommit();
+    groupCommitSize = maxTransactions > 1 ? maxTransactions : 0;
+    groupCommitWindow = std::chrono::milliseconds( windowMilliseconds );
+    if ( !groupCommitSize ) {
+        groupConnection.reset();
+    }
+}
+
+void Database::flushGroupCommit() {
+    std::lock_guard<std::recursive_mutex> lock( mux );
+    // An open transaction flushes the group when it ends
+    if ( !groupTransaction || groupMemberOpen ) {
+        return;
+    }
+    std::set<ObjectRef,lessObjectRef> objects{};
+    objects.swap( groupObjects );
+    graph_nodes_t nodes{};
+    nodes.swap( groupNodes );
+    LOG( DBUG ) << "Group commit of " << groupCommitted << " transactions";
+    groupCommitted = 0;
+    ++groupSequence;
+    try {
+        groupTransaction->commit();
+        groupTransaction.reset();
+    } catch (...) {
+        groupTransaction.reset();
+        LOG( WARNING ) << "Group commit failed.";
+        throw Exception( Error::ErrorCode::UnexpectedDatabaseError );
+    }
+    addToGraph( nodes );
+    std::vector<CryptoHelper::SHA3> hashes{};
+    for ( const auto& node : nodes ) {
+        hashes.push_back( node.first );
+    }
+    announceTransactions( hashes );
+    objectsChanged( objects );
+}
+
+void Database::endGroupTransaction( const std::set<ObjectRef,lessObjectRef>& objects, bool committed,
+        const CryptoHelper::SHA3& hash, GraphNode node ) {
+    std::lock_guard<std::recursive_mutex> lock( mux );
+    groupMemberOpen = false;
+    resumeRemoteWrites();
+    groupCondition.notify_all();
+    if ( committed ) {
+        groupObjects.insert( objects.begin(), objects.end() );
+        groupNodes.emplace_back( hash, std::move( node ) );
+        if ( 1 == ++groupCommitted ) {
+            // The first transaction of the group starts the window
+            groupCommitDeadline = std::chrono::steady_clock::now() + groupCommitWindow;
+        }
+    }
+    // The timer leaves the group alone while a transaction is open, so a
+    // window that passed meanwhile is handled here
+    bool windowPassed{ groupCommitted && groupCommitWindow.count()
+        && std::chrono::steady_clock::now() >= groupCommitDeadline };
+    if ( groupCommitted >= groupCommitSize || windowPassed ) {
+        flushGroupCommit();
+    } else if ( committed && 1 == groupCommitted && groupCommitWindow.count() ) {
+        try {
+            scheduleGroupFlush( groupSequence, groupCommitDeadline );
+        } catch ( const std::runtime_error& ) {
+            // Closing, write the group now
+            flushGroupCommit();
+        }
+    }
+}
+
+std::future<void> Database::submitWrite( std::function<void()> job, bool remote ) {
+    std::shared_ptr<std::promise<void>> done{ std::make_shared<std::promise<void>>() };
+    std::future<void> future{ done->get_future() };
+    {
+        std::lock_guard<std::mutex> lock( writerMutex );
+        if ( writerStopping ) {
+            throw std::runtime_error( "Database is closing" );
+        }
+        if ( !writer.joinable() ) {
+            writer = std::thread( &Database::runWriter, this );
+        }
+        writerQueue.push_back( WriterJob{ [job, done]() -> void {
+            try {
+                job();
+                done->set_value();
+            } catch (...) {
+                done->set_exception( std::current_exception() );
+            }
+        }, remote } );
+    }
+    writerCondition.notify_one();
+    return future;
+}
+
+void Database::scheduleGroupFlush( unsigned group, std::chrono::steady_clock::time_point deadline ) {
+    {
+        std::lock_guard<std::mutex> lock( writerMutex );
+        if ( writerStopping ) {
+            throw std::runtime_error( "Database is closing" );
+        }
+        if ( !writer.joinable() ) {
+            writer = std::thread( &Database::runWriter, this );
+        }
+        groupTimerArmed = true;
+        groupTimerSequence = group;
+        groupTimerDeadline = deadline;
+    }
+    writerCondition.notify_one();
+}
+
+void Database::resumeRemoteWrites() {
+    if ( groupWaiting.empty() ) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock( writerMutex );
+        for ( auto it = groupWaiting.rbegin(); it != groupWaiting.rend(); ++it ) {
+            writerQueue.push_front( WriterJob{ std::move( *it ), true } );
+        }
+    }
+    groupWaiting.clear();
+    writerCondition.notify_one();
+}
+
+void Database::runWriter() {
+    {
+        std::lock_guard<std::recursive_mutex> groupLock( mux );
+        writerThread = std::this_thread::get_id();
+    }
+    std::unique_lock<std::mutex> lock( writerMutex );
+    while ( true ) {
+        auto ready = [this]() -> bool {
+            return writerStopping || !writerQueue.empty();
+        };
+        if ( groupTimerArmed ) {
+            // Waiting for the window does not hold up the commits queued meanwhile
+            writerCondition.wait_until( lock, groupTimerDeadline, ready );
+        } else {
+            writerCondition.wait( lock, ready );
+        }
+        if ( groupTimerArmed && ( writerStopping
+                || std::chrono::steady_clock::now() >= groupTimerDeadline ) ) {
+            groupTimerArmed = false;
+            unsigned group{ groupTimerSequence };
+            lock.unlock();
+            try {
+                std::lock_guard<std::recursive_mutex> groupLock( mux );
+                if ( group == groupSequence ) {
+                    flushGroupCommit();
+                }
+            } catch (...) {
+                // Logged by flushGroupCommit, the group is dropped
+            }
+            lock.lock();
+            continue;
+        }
+        if ( writerQueue.empty() ) {
+            // Stopping, and everything queued has been written
+            return;
+        }
+        WriterJob job{ std::move( writerQueue.front() ) };
+        writerQueue.pop_front();
+        lock.unlock();
+        std::unique_ptr<RemoteWrite> remoteWrite{};
+        if ( job.remote ) {
+            std::lock_guard<std::recursive_mutex> groupLock( mux );
+            if ( groupMemberOpen ) {
+                lock.lock();
+                if ( !writerStopping ) {
+                    // Written when the transaction ends, the writer may have to commit it
+                    groupWaiting.push_back( std::move( job.run ) );
+                    continue;
+                }
+                lock.unlock();
+            } else {
+                try {
+                    remoteWrite.reset( new RemoteWrite( this ) );
+                } catch (...) {
+                    // The group could not be written and is dropped, see flushGroupCommit
+                }
+            }
+        }
+        job.run();
+        job.run = nullptr;
+        remoteWrite.reset();
+        lock.lock();
+    }
+}
+
+void Database::stopWriter() {
+    {
+        // The remote writes waiting for the group are written, or fail, now
+        std::lock_guard<std::recursive_mutex> groupLock( mux );
+        resumeRemoteWrites();
+        std::lock_guard<std::mutex> lock( writerMutex );
+        writerStopping = true;
+    }
+    writerCondition.notify_one();
+    if ( writer.joinable() ) {
+        writer.join();
+    }
+    std::lock_guard<std::mutex> lock( writerMutex );
+    writerStopping = false;
+}
+
 void Database::writeToDatabase( std::basic_streambuf<char>& sb ) {
+    RemoteWrite write( this );
     deserializer->write( sb );
 }
 
 void Database::writeToDatabase( const char* data, std::size_t length ) {
+    RemoteWrite write( this );
     deserializer->write( data, length );
 }
 
 void Database::writeToDatabase( const std::string& data ) {
+    RemoteWrite write( this );
     deserializer->write( data );
 }
 
+std::size_t Database::ingest( std::basic_streambuf<char>& sb ) {
+    // Read the meta data of every transaction so they can be sorted once
+    std::vector<std::pair<Meta, std::string>> transactions{};
+    for ( std::string& text : splitTransactions( sb ) ) {
+        std::stringbuf buffer{ text };
+        std::vector<Meta> meta{ Deserializer::exchangeFormatToMeta( buffer ) };
+        if ( 1 != meta.size() ) {
+            throw FormatException( "Expected one transaction." );
+        }
+        transactions.emplace_back( meta.front(), std::move( text ) );
+    }
+    std::sort( transactions.begin(), transactions.end(),
+            []( const std::pair<Meta, std::string>& l, const std::pair<Meta, std::string>& r ) -> bool {
+        const std::string lTimestamp{ l.first.timestamp.toString() }, rTimestamp{ r.first.timestamp.toString() };
+        return lTimestamp < rTimestamp
+                || ( lTimestamp == rTimestamp && l.first.transactionHash < r.first.transactionHash );
+    } );
+    LOG( DBUG ) << "Ingesting " << transactions.size() << " transactions";
+
+    RemoteWrite write( this );
+    std::unique_ptr<Connection> connection{ getIsolatedDbConnection() };
+    std::size_t written{ 0 };
+    for ( std::size_t first{ 0 }; first < transactions.size(); first += INGEST_BATCH_SIZE ) {
+        std::size_t last{ std::min( first + INGEST_BATCH_SIZE, transactions.size() ) };
+        {
+            std::lock_guard<std::recursive_mutex> lock( mux );
+            batchObjects.clear();
+            batchNodes.clear();
+        }
+        Helper::Database::Transaction batch( *connection );
+        std::vector<std::size_t> pending{};
+        std::vector<Meta> added{};
+        for ( std::size_t i{ first }; i < last; ++i ) {
+            const Meta& meta = transactions.at( i ).first;
+            if ( !added.empty() && added.back().transactionHash == meta.transactionHash ) {
+                continue;
+            }
+            if ( haveTransaction( meta.transactionHash ) ) {
+                continue;
+            }
+            pending.push_back( i );
+            added.push_back( meta );
+        }
+
+        // The signatures are verified on other threads while the batch is written in order
+        std::future<std::vector<char>> signatures{ verifySignatures( added, connection.get() ) };
+        Deserializer deserializer( this, connection.get() );
+        for ( std::size_t i : pending ) {
+            deserializer.write( transactions.at( i ).second );
+        }
+        written += verifyBatch( added, signatures.get(), connection.get() );
+        batch.commit();
+
+        std::set<ObjectRef,lessObjectRef> objects{};
+        graph_nodes_t nodes{};
+        {
+            std::lock_guard<std::recursive_mutex> lock( mux );
+            objects.swap( batchObjects );
+            nodes.swap( batchNodes );
+        }
+        addToGraph( nodes );
+        objectsChanged( objects );
+    }
+    return written;
+}
+
+std::future<std::vector<char>> Database::verifySignatures( const std::vector<Meta>& batch,
+        Connection* connection ) const {
+    // Look up the signers here, the connection must not be shared with the workers
+    std::vector<CryptoHelper::PublicKey> signers( batch.size() );
+    std::vector<char> known( batch.size(), 0 );
+    for ( std::size_t i{ 0 }; i < batch.size(); ++i ) {
+        try {
+            signers.at( i ) = transactionSigner( batch.at( i ).user, connection );
+            known.at( i ) = 1;
+        } catch ( const Mist::Exception& ) {
+            // Rejected in order when the transaction is written
+        }
+    }
+
+    return std::async( std::launch::async, [this, batch, signers, known]() -> std::vector<char> {
+        std::vector<char> verified( batch.size(), SIGNATURE_UNKNOWN );
+        std::size_t threads{ std::max( 1u, std::thread::hardware_concurrency() ) };
+        std::size_t chunk{ ( batch.size() + threads - 1 ) / threads };
+        std::vector<std::future<void>> workers{};
+        for ( std::size_t begin{ 0 }; begin < batch.size(); begin += chunk ) {
+            std::size_t end{ std::min( begin + chunk, batch.size() ) };
+            workers.push_back( std::async( std::launch::async, [&, begin, end]() -> void {
+                for ( std::size_t i{ begin }; i < end; ++i ) {
+                    if ( known.at( i ) ) {
+                        verified.at( i ) = verifier( signers.at( i ),
+                                batch.at( i ).transactionHash, batch.at( i ).signature ) ?
+                                        SIGNATURE_VALID : SIGNATURE_INVALID;
+                    }
+                }
+            } ) );
+        }
+        for ( std::future<void>& worker : workers ) {
+            worker.get();
+        }
+        return verified;
+    } );
+}
+
+std::size_t Database::verifyBatch( const std::vector<Meta>& batch, std::vector<char> signatures,
+        Connection* connection ) const {
+    std::size_t verified{ 0 };
+    for ( std::size_t i{ 0 }; i < batch.size(); ++i ) {
+        const Meta& meta = batch.at( i );
+        Database::Transaction transaction{};
+        try {
+            transaction = getTransactionMeta( meta.transactionHash, connection );
+        } catch ( const Exception& ) {
+            // Skipped since its parents are missing
+            continue;
+        }
+        bool valid{ SIGNATURE_VALID == signatures.at( i ) };
+        if ( SIGNATURE_UNKNOWN == signatures.at( i ) ) {
+            valid = verifier( transactionSigner( transaction.creatorHash, connection ),
+                    transaction.hash, transaction.signature );
+        }
+        if ( !valid ) {
+            LOG( WARNING ) << "Transaction signature validation failed.";
+            throw Mist::Exception( Mist::Error::ErrorCode::InvalidTransaction );
+        }
+        ++verified;
+    }
+    return verified;
+}
+
+void Database::batchCommitted( const std::set<ObjectRef,lessObjectRef>& objects,
+        const CryptoHelper::SHA3& hash, GraphNode node ) {
+    std::lock_guard<std::recursive_mutex> lock( mux );
+    batchObjects.insert( objects.begin(), objects.end() );
+    batchNodes.emplace_back( hash, std::move( node ) );
+}
+
+void Database::writeToDatabaseAsync( const std::string& data,
+        std::function<void(std::exception_ptr)> done ) {
+    submitWrite( [this, data, done]() -> void {
+        std::exception_ptr error{};
+        try {
+            writeToDatabase( data );
+        } catch (...) {
+            error = std::current_exception();
+        }
+        if ( done ) {
+            done( error );
+        }
+    }, true );
+}
+
+std::shared_ptr<Deserializer> Database::openWriteStream() {
+    return std::make_shared<Deserializer>( this );
+}
+
+void Database::writeToStreamAsync( std::shared_ptr<Deserializer> stream,
+        const std::string& data,
+        std::function<void(std::exception_ptr)> done ) {
+    submitWrite( [stream, data, done]() -> void {
+        std::exception_ptr error{};
+        try {
+            stream->write( data );
+        } catch (...) {
+            error = std::current_exception();
+        }
+        if ( done ) {
+            done( error );
+        }
+    }, true );
+}
+
 void Database::readTransaction( std::basic_streambuf<char>& sb,
         const std::string& hash,
         Connection* connection ) const {
-    serializer->readTransaction( sb, hash, connection );
+    if ( connection ) {
+        serializer->readTransaction( sb, hash, connection );
+        return;
+    }
+    // Reads for peers use a serializer and snapshot of their own
+    ReadConnection reader{ getReadConnection() };
+    Serializer( this ).readTransaction( sb, hash, reader.get() );
 }
 
 void Database::readTransactionBody( std::basic_streambuf<char>& sb,
@@ -238,19 +982,38 @@ void Database::readTransactionBody( std::basic_streambuf<char>& sb,
 }
 
 void Database::readTransactionList( std::basic_streambuf<char>& sb ) const {
-    serializer->readTransactionList( sb );
+    ReadConnection reader{ getReadConnection() };
+    Serializer( this ).readTransactionList( sb, reader.get() );
 }
 
 void Database::readTransactionMetadata( std::basic_streambuf<char>& sb, const std::string& hash ) const {
-    serializer->readTransactionMetadata( sb, hash );
+    ReadConnection reader{ getReadConnection() };
+    Serializer( this ).readTransactionMetadata( sb, hash, reader.get() );
 }
 
 void Database::readTransactionMetadataLastest( std::basic_streambuf<char>& sb ) const {
-    serializer->readTransactionMetadataLatest( sb );
+    ReadConnection reader{ getReadConnection() };
+    Serializer( this ).readTransactionMetadataLatest( sb, reader.get() );
 }
 
 void Database::readTransactionMetadataFrom( std::basic_streambuf<char>& sb, const std::vector<std::string>& hashes ) const {
-    serializer->readTransactionMetadataFrom( sb, hashes );
+    ReadConnection reader{ getReadConnection() };
+    Serializer( this ).readTransactionMetadataFrom( sb, hashes, reader.get() );
+}
+
+void Database::readTransactionMetadataOf( std::basic_streambuf<char>& sb, const std::vector<std::string>& hashes ) const {
+    ReadConnection reader{ getReadConnection() };
+    Serializer( this ).readTransactionMetadataOf( sb, hashes, reader.get() );
+}
+
+void Database::readTransactions( std::basic_streambuf<char>& sb, const std::vector<std::string>& hashes ) const {
+    ReadConnection reader{ getReadConnection() };
+    Serializer( this ).readTransactions( sb, hashes, reader.get() );
+}
+
+void Database::readTransactionsFrom( std::basic_streambuf<char>& sb, const std::vector<std::string>& hashes ) const {
+    ReadConnection reader{ getReadConnection() };
+    Serializer( this ).readTransactionsFrom( sb, hashes, reader.get() );
 }
 
 void Database::readUser( std::basic_streambuf<char>& sb, const std::string& hash ) const {
@@ -271,7 +1034,7 @@ Database::Transaction Database::getTransactionMeta( unsigned version,
     if ( nullptr != connection ) {
         conn = connection;
     }
-    Database::Statement transactionMeta( *conn,
+    Database::CachedStatement transactionMeta( *conn,
             "SELECT accessDomain, version, timestamp, userHash, hash, signature "
             " FROM 'Transaction' "
             " WHERE version=? " );
@@ -285,15 +1048,20 @@ Database::Transaction Database::getTransactionMeta( unsigned version,
 
 Database::Transaction Database::getTransactionMeta( const std::string& hash,
         Connection* connection ) const {
+    return getTransactionMeta( CryptoHelper::SHA3::fromString( hash ), connection );
+}
+
+Database::Transaction Database::getTransactionMeta( const CryptoHelper::SHA3& hash,
+        Connection* connection ) const {
     Connection* conn{ db.get() };
     if ( nullptr != connection ) {
         conn = connection;
     }
-    Database::Statement query( *conn,
+    Database::CachedStatement query( *conn,
             "SELECT accessDomain, version, timestamp, userHash, hash, signature "
             " FROM 'Transaction' "
             " WHERE hash=? " );
-    query << hash;
+    query << toBlob( hash );
     if ( !query.executeStep() ) {
         LOG( WARNING ) << "Transaction does not exist.";
         throw Exception( Error::ErrorCode::NotFound );
@@ -301,11 +1069,6 @@ Database::Transaction Database::getTransactionMeta( const std::string& hash,
     return statementRowToTransaction( query );
 }
 
-Database::Transaction Database::getTransactionMeta( const CryptoHelper::SHA3& hash,
-        Connection* connection ) const {
-    return getTransactionMeta( hash.toString(), connection );
-}
-
 // TODO: Redo, should return vector<Meta> and should include all child-less transactions
 std::vector<Database::Transaction> Database::getTransactionLatest() const {
     std::vector<Database::Transaction> latest{};
@@ -320,7 +1083,7 @@ std::vector<Database::Transaction> Database::getTransactionLatest() const {
 }
 
 std::vector<Database::Transaction> Database::getTransactionList() const {
-    Database::Statement qAll( *db.get(),
+    Database::CachedStatement qAll( *db.get(),
             "SELECT accessDomain, version, timestamp, userHash, hash, signature "
             "FROM 'Transaction' "
             "ORDER BY version ASC ");
@@ -334,53 +1097,82 @@ std::vector<Database::Transaction> Database::getTransactionList() const {
 // TODO: redo, should return vector<Meta> with all transactions from the oldest transaction of the hashes
 std::vector<Database::Transaction> Database::getTransactionsFrom( const std::vector<std::string>& hashIds,
         Connection* connection ) const {
-    if ( 0 == hashIds.size() ) {
-        return std::vector<Database::Transaction>{};
-    }
+    std::vector<Database::Transaction> transactions{};
+    mapTransactionsFrom( [&transactions] ( const Database::Transaction& trans ) -> void {
+        transactions.push_back( trans );
+    }, hashIds, connection );
+    return transactions;
+}
 
-    Connection* conn{ db.get() };
-    if ( nullptr != connection ) {
-        conn = connection;
-    }
+bool Database::haveTransaction( const CryptoHelper::SHA3& hash ) const {
+    std::lock_guard<std::mutex> lock( graphMutex );
+    return graph.count( hash ) != 0;
+}
 
-    if ( !haveAll( hashIds, conn ) ) {
-        LOG( DBUG ) << "Not found";
-        throw Exception( Error::ErrorCode::NotFound );
+Database::Sketch Database::getTransactionSketch( std::size_t cells ) const {
+    Sketch sketch( cells );
+    std::lock_guard<std::mutex> lock( graphMutex );
+    for ( const auto& node : graph ) {
+        sketch.insert( node.first );
     }
+    return sketch;
+}
 
-    std::string getOldest {
-        "SELECT version, timestamp "
-        " FROM 'Transaction' "
-        " WHERE hash IN ( "
-    };
-
-    for ( const std::string id: hashIds ) {
-        getOldest += "'" + id +"',";
+std::vector<std::string> Database::getTransactionsMissingFrom( const Sketch& sketch ) const {
+    if ( sketch.size() > SKETCH_CELLS_MAX ) {
+        throw Exception( "Sketch is too large.", Error::ErrorCode::NotFound );
+    }
+    Sketch difference{ getTransactionSketch( sketch.size() ) };
+    difference.subtract( sketch );
+    std::vector<CryptoHelper::SHA3> here{}, there{};
+    if ( !difference.decode( here, there ) ) {
+        throw Exception( "Sketch is too small for the difference.", Error::ErrorCode::NotFound );
     }
-    getOldest.pop_back(); // Remove last comma
-    getOldest += ") "
-            "ORDER BY datetime( timestamp ) DESC ";
 
-    Database::Statement oldest( *conn, getOldest );
+    std::vector<std::pair<std::string, CryptoHelper::SHA3>> missing{};
+    {
+        std::lock_guard<std::mutex> lock( graphMutex );
+        for ( const CryptoHelper::SHA3& hash : here ) {
+            auto node = graph.find( hash );
+            if ( node != graph.end() ) {
+                missing.emplace_back( node->second.timestamp, hash );
+            }
+        }
+    }
+    std::sort( missing.begin(), missing.end() );
 
-    if ( !oldest.executeStep() ) {
-        LOG( WARNING ) << "Have transaction but could not fetch them.";
-        throw Mist::Exception( "Have transaction but could not fetch them.", Error::ErrorCode::UnexpectedDatabaseError );
+    std::vector<std::string> hashes{};
+    for ( const auto& transaction : missing ) {
+        hashes.push_back( transaction.second.toString() );
     }
+    return hashes;
+}
 
-    Database::Statement transactionsFromVersion( *conn,
-            "SELECT accessDomain, version, timestamp, userHash, hash, signature "
-            "FROM 'Transaction' "
-            "WHERE version >= ? "
-            "ORDER BY version ASC ");
-    transactionsFromVersion << oldest.getColumn( "version" ).getUInt();
+CryptoHelper::SHA3 Database::getHeadDigest() const {
+    CryptoHelper::SHA3Hasher hasher{};
+    std::lock_guard<std::mutex> lock( graphMutex );
+    // In hash order, which is the same everywhere
+    for ( const CryptoHelper::SHA3& hash : graphHeads ) {
+        hasher.update( hash.data(), hash.data() + hash.size() );
+    }
+    return hasher.finalize();
+}
 
-    std::vector<Database::Transaction> transactions{};
-    while ( transactionsFromVersion.executeStep() ) {
-        transactions.push_back( statementRowToTransaction( transactionsFromVersion ) );
+std::vector<CryptoHelper::SHA3> Database::getTransactionHeads() const {
+    std::vector<std::pair<std::string, CryptoHelper::SHA3>> heads{};
+    {
+        std::lock_guard<std::mutex> lock( graphMutex );
+        for ( const CryptoHelper::SHA3& hash : graphHeads ) {
+            heads.emplace_back( graph.at( hash ).timestamp, hash );
+        }
     }
+    std::sort( heads.begin(), heads.end() );
 
-    return transactions;
+    std::vector<CryptoHelper::SHA3> hashes{};
+    for ( const auto& head : heads ) {
+        hashes.push_back( head.second );
+    }
+    return hashes;
 }
 
 Database::Meta Database::transactionToMeta( const Database::Transaction& trans,
@@ -415,7 +1207,7 @@ void Database::mapTransactions( map_trans_f fn,
     if ( nullptr != connection ) {
         conn = connection;
     }
-    Database::Statement all( *conn,
+    Database::CachedStatement all( *conn,
             "SELECT accessDomain, version, timestamp, userHash, hash, signature "
             "FROM 'Transaction' "
             "ORDER BY version ASC ");
@@ -430,7 +1222,28 @@ void Database::mapTransactionLatest( map_trans_f fn,
     if ( nullptr != connection ) {
         conn = connection;
     }
-    Database::Statement openTransactions( *conn,
+
+    std::vector<Database::Transaction> heads{};
+    try {
+        for ( const CryptoHelper::SHA3& hash : getTransactionHeads() ) {
+            heads.push_back( getTransactionMeta( hash, conn ) );
+        }
+        std::sort( heads.begin(), heads.end(),
+                []( const Database::Transaction& l, const Database::Transaction& r ) -> bool {
+            return l.version < r.version;
+        } );
+    } catch ( const Exception& ) {
+        // The connection reads a snapshot from before a head was committed
+        heads.clear();
+    }
+    if ( !heads.empty() ) {
+        for ( const Database::Transaction& head : heads ) {
+            fn( head );
+        }
+        return;
+    }
+
+    Database::CachedStatement openTransactions( *conn,
             "SELECT t.accessDomain AS accessDomain, t.version AS version, timestamp, userHash, hash, signature "
             "FROM 'Transaction' AS t "
             "LEFT OUTER JOIN TransactionParent tp "
@@ -449,7 +1262,7 @@ void Database::mapParents( map_trans_f fn, const Database::Transaction& transact
     if ( nullptr != connection ) {
         conn = connection;
     }
-    Database::Statement parent( *conn,
+    Database::CachedStatement parent( *conn,
             "SELECT t.accessDomain AS accessDomain, t.version AS version, timestamp, userHash, hash, signature "
             "FROM TransactionParent AS tp, 'Transaction' AS t "
             "WHERE tp.version=? AND t.accessDomain=tp.parentAccessDomain AND t.version=tp.parentVersion "
@@ -476,32 +1289,27 @@ void Database::mapTransactionsFrom( map_trans_f fn, const std::vector<std::strin
         conn = connection;
     }
 
-    std::string getOldest {
-        "SELECT version, timestamp "
-        "FROM 'Transaction' "
-        "WHERE hash IN ( "
-    };
-
-    for ( const std::string id: ids ) {
-        getOldest += "'" + id +"',";
-    }
-    getOldest.pop_back(); // Remove last comma
-    getOldest += ") "
-            "ORDER BY datetime( timestamp ) DESC ";
-
-    Database::Statement oldest( *conn, getOldest );
-
-    if ( !oldest.executeStep() ) {
-        LOG( WARNING ) << "Have transaction but could not fetch them.";
-        throw Mist::Exception( "Have transaction but could not fetch them.", Error::ErrorCode::UnexpectedDatabaseError );
+    // Start from the most recent of the transactions
+    CryptoHelper::SHA3 newest{};
+    {
+        std::lock_guard<std::mutex> lock( graphMutex );
+        std::string newestTimestamp{};
+        for ( const std::string& id : ids ) {
+            CryptoHelper::SHA3 hash{ CryptoHelper::SHA3::fromString( id ) };
+            const std::string& timestamp = graph.at( hash ).timestamp;
+            if ( newestTimestamp < timestamp || ( newestTimestamp == timestamp && hash < newest ) ) {
+                newestTimestamp = timestamp;
+                newest = hash;
+            }
+        }
     }
 
-    Database::Statement transactionsFromVersion( *conn,
+    Database::CachedStatement transactionsFromVersion( *conn,
             "SELECT accessDomain, version, timestamp, userHash, hash, signature "
             "FROM 'Transaction' "
-            "WHERE version >= ? "
+            "WHERE version >= ( SELECT version FROM 'Transaction' WHERE hash=? ) "
             "ORDER BY version ASC ");
-    transactionsFromVersion << oldest.getColumn( "version" ).getUInt();
+    transactionsFromVersion << toBlob( newest );
 
     while ( transactionsFromVersion.executeStep() ) {
         fn( statementRowToTransaction( transactionsFromVersion ) );
@@ -514,21 +1322,22 @@ void Database::mapObject( map_obj_f fn, const Database::Transaction& transaction
     if ( nullptr != connection ) {
         conn = connection;
     }
-    Database::Statement object( *conn,
+    Database::CachedStatement object( *conn,
             "SELECT accessDomain, id, version, status, parent, parentAccessDomain, transactionAction "
             "FROM Object "
             "WHERE version=? "
             "ORDER BY id ASC " );
     object << transaction.version;
-    Database::Statement attribute( *conn,
+    Database::CachedStatement attribute( *conn,
             //"SELECT accessDomain, id, version, name, value, json "
             "SELECT accessDomain, id, version, name, type, value "
             "FROM Attribute "
-            "WHERE version=?"
-            "ORDER BY id ASC " );
+            "WHERE accessDomain=? AND id=? AND version=?" );
     while( object.executeStep() ) {
         std::map<std::string,Value> attributes{};
-        attribute << object.getColumn( "version" ).getInt64();
+        attribute << object.getColumn( "accessDomain" ).getInt()
+                << object.getColumn( "id" ).getInt64()
+                << object.getColumn( "version" ).getInt64();
         while ( attribute.executeStep() ) {
             attributes.emplace(
                     attribute.getColumn( "name" ).getString(),
@@ -547,20 +1356,21 @@ void Database::mapObjectId( map_obj_f fn, const long long id,
     if ( nullptr != connection ) {
         conn = connection;
     }
-    Database::Statement object( *conn,
+    Database::CachedStatement object( *conn,
             "SELECT accessDomain, id, version, status, parent, parentAccessDomain, transactionAction "
             "FROM Object "
             "WHERE id=? "
             "ORDER BY version ASC ");
     object << id;
-    Database::Statement attribute( *conn,
+    Database::CachedStatement attribute( *conn,
             "SELECT accessDomain, id, version, name, type, value "
             "FROM Attribute "
-            "WHERE version=?"
-            "ORDER BY id ASC " );
+            "WHERE accessDomain=? AND id=? AND version=?" );
     while( object.executeStep() ) {
         std::map<std::string,Value> attributes{};
-        attribute << object.getColumn( "version" ).getInt64();
+        attribute << object.getColumn( "accessDomain" ).getInt()
+                << object.getColumn( "id" ).getInt64()
+                << object.getColumn( "version" ).getInt64();
         while ( attribute.executeStep() ) {
             attributes.emplace(
                     attribute.getColumn( "name" ).getString(),
@@ -573,40 +1383,28 @@ void Database::mapObjectId( map_obj_f fn, const long long id,
     }
 }
 
-bool Database::haveAll( const std::vector<std::string>& transactionHashes ,
-            Connection* connection ) const {
+bool Database::haveAll( const std::vector<std::string>& transactionHashes ) const {
     if ( transactionHashes.empty() ) {
         LOG( DBUG ) << "Not found";
         throw Exception( "Can not find transactions for an empty array of hashes.", Mist::Error::ErrorCode::NotFound );
     }
-    Connection* conn{ db.get() };
-    if ( nullptr != connection ) {
-        conn = connection;
-    }
-
-    std::string haveAllQuery {
-        "SELECT hash "
-        "FROM 'Transaction' "
-        "WHERE hash IN ( "
-    };
-
-    for ( const std::string id: transactionHashes ) {
-        haveAllQuery += "'" + id +"',";
-    }
-    haveAllQuery.pop_back(); // Remove last comma
-    haveAllQuery += ") ";
 
-    unsigned count{};
-    Database::Statement countAll( *conn, haveAllQuery );
-    while( countAll.executeStep() ) {
-        ++count;
+    std::lock_guard<std::mutex> lock( graphMutex );
+    for ( const std::string& id : transactionHashes ) {
+        if ( 0 == graph.count( CryptoHelper::SHA3::fromString( id ) ) ) {
+            return false;
+        }
     }
-
-    return transactionHashes.size() == count;
+    return true;
 }
 
-std::shared_ptr<UserAccount> Database::getUser( const std::string& userHash ) const {
-    Database::Statement userId( *db.get(),
+std::shared_ptr<UserAccount> Database::getUser( const std::string& userHash,
+        Connection* connection ) const {
+    Connection* conn{ db.get() };
+    if ( nullptr != connection ) {
+        conn = connection;
+    }
+    Database::CachedStatement userId( *conn,
             "SELECT id "
             "FROM Attribute "
             "WHERE name='id' AND value=? AND version IN ( "
@@ -622,7 +1420,7 @@ std::shared_ptr<UserAccount> Database::getUser( const std::string& userHash ) co
     }
 
     // TODO: check object status to make sure that the user still is valid
-    Database::Statement user( *db.get(),
+    Database::CachedStatement user( *conn,
             "SELECT accessDomain, id, version, name, value "
             "FROM Attribute "
             "WHERE id=? "
@@ -659,7 +1457,7 @@ std::shared_ptr<UserAccount> Database::getUser( const std::string& userHash ) co
 // TODO: check that the account is still valid?
 void Database::mapUser( map_user_f fn, const std::string& userHash ) const {
     // TODO: do everything with a single query with some join magic to replace sql "pivot"
-    Database::Statement userId( *db.get(),
+    Database::CachedStatement userId( *db.get(),
             "SELECT version "
             "FROM Attribute "
             "WHERE name='id' AND value=? AND version IN ( "
@@ -674,7 +1472,7 @@ void Database::mapUser( map_user_f fn, const std::string& userHash ) const {
         return;
     }
 
-    Database::Statement user( *db.get(),
+    Database::CachedStatement user( *db.get(),
             "SELECT accessDomain, id, version, name, value "
             "FROM Attribute "
             "WHERE version=? ");
@@ -705,7 +1503,7 @@ void Database::mapUser( map_user_f fn, const std::string& userHash ) const {
 
 void Database::mapUsers( map_user_f fn ) const {
     // TODO: do everything with a single query with some join magic to replace sql "pivot"
-    Database::Statement userId( *db.get(),
+    Database::CachedStatement userId( *db.get(),
             "SELECT version "
             "FROM Attribute "
             "WHERE name='id' AND version IN ( "
@@ -716,7 +1514,7 @@ void Database::mapUsers( map_user_f fn ) const {
             "ORDER BY value ASC " );
     userId << USERS_OBJECT_ID;
 
-    Database::Statement user( *db.get(),
+    Database::CachedStatement user( *db.get(),
             "SELECT accessDomain, id, version, name, value "
             "FROM Attribute "
             "WHERE version=? ");
@@ -771,7 +1569,7 @@ void Database::mapUsersFrom( map_user_f fn, const std::vector<std::string>& user
     Database::Statement userId( *db.get(), queryUserIds );
     userId << USERS_OBJECT_ID;
 
-    Database::Statement user( *db.get(),
+    Database::CachedStatement user( *db.get(),
             "SELECT accessDomain, id, version, name, value "
             "FROM Attribute "
             "WHERE version=? ");
@@ -829,9 +1627,15 @@ void Database::inviteUser( const UserAccount& user ) {
 }
 
 Database::Object Database::getObject( int accessDomain, long long id, bool includeDeleted ) const {
+    std::lock_guard<std::recursive_mutex> lock( mux );
     return getObject( db.get(), accessDomain, id, includeDeleted );
 }
 
+Database::Object Database::readObject( int accessDomain, long long id, bool includeDeleted ) const {
+    ReadConnection connection{ getReadConnection() };
+    return getObject( connection.get(), accessDomain, id, includeDeleted );
+}
+
 Database::Object Database::getObject( Connection* connection, int accessDomain, long long id, bool includeDeleted ) const {
     if (  ROOT_OBJECT_ID == id) {
         // TODO: what should the root object look like?
@@ -849,14 +1653,13 @@ Database::Object Database::getObject( Connection* connection, int accessDomain,
         };
     }
 
-    Database::Statement object( *connection,
-            "SELECT accessDomain, id, MAX( version ) as version, status, parent, parentAccessDomain, transactionAction "
-            "FROM Object "
-            "WHERE accessDomain=? AND id=? "
-            "ORDER BY version DESC ");
+    Database::CachedStatement object( *connection,
+            "SELECT accessDomain, id, version, status, parent, parentAccessDomain, transactionAction "
+            "FROM ObjectHead "
+            "WHERE accessDomain=? AND id=? " );
     object << accessDomain << id;
 
-    Database::Statement attribute( *connection,
+    Database::CachedStatement attribute( *connection,
             "SELECT accessDomain, id, version, name, type, value "
             "FROM Attribute "
             "WHERE accessDomain=? AND id=? AND version=? "
@@ -886,6 +1689,7 @@ Database::Object Database::getObject( Connection* connection, int accessDomain,
 
 unsigned Database::subscribeObject( std::function<void(Object)> cb, int accessDomain,
         long long id, bool includeDeleted ) {
+    std::lock_guard<std::recursive_mutex> lock( mux );
     {
         LOG( DBUG ) << "Checking if object exists";
         getObject( accessDomain, id, includeDeleted ); // Test if the object exists, otherwise throw
@@ -911,6 +1715,7 @@ unsigned Database::subscribeObject( std::function<void(Object)> cb, int accessDo
 }
 
 void Database::unsubscribe( unsigned subId ) {
+    std::lock_guard<std::recursive_mutex> lock( mux );
     LOG( DBUG ) << "Unsubscribing";
     try {
         for( const long long& objId: subscriberObjects.at( subId ) ) {
@@ -924,31 +1729,164 @@ void Database::unsubscribe( unsigned subId ) {
         LOG( DBUG ) << "Tried to remove non-subscriber";
     }
     objectSubscriberCallback.erase( subId );
-    //querySubscriberCallback.erase( subId );
+    querySubscriberCallback.erase( subId );
     queryFunctionSubscriberCallback.erase( subId );
+    queryDeltaSubscriberCallback.erase( subId );
+    functionAggregates.erase( subId );
+
+    subscriberAttributes.erase( subId );
+    auto parent = subscriberParent.find( subId );
+    if ( parent != subscriberParent.end() ) {
+        parentSubscribers.at( parent->second ).erase( subId );
+        if ( parentSubscribers.at( parent->second ).empty() ) {
+            parentSubscribers.erase( parent->second );
+        }
+        subscriberParent.erase( parent );
+    }
+}
+
+void Database::registerQuerySubscriber( unsigned subscriber, const Query& querier,
+        int accessDomain, long long id, bool versionsQuery ) {
+    if ( versionsQuery ) {
+        // The object is listed as changed when it, or one of its children, changes
+        objectSubscribers[ id ].insert( subscriber );
+        subscriberObjects[ subscriber ].insert( id );
+    } else {
+        ObjectRef parent{ static_cast<AccessDomain>( accessDomain ), static_cast<unsigned long>( id ) };
+        parentSubscribers[ parent ].insert( subscriber );
+        subscriberParent[ subscriber ] = parent;
+
+        // Whole objects, or objects as of an older version, depend on everything
+        if ( querier.getMaxVersion() || ( !querier.isFunctionCall() && querier.getAll() ) ) {
+            return;
+        }
+        std::set<std::string> attributes{ querier.getFilterAttributes() };
+        for ( const std::string& name : querier.getAttributes() ) {
+            attributes.insert( name );
+        }
+        if ( !querier.getFunctionAttribute().empty() ) {
+            attributes.insert( querier.getFunctionAttribute() );
+        }
+        if ( !querier.getSortAttribute().empty() ) {
+            attributes.insert( querier.getSortAttribute() );
+        }
+        subscriberAttributes[ subscriber ] = attributes;
+    }
 }
 
 Database::QueryResult Database::query( int accessDomain, long long parentId, const std::string& select,
         const std::string& filter, const std::string& sort,
         const std::map<std::string, Value>& args,
-        int maxVersion, bool includeDeleted ) {
-    return query( db.get(), accessDomain, parentId, select, filter, sort, args, maxVersion, includeDeleted );
+        int maxVersion, bool includeDeleted, unsigned pageSize, const std::string& cursor ) {
+    return query( db.get(), accessDomain, parentId, select, filter, sort, args, maxVersion, includeDeleted,
+            pageSize, cursor );
 }
 
 Database::QueryResult Database::query( Connection* connection, int accessDomain, long long parentId, const std::string& select,
         const std::string& filter, const std::string& sort,
         const std::map<std::string, Value>& args,
-        int maxVersion, bool includeDeleted ) {
-    Mist::Query querier{};
-    querier.parseQuery( accessDomain, parentId, select, filter, sort, valueMapToArgumentMap( args ), maxVersion, includeDeleted );
+        int maxVersion, bool includeDeleted, unsigned pageSize, const std::string& cursor ) {
+    std::lock_guard<std::recursive_mutex> lock( mux );
+    Query& querier( compiledQuery( false, accessDomain, parentId, select, filter, sort,
+            valueMapToArgumentMap( args ), maxVersion, includeDeleted, pageSize, !cursor.empty() ) );
+    if ( querier.getPageSize() ) {
+        std::pair<ArgumentVT, unsigned long> last{ ArgumentVT( nullptr ), 0 };
+        if ( !cursor.empty() ) {
+            last = parseCursor( cursor, !querier.getSortAttribute().empty() );
+        }
+        querier.bindPage( pageSize, last.first, last.second );
+    }
     return query( querier, connection );
 }
 
+Database::QueryResult Database::readQuery( int accessDomain, long long parentId, const std::string& select,
+        const std::string& filter, const std::string& sort,
+        const std::map<std::string, Value>& args,
+        int maxVersion, bool includeDeleted, unsigned pageSize, const std::string& cursor ) {
+    // The query cache belongs to the thread using the main connection
+    Query querier{};
+    querier.parseQuery( accessDomain, parentId, select, filter, sort, valueMapToArgumentMap( args ),
+            maxVersion, includeDeleted, pageSize, !cursor.empty() );
+    if ( querier.getPageSize() ) {
+        std::pair<ArgumentVT, unsigned long> last{ ArgumentVT( nullptr ), 0 };
+        if ( !cursor.empty() ) {
+            last = parseCursor( cursor, !querier.getSortAttribute().empty() );
+        }
+        querier.bindPage( pageSize, last.first, last.second );
+    }
+    ReadConnection connection{ getReadConnection() };
+    return query( querier, connection.get() );
+}
+
+Query& Database::compiledQuery( bool versionsQuery, int accessDomain, long long parentId,
+        const std::string& select, const std::string& filter, const std::string& sort,
+        const std::map<std::string,ArgumentVT>& args, int maxVersion, bool includeDeleted,
+        unsigned pageSize, bool afterCursor ) {
+    // The generated SQL depends on the shape of the query and the types of
+    // the arguments, the access domain, parent and argument values are bound.
+    std::string key{ versionsQuery ? "v" : "q" };
+    key += '\x1f' + select + '\x1f' + filter + '\x1f' + sort + '\x1f'
+            + std::to_string( maxVersion ) + '\x1f' + ( includeDeleted ? "1" : "0" );
+    if ( pageSize ) {
+        key += afterCursor ? "\x1f" "pc" : "\x1f" "p";
+    }
+    for ( const auto& arg : args ) {
+        key += '\x1f' + arg.first + ':' + std::to_string( static_cast<int>( arg.second.type() ) );
+    }
+
+    auto it = queryCache.find( key );
+    if ( queryCache.end() != it ) {
+        it->second.first->bindArguments( accessDomain, parentId, args );
+        queryCacheOrder.splice( queryCacheOrder.begin(), queryCacheOrder, it->second.second );
+        return *it->second.first;
+    }
+
+    std::unique_ptr<Query> querier{ new Query() };
+    if ( versionsQuery ) {
+        querier->parseVersionQuery( accessDomain, parentId, select, filter, args, includeDeleted );
+    } else {
+        querier->parseQuery( accessDomain, parentId, select, filter, sort, args, maxVersion, includeDeleted,
+                pageSize, afterCursor );
+    }
+    if ( queryCache.size() >= QUERY_CACHE_SIZE ) {
+        queryCache.erase( queryCacheOrder.back() );
+        queryCacheOrder.pop_back();
+    }
+    queryCacheOrder.push_front( key );
+    it = queryCache.emplace( key, std::make_pair( std::move( querier ), queryCacheOrder.begin() ) ).first;
+    return *it->second.first;
+}
+
+void Database::bindQueryArguments( Database::Statement& statement, const Query& querier ) {
+    // Arguments the generated SQL ended up not referring to are skipped
+    const std::vector<ArgumentVT> args{ querier.getArgs() };
+    const int count{ std::min( static_cast<int>( args.size() ), statement.getBindParameterCount() ) };
+    for ( int i = 0; i < count; ++i ) {
+        const ArgumentVT& arg = args.at( i );
+        switch ( arg.type() ) {
+        case Type::Boolean:
+            statement.bind( i + 1, arg.boolValue() ? 1 : 0 );
+            break;
+        case Type::Number:
+            statement.bind( i + 1, arg.numberValue() );
+            break;
+        case Type::String:
+        case Type::JSON:
+            statement.bind( i + 1, arg.stringValue() );
+            break;
+        default:
+            statement.bind( i + 1 );
+            break;
+        }
+    }
+}
+
 
 Database::QueryResult Database::query( const Query& querier, Connection* connection ) {
-    Database::Statement dbQuery( *connection, querier.getSqlQuery() );
     QueryResult result{};
     if ( querier.isFunctionCall() ) {
+        Database::CachedStatement dbQuery( *connection, querier.getSqlQuery() );
+        bindQueryArguments( dbQuery, querier );
         try {
             if ( !dbQuery.executeStep() ) {
                 LOG( DBUG ) << "Query failed";
@@ -964,50 +1902,88 @@ Database::QueryResult Database::query( const Query& querier, Connection* connect
         result.functionAttribute = querier.getFunctionAttribute();
         result.functionValue = dbQuery.getColumn( "value" ).getDouble();
     } else {
-        if( dbQuery.executeStep() ) {
-            // TODO: fix queries so we get all info needed?
-            result.objects.push_back({
-                static_cast<AccessDomain>( dbQuery.getColumn( "_accessDomain" ).getInt() ),
-                static_cast<unsigned long>( dbQuery.getColumn( "_id" ).getUInt() ),
-                static_cast<unsigned>( dbQuery.getColumn( "_version" ).getUInt() ),
-                {
-                        static_cast<AccessDomain>( dbQuery.getColumn( "_parentAccessDomain" ).getUInt() ),
-                        static_cast<unsigned long>( dbQuery.getColumn( "_parent" ).getInt64() )
-                },
-                { { dbQuery.getColumn( "name" ).getString(), statementRowToValue( dbQuery ) } },
-                static_cast<ObjectStatus>( dbQuery.getColumn( "_status" ).getUInt() ),
-                static_cast<ObjectAction>( dbQuery.getColumn( "_transactionAction" ).getUInt() )
-            });
-        } else {
-	  //            LOG( DBUG ) << "No results";
-	  //            throw Exception( Error::ErrorCode::NotFound );
-	  return result;
-        }
-        while ( dbQuery.executeStep() ) {
-            Object& object{ *(result.objects.end() - 1) };
-            unsigned long id{ dbQuery.getColumn( "_id" ).getUInt() };
-            unsigned version{ dbQuery.getColumn( "_version" ).getUInt() };
-            std::string name{ dbQuery.getColumn( "name" ).getString() };
-            Value value{ statementRowToValue( dbQuery ) };
-            if ( id == object.id && version == object.version ) {
-                object.attributes.emplace( name, value );
+        mapQuery( [&result]( const Object& object ) -> void {
+            result.objects.push_back( object );
+        }, querier, connection );
+        // A page is read with one extra object when there are more
+        if ( querier.getPageSize() && result.objects.size() > querier.getPageSize() ) {
+            result.objects.resize( querier.getPageSize() );
+            const Object& last{ result.objects.back() };
+            if ( querier.getSortAttribute().empty() ) {
+                result.cursor = makeCursor( last.id );
             } else {
-                result.objects.push_back({
-                    static_cast<AccessDomain>( dbQuery.getColumn( "_accessDomain" ).getInt() ),
-                    id,
-                    version,
-                    {
-                            static_cast<AccessDomain>( dbQuery.getColumn( "_parentAccessDomain" ).getUInt() ),
-                            static_cast<unsigned long>( dbQuery.getColumn( "_parent" ).getInt64() )
-                    },
-                    { { name, value } },
-                    static_cast<ObjectStatus>( dbQuery.getColumn( "_status" ).getUInt() ),
-                    static_cast<ObjectAction>( dbQuery.getColumn( "_transactionAction" ).getUInt() )
-                });
+                // The sort value is read here since it need not be selected
+                Database::CachedStatement sortValue( *connection,
+                        "SELECT type, value FROM Attribute WHERE accessDomain=? AND id=? AND version=? AND name=?" );
+                sortValue << static_cast<int>( last.accessDomain ) << static_cast<long long>( last.id )
+                        << last.version << querier.getSortAttribute();
+                result.cursor = makeCursor( last.id,
+                        sortValue.executeStep() ? statementRowToValue( sortValue ) : Value( nullptr ) );
             }
         }
     }
-    return result;
+    return result;
+}
+
+void Database::mapQuery( std::function<void(const Object&)> fn,
+        int accessDomain, long long parentId, const std::string& select,
+        const std::string& filter, const std::string& sort,
+        const std::map<std::string, Value>& args,
+        int maxVersion, bool includeDeleted ) {
+    mapQuery( fn, db.get(), accessDomain, parentId, select, filter, sort, args, maxVersion, includeDeleted );
+}
+
+void Database::mapQuery( std::function<void(const Object&)> fn, Connection* connection,
+        int accessDomain, long long parentId, const std::string& select,
+        const std::string& filter, const std::string& sort,
+        const std::map<std::string, Value>& args,
+        int maxVersion, bool includeDeleted ) {
+    std::lock_guard<std::recursive_mutex> lock( mux );
+    mapQuery( fn, compiledQuery( false, accessDomain, parentId, select, filter, sort,
+            valueMapToArgumentMap( args ), maxVersion, includeDeleted ), connection );
+}
+
+void Database::mapQuery( std::function<void(const Object&)> fn, const Query& querier,
+        Connection* connection ) {
+    if ( querier.isFunctionCall() ) {
+        throw std::runtime_error( "Cannot map the objects of a function" );
+    }
+    // The query is not used after binding, fn may run queries that replace it in the cache
+    Database::CachedStatement dbQuery( *connection, querier.getSqlQuery() );
+    bindQueryArguments( dbQuery, querier );
+
+    // The rows of an object are next to each other, it is complete when the next object starts
+    Object object{};
+    bool haveObject{ false };
+    while ( dbQuery.executeStep() ) {
+        unsigned long id{ dbQuery.getColumn( "_id" ).getUInt() };
+        unsigned version{ dbQuery.getColumn( "_version" ).getUInt() };
+        std::string name{ dbQuery.getColumn( "name" ).getString() };
+        Value value{ statementRowToValue( dbQuery ) };
+        if ( haveObject && id == object.id && version == object.version ) {
+            object.attributes.emplace( name, value );
+            continue;
+        }
+        if ( haveObject ) {
+            fn( object );
+        }
+        object = {
+            static_cast<AccessDomain>( dbQuery.getColumn( "_accessDomain" ).getInt() ),
+            id,
+            version,
+            {
+                    static_cast<AccessDomain>( dbQuery.getColumn( "_parentAccessDomain" ).getUInt() ),
+                    static_cast<unsigned long>( dbQuery.getColumn( "_parent" ).getInt64() )
+            },
+            { { name, value } },
+            static_cast<ObjectStatus>( dbQuery.getColumn( "_status" ).getUInt() ),
+            static_cast<ObjectAction>( dbQuery.getColumn( "_transactionAction" ).getUInt() )
+        };
+        haveObject = true;
+    }
+    if ( haveObject ) {
+        fn( object );
+    }
 }
 
 unsigned Database::subscribeQuery( std::function<void(QueryResult)> cb,
@@ -1015,39 +1991,147 @@ unsigned Database::subscribeQuery( std::function<void(QueryResult)> cb,
             const std::string& filter, const std::string& sort,
             const std::map<std::string, Value>& args,
             int maxVersion, bool includeDeleted ) {
+    std::lock_guard<std::recursive_mutex> lock( mux );
     ++subId;
     QueryResult qr{ query( accessDomain, parentId, select, filter, sort, args, maxVersion, includeDeleted ) };
+    std::unique_ptr<Query> querier{ new Query() };
+    querier->parseQuery(
+            accessDomain, parentId, select, filter, sort, valueMapToArgumentMap( args ), maxVersion, includeDeleted
+    );
+    registerQuerySubscriber( subId, *querier, accessDomain, parentId, false );
     if( qr.isFunctionCall ) {
-        queryFunctionSubscriberCallback[ subId ] = std::make_tuple( std::unique_ptr<Query>( new Query() ), qr.functionValue, cb );
-        std::get<0>( queryFunctionSubscriberCallback.at( subId ) )->parseQuery(
-                    accessDomain, parentId, select, filter, sort, valueMapToArgumentMap( args ), maxVersion, includeDeleted
-                );
+        if ( !querier->getValuesSqlQuery().empty() ) {
+            loadAggregate( *querier, functionAggregates[ subId ] );
+        }
+        queryFunctionSubscriberCallback[ subId ] = std::make_tuple( std::move( querier ), qr.functionValue, cb );
     } else {
-        for( const auto& object : qr.objects ) {
-            try {
-                objectSubscribers.at( object.id ).insert( subId );
-            } catch ( const std::out_of_range& ) {
-                objectSubscribers[ object.id ] = {};
-                objectSubscribers.at( object.id ).insert( subId );
-            }
-            try {
-                subscriberObjects.at( subId ).insert( object.id );
-            } catch ( const std::out_of_range& ) {
-                // No objects for this subscriber yet.
-                subscriberObjects[ subId ] = {};
-                subscriberObjects.at( subId ).insert( object.id );
+        querySubscriberCallback[ subId ] = std::make_pair( std::move( querier ), cb );
+    }
+
+    return subId;
+}
+
+unsigned Database::subscribeQueryDelta( std::function<void(QueryDelta)> cb,
+            int accessDomain, long long parentId, const std::string& select,
+            const std::string& filter, const std::string& sort,
+            const std::map<std::string, Value>& args,
+            int maxVersion, bool includeDeleted ) {
+    std::lock_guard<std::recursive_mutex> lock( mux );
+    std::unique_ptr<Query> querier{ new Query() };
+    querier->parseQuery(
+            accessDomain, parentId, select, filter, sort, valueMapToArgumentMap( args ), maxVersion, includeDeleted
+    );
+    if ( querier->isFunctionCall() ) {
+        throw std::runtime_error( "Cannot subscribe to the changes of a function" );
+    }
+    ++subId;
+    unsigned subscriber{ subId };
+    std::map<ObjectRef,unsigned,lessObjectRef> delivered{};
+    QueryDelta delta{ diffObjects( query( *querier, db.get() ).objects, delivered ) };
+    registerQuerySubscriber( subscriber, *querier, accessDomain, parentId, false );
+    queryDeltaSubscriberCallback[ subscriber ] = std::make_tuple( std::move( querier ), std::move( delivered ), cb );
+    cb( delta );
+
+    return subscriber;
+}
+
+void Database::loadAggregate( const Query& querier, FunctionAggregate& aggregate ) {
+    aggregate = FunctionAggregate{};
+    Statement values( *db.get(), querier.getValuesSqlQuery() );
+    bindQueryArguments( values, querier );
+    while ( values.executeStep() ) {
+        double value{ values.getColumn( "value" ).getDouble() };
+        if ( aggregate.values.empty() ) {
+            aggregate.min = aggregate.max = value;
+        }
+        aggregate.values[ static_cast<unsigned long>( values.getColumn( "id" ).getInt64() ) ] = value;
+        aggregate.sum += value;
+        aggregate.min = std::min( aggregate.min, value );
+        aggregate.max = std::max( aggregate.max, value );
+    }
+}
+
+void Database::updateAggregate( const Query& querier, FunctionAggregate& aggregate,
+        const std::set<unsigned long>& objects ) {
+    CachedStatement objectValue( *db.get(), querier.getObjectValueSqlQuery() );
+    const int idIndex{ static_cast<int>( querier.getArgs().size() ) + 1 };
+    bool extremeRemoved{ false };
+    for ( const unsigned long id : objects ) {
+        auto previous = aggregate.values.find( id );
+        if ( previous != aggregate.values.end() ) {
+            aggregate.sum -= previous->second;
+            extremeRemoved = extremeRemoved
+                    || previous->second <= aggregate.min || previous->second >= aggregate.max;
+            aggregate.values.erase( previous );
+        }
+
+        bindQueryArguments( objectValue, querier );
+        objectValue.bind( idIndex, static_cast<long long>( id ) );
+        if ( objectValue.executeStep() ) {
+            double value{ objectValue.getColumn( "value" ).getDouble() };
+            if ( aggregate.values.empty() ) {
+                aggregate.min = aggregate.max = value;
             }
+            aggregate.values[ id ] = value;
+            aggregate.sum += value;
+            aggregate.min = std::min( aggregate.min, value );
+            aggregate.max = std::max( aggregate.max, value );
         }
-        querySubscriberCallback[ subId ] = std::make_pair( std::unique_ptr<Query>(), cb );
-        querySubscriberCallback.at( subId ).first.reset( new Query() );
-        querySubscriberCallback.at( subId ).first->parseQuery(
-                accessDomain, parentId, select, filter, sort, valueMapToArgumentMap( args ), maxVersion, includeDeleted
-        );
+        objectValue.reset();
     }
 
-    return subId;
+    // The next smallest or largest value is only known from all values
+    const std::string functionName{ querier.getFunctionName() };
+    if ( extremeRemoved && !aggregate.values.empty()
+            && ( "min" == functionName || "max" == functionName ) ) {
+        aggregate.min = aggregate.max = aggregate.values.begin()->second;
+        for ( const auto& kv : aggregate.values ) {
+            aggregate.min = std::min( aggregate.min, kv.second );
+            aggregate.max = std::max( aggregate.max, kv.second );
+        }
+    }
 }
 
+double Database::aggregateValue( const std::string& functionName,
+        const FunctionAggregate& aggregate ) {
+    // As SQLite, except that NULL for no values is read as 0
+    if ( "count" == functionName ) {
+        return static_cast<double>( aggregate.values.size() );
+    } else if ( aggregate.values.empty() ) {
+        return 0;
+    } else if ( "sum" == functionName ) {
+        return aggregate.sum;
+    } else if ( "avg" == functionName ) {
+        return aggregate.sum / aggregate.values.size();
+    } else if ( "min" == functionName ) {
+        return aggregate.min;
+    } else {
+        return aggregate.max;
+    }
+}
+
+Database::QueryDelta Database::diffObjects( const std::vector<Object>& objects,
+        std::map<ObjectRef,unsigned,lessObjectRef>& delivered ) {
+    QueryDelta delta{};
+    std::map<ObjectRef,unsigned,lessObjectRef> current{};
+    for ( const Object& object : objects ) {
+        ObjectRef ref{ object.accessDomain, object.id };
+        current[ ref ] = object.version;
+        auto previous = delivered.find( ref );
+        if ( previous == delivered.end() ) {
+            delta.added.push_back( object );
+        } else if ( previous->second != object.version ) {
+            delta.changed.push_back( object );
+        }
+    }
+    for ( const auto& kv : delivered ) {
+        if ( 0 == current.count( kv.first ) ) {
+            delta.removed.push_back( kv.first );
+        }
+    }
+    delivered.swap( current );
+    return delta;
+}
 
 Database::QueryResult Database::queryVersion( int accessDomain, long long parentId, const std::string& select,
         const std::string& filter, const std::map<std::string, Value>& args, bool includeDeleted ) {
@@ -1056,13 +2140,14 @@ Database::QueryResult Database::queryVersion( int accessDomain, long long parent
 
 Database::QueryResult Database::queryVersion( Connection* connection, int accessDomain, long long parentId, const std::string& select,
         const std::string& filter, const std::map<std::string, Value>& args, bool includeDeleted ) {
-    Query querier{};
-    querier.parseVersionQuery( accessDomain, parentId, select, filter, valueMapToArgumentMap( args ), includeDeleted );
-    return queryVersion( querier, connection );
+    std::lock_guard<std::recursive_mutex> lock( mux );
+    return queryVersion( compiledQuery( true, accessDomain, parentId, select, filter, "",
+            valueMapToArgumentMap( args ), 0, includeDeleted ), connection );
 }
 
 Database::QueryResult Database::queryVersion( const Query& querier, Connection* connection ) {
-    Database::Statement dbQuery( *connection, querier.getSqlQuery() );
+    Database::CachedStatement dbQuery( *connection, querier.getSqlQuery() );
+    bindQueryArguments( dbQuery, querier );
     QueryResult result{};
     if ( querier.isFunctionCall() ) {
         try {
@@ -1129,34 +2214,18 @@ unsigned Database::subscribeQueryVersion( std::function<void(QueryResult)> cb,
         int accessDomain, long long parentId, const std::string& select,
         const std::string& filter, const std::map<std::string, Value>& args,
         bool includeDeleted ) {
+    std::lock_guard<std::recursive_mutex> lock( mux );
     ++subId;
     QueryResult qr{ queryVersion( accessDomain, parentId, select, filter, args, includeDeleted ) };
+    std::unique_ptr<Query> querier{ new Query() };
+    querier->parseVersionQuery(
+            accessDomain, parentId, select, filter, valueMapToArgumentMap( args ), includeDeleted
+    );
+    registerQuerySubscriber( subId, *querier, accessDomain, parentId, true );
     if( qr.isFunctionCall ) {
-        queryFunctionSubscriberCallback[ subId ] = std::make_tuple( std::unique_ptr<Query>( new Query() ), qr.functionValue, cb );
-        std::get<0>( queryFunctionSubscriberCallback.at( subId ) )->parseVersionQuery(
-                    accessDomain, parentId, select, filter, valueMapToArgumentMap( args ), includeDeleted
-                );
+        queryFunctionSubscriberCallback[ subId ] = std::make_tuple( std::move( querier ), qr.functionValue, cb );
     } else {
-        for( const auto& object : qr.objects ) {
-            try {
-                objectSubscribers.at( object.id ).insert( subId );
-            } catch ( const std::out_of_range& ) {
-                objectSubscribers[ object.id ] = {};
-                objectSubscribers.at( object.id ).insert( subId );
-            }
-            try {
-                subscriberObjects.at( subId ).insert( object.id );
-            } catch ( const std::out_of_range& ) {
-                // No objects for this subscriber yet.
-                subscriberObjects[ subId ] = {};
-                subscriberObjects.at( subId ).insert( object.id );
-            }
-        }
-        querySubscriberCallback[ subId ] = std::make_pair( std::unique_ptr<Query>(), cb );
-        querySubscriberCallback.at( subId ).first.reset( new Query() );
-        querySubscriberCallback.at( subId ).first->parseVersionQuery(
-                accessDomain, parentId, select, filter, valueMapToArgumentMap( args ), includeDeleted
-        );
+        querySubscriberCallback[ subId ] = std::make_pair( std::move( querier ), cb );
     }
 
     return subId;
@@ -1168,22 +2237,28 @@ std::unique_ptr<Mist::RemoteTransaction> Database::beginRemoteTransaction(
         Helper::Date timestamp,
         CryptoHelper::SHA3 userHash,
         CryptoHelper::SHA3 hash,
-        CryptoHelper::Signature signature ) {
+        CryptoHelper::Signature signature,
+        Connection* batchConnection ) {
     LOG ( DBUG ) << "Begin remote transaction";
+    RemoteWrite write( this );
     if(!_isOK) {
         LOG ( WARNING ) << "Invalid database state: Can not begin remote transaction";
         throw std::runtime_error( "Can not begin remote transaction, database error state." );
     }
+    Connection* conn{ db.get() };
+    if ( nullptr != batchConnection ) {
+        conn = batchConnection;
+    }
 
     // Check if transaction already exists
-    Database::Statement hasTransaction( *db.get(),
+    Database::CachedStatement hasTransaction( *conn,
             "SELECT EXISTS( "
                 "SELECT * "
                 "FROM 'Transaction' "
                 "WHERE hash=? "
                 "LIMIT 1 "
             ") AS existing " );
-    hasTransaction << hash.toString();
+    hasTransaction << toBlob( hash );
     if ( !hasTransaction.executeStep() ) {
         LOG( WARNING ) << "Unexpected database error, could not query 'EXISTS' from 'Transaction' where hash=? ";
         throw Exception( Error::ErrorCode::UnexpectedDatabaseError );
@@ -1194,34 +2269,17 @@ std::unique_ptr<Mist::RemoteTransaction> Database::beginRemoteTransaction(
         throw Exception( Error::ErrorCode::AlreadyInUse );
     }
 
-    // Check permission
-    if( !this->verifier ) {
-        LOG( WARNING ) << "No verifier is set, can not accept any remote transactions.";
-        throw( Mist::Exception( Mist::Error::ErrorCode::AccessDenied ) );
-    }
-
-    if( manifest && manifest->getCreator().hash() == userHash ) {
-        if ( !verifier( manifest->getCreator(), hash, signature ) ) {
-            LOG( WARNING ) << "Transaction signature validation failed.";
-            throw Mist::Exception( Mist::Error::ErrorCode::InvalidTransaction );
-        }
-    } else {
-        std::shared_ptr<UserAccount> userAccount{ getUser( userHash.toString() ) };
-
-        if ( !userAccount || userAccount->getPermission() == Permission::P::read ) {
-            LOG ( WARNING ) << "Invalid user or user permission";
-            throw Mist::Exception( Mist::Error::ErrorCode::AccessDenied );
-        }
-
-        if ( !verifier( userAccount->getPublicKey(), hash, signature ) ) {
-            LOG( WARNING ) << "Transaction signature validation failed.";
-            throw Mist::Exception( Mist::Error::ErrorCode::InvalidTransaction );
-        }
+    // Check permission, the signature of a batch is verified with the rest of the batch
+    CryptoHelper::PublicKey signer{ transactionSigner( userHash, conn ) };
+    if ( !batchConnection && !verifier( signer, hash, signature ) ) {
+        LOG( WARNING ) << "Transaction signature validation failed.";
+        throw Mist::Exception( Mist::Error::ErrorCode::InvalidTransaction );
     }
 
     // Create local version number.
-    Database::Statement query(*db.get(), "SELECT IFNULL(MAX(version),0)+1 AS newVersion "
+    Database::CachedStatement query(*conn, "SELECT IFNULL(MAX(version),0)+? AS newVersion "
             "FROM 'Transaction'");
+    query << VERSION_STRIDE;
     if ( !query.executeStep() ) {
         _isOK = false;
         LOG ( WARNING ) << "Invalid database state: Can not begin remote transaction";
@@ -1237,11 +2295,30 @@ std::unique_ptr<Mist::RemoteTransaction> Database::beginRemoteTransaction(
             timestamp,
             userHash,
             hash,
-            signature
+            signature,
+            batchConnection
         )
     );
 }
 
+CryptoHelper::PublicKey Database::transactionSigner( const CryptoHelper::SHA3& userHash,
+        Connection* connection ) const {
+    if( !this->verifier ) {
+        LOG( WARNING ) << "No verifier is set, can not accept any remote transactions.";
+        throw( Mist::Exception( Mist::Error::ErrorCode::AccessDenied ) );
+    }
+
+    if( manifest && manifest->getCreator().hash() == userHash ) {
+        return manifest->getCreator();
+    }
+    std::shared_ptr<UserAccount> userAccount{ getUser( userHash.toString(), connection ) };
+    if ( !userAccount || userAccount->getPermission() == Permission::P::read ) {
+        LOG ( WARNING ) << "Invalid user or user permission";
+        throw Mist::Exception( Mist::Error::ErrorCode::AccessDenied );
+    }
+    return userAccount->getPublicKey();
+}
+
 std::unique_ptr<Mist::Transaction> Database::beginTransaction( AccessDomain accessDomain ) {
     unsigned newVersion;
 
@@ -1251,8 +2328,27 @@ std::unique_ptr<Mist::Transaction> Database::beginTransaction( AccessDomain acce
         LOG ( WARNING ) << "Invalid database state: Can not begin transaction";
         throw std::runtime_error( "Invalid database state: Can not begin transaction" );
     }
+    std::unique_lock<std::recursive_mutex> lock( mux );
+    Connection* conn{ db.get() };
+    if ( groupCommitSize ) {
+        // A remote write holds the write lock until it ends
+        if ( !remoteWriteThreads.count( std::this_thread::get_id() ) ) {
+            groupCondition.wait( lock, [this]() -> bool { return remoteWriteThreads.empty(); } );
+        }
+        if ( groupMemberOpen ) {
+            throw std::runtime_error( "A transaction of the group commit is already open" );
+        }
+        if ( !groupConnection ) {
+            groupConnection = getIsolatedDbConnection();
+        }
+        if ( !groupTransaction ) {
+            groupTransaction.reset( new Helper::Database::Transaction( *groupConnection ) );
+        }
+        // The transactions of the group are not visible on the main connection yet
+        conn = groupConnection.get();
+    }
     //Helper::Database::Transaction newVersion( *db );
-    Database::Statement getVersion(*db.get(), "SELECT MAX(version) AS version, timestamp, STRFTIME('%Y-%m-%d %H:%M:%f','now') AS now "
+    Database::CachedStatement getVersion(*conn, "SELECT MAX(version) AS version, timestamp, STRFTIME('%Y-%m-%d %H:%M:%f','now') AS now "
             "FROM 'Transaction'");
     if ( !getVersion.executeStep() ) {
         _isOK = false;
@@ -1260,27 +2356,31 @@ std::unique_ptr<Mist::Transaction> Database::beginTransaction( AccessDomain acce
         throw std::runtime_error( "Invalid database state: Can not begin transaction" );
     }
     if ( getVersion.getColumn( "version" ).isNull()) {
-        newVersion = 1;
+        newVersion = VERSION_STRIDE;
     } else if (getVersion.getColumn( "timestamp" ).getString() == getVersion.getColumn( "now" ).getString()) {
-      newVersion = getVersion.getColumn( "version" ).getUInt() + 1;
+      newVersion = getVersion.getColumn( "version" ).getUInt() + VERSION_STRIDE;
 //      usleep( 1 );
     std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
     } else if (getVersion.getColumn( "timestamp" ).getString() > getVersion.getColumn( "now" ).getString()) {
         LOG ( WARNING ) << "Last transaction is from the future. Cannot begin a new transaction";
         throw std::runtime_error( "Last transaction is from the future. Cannot begin a new transaction" );
     } else {
-      newVersion = getVersion.getColumn( "version" ).getUInt() + 1;
+      newVersion = getVersion.getColumn( "version" ).getUInt() + VERSION_STRIDE;
     }
 
     //Transaction* transaction{ new Transaction( this, accessDomain, query.getColumn("newVersion").getUInt() ) };
     //newVersion.commit();
-    return std::unique_ptr<Mist::Transaction>(
+    std::unique_ptr<Mist::Transaction> transaction(
         new Mist::Transaction(
             this,
             accessDomain,
-            newVersion
+            newVersion,
+            groupCommitSize ? groupConnection.get() : nullptr
         )
     );
+    groupMemberOpen = groupCommitSize > 0;
+    groupMemberThread = std::this_thread::get_id();
+    return transaction;
 }
 
 std::unique_ptr<Database::Connection> Database::getIsolatedDbConnection() const {
@@ -1295,6 +2395,74 @@ std::unique_ptr<Database::Connection> Database::getIsolatedDbConnection() const
     }
 }
 
+Database::RemoteWrite::RemoteWrite( Database* database ) : database( database ) {
+    std::unique_lock<std::recursive_mutex> lock( database->mux );
+    std::thread::id thread{ std::this_thread::get_id() };
+    if ( database->groupMemberOpen
+            && ( thread == database->groupMemberThread || thread == database->writerThread ) ) {
+        // Waiting here would keep the transaction from ending
+        throw std::runtime_error( "A transaction of the group commit is open" );
+    }
+    database->groupCondition.wait( lock, [database]() -> bool { return !database->groupMemberOpen; } );
+    database->flushGroupCommit();
+    database->remoteWriteThreads.insert( thread );
+}
+
+Database::RemoteWrite::~RemoteWrite() {
+    std::lock_guard<std::recursive_mutex> lock( database->mux );
+    database->remoteWriteThreads.erase(
+            database->remoteWriteThreads.find( std::this_thread::get_id() ) );
+    database->groupCondition.notify_all();
+}
+
+Database::ReadConnection::ReadConnection( const Database* database,
+        std::unique_ptr<Connection> connection ) :
+        database( database ), connection( std::move( connection ) ) {
+}
+
+Database::ReadConnection::~ReadConnection() {
+    if ( !connection ) {
+        return;
+    }
+    try {
+        // Ends the read transaction and lets go of its snapshot
+        connection->exec( "COMMIT" );
+    } catch ( SQLite::Exception& e ) {
+        LOG ( WARNING ) << "Database error: " << e.what();
+        return;
+    }
+    database->releaseReadConnection( std::move( connection ) );
+}
+
+Database::ReadConnection Database::getReadConnection() const {
+    std::unique_ptr<Connection> connection{};
+    {
+        std::lock_guard<std::mutex> lock( readConnectionsMutex );
+        if ( !readConnections.empty() ) {
+            connection = std::move( readConnections.back() );
+            readConnections.pop_back();
+        }
+    }
+    try {
+        if ( !connection ) {
+            connection.reset( new Connection( path, Helper::Database::OPEN_READONLY ) );
+        }
+        // The snapshot is taken by the first read
+        connection->exec( "BEGIN" );
+    } catch ( SQLite::Exception& e ) {
+        LOG ( WARNING ) << "Database error: " << e.what();
+        throw;
+    }
+    return ReadConnection( this, std::move( connection ) );
+}
+
+void Database::releaseReadConnection( std::unique_ptr<Connection> connection ) const {
+    std::lock_guard<std::mutex> lock( readConnectionsMutex );
+    if ( readConnections.size() < READ_CONNECTION_POOL_SIZE ) {
+        readConnections.push_back( std::move( connection ) );
+    }
+}
+
 CryptoHelper::SHA3 Database::calculateTransactionHash(
         const Database::Transaction& transaction,
         Connection* connection ) const {
@@ -1336,6 +2504,34 @@ unsigned Database::reorderTransaction( const Database::Transaction& tranasaction
         conn = connection;
     }
 
+    // Versions are handed out VERSION_STRIDE apart, so a transaction that
+    // belongs between two existing transactions can usually be given a
+    // version in the gap between them without touching any other row.
+    // The transaction has already been inserted last, find the first
+    // transaction that should come after it ordered by (timestamp, hash).
+    CachedStatement newerTransaction( *conn,
+            "SELECT version, timestamp, hash "
+            "FROM 'Transaction' "
+            "WHERE timestamp >= ? AND version <> ? "
+            "ORDER BY timestamp ASC, version ASC ");
+    newerTransaction << tranasaction.date.toString() << tranasaction.version;
+
+    unsigned nextVersion{ 0 };
+    std::string nextTimestamp;
+    while( newerTransaction.executeStep() ) {
+        nextTimestamp = newerTransaction.getColumn( "timestamp" ).getString();
+        if ( tranasaction.date.toString() < nextTimestamp
+                || tranasaction.hash < columnToHash( newerTransaction.getColumn( "hash" ) ) ) {
+            nextVersion = newerTransaction.getColumn( "version" ).getUInt();
+            break;
+        }
+    }
+
+    // There are no newer transactions, the transaction is in the correct place
+    if ( 0 == nextVersion ) {
+        return tranasaction.version;
+    }
+
     std::unique_ptr<Helper::Database::SavePoint> savePoint;
     try {
         savePoint.reset( new Helper::Database::SavePoint( conn, "reorder" ) );
@@ -1344,99 +2540,117 @@ unsigned Database::reorderTransaction( const Database::Transaction& tranasaction
         throw std::runtime_error("SavePoint constructor failed");
     }
 
-    Statement newerTransaction( *conn,
-            "SELECT version, timestamp "
-            "FROM 'Transaction' "
-            "WHERE timestamp >= ? "
-            "ORDER BY version DESC ");
-
-    Statement sameTimeTransaction( *conn,
-            "SELECT version, hash "
-            "FROM 'Transaction' "
-            "WHERE timestamp >= ? "
-            "ORDER BY version ASC ");
-
-    std::vector<std::unique_ptr<Statement>> versionUp;
-    versionUp.emplace_back( new Statement( *conn, "UPDATE Attribute SET version=version+1 WHERE version=? " ) );
-    versionUp.emplace_back( new Statement( *conn, "UPDATE Object SET version=version+1 WHERE version=? " ) );
-    versionUp.emplace_back( new Statement( *conn, "UPDATE 'Transaction' SET version=version+1 WHERE version=? " ) );
-    versionUp.emplace_back( new Statement( *conn, "UPDATE TransactionParent SET parentVersion=parentVersion+1 WHERE parentVersion=? " ) );
-    versionUp.emplace_back( new Statement( *conn, "UPDATE TransactionParent SET version=version+1 WHERE version=? " ) );
-    // TODO: Up version in "Renumber" table
-    // TODO: Up version in "AccessDomain" table
-    std::vector<std::unique_ptr<Statement>> versionDown;
-    versionDown.emplace_back( new Statement( *conn, "UPDATE Attribute SET version=version-1 WHERE version=? " ) );
-    versionDown.emplace_back( new Statement( *conn, "UPDATE Object SET version=version-1 WHERE version=? " ) );
-    versionDown.emplace_back( new Statement( *conn, "UPDATE 'Transaction' SET version=version-1 WHERE version=? " ) );
-    versionDown.emplace_back( new Statement( *conn, "UPDATE TransactionParent SET parentVersion=parentVersion-1 WHERE parentVersion=? " ) );
-    versionDown.emplace_back( new Statement( *conn, "UPDATE TransactionParent SET version=version-1 WHERE version=? " ) );
-    // TODO: Down version in "Renumber" table
-    // TODO: Down version in "AccessDomain" table
     std::vector<std::unique_ptr<Statement>> versionSet;
     versionSet.emplace_back( new Statement( *conn, "UPDATE Attribute SET version=? WHERE version=? " ) );
     versionSet.emplace_back( new Statement( *conn, "UPDATE Object SET version=? WHERE version=? " ) );
     versionSet.emplace_back( new Statement( *conn, "UPDATE 'Transaction' SET version=? WHERE version=? " ) );
     versionSet.emplace_back( new Statement( *conn, "UPDATE TransactionParent SET parentVersion=? WHERE parentVersion=? " ) );
     versionSet.emplace_back( new Statement( *conn, "UPDATE TransactionParent SET version=? WHERE version=? " ) );
-    // TODO: Set version in "Renumber" table
+    versionSet.emplace_back( new Statement( *conn, "UPDATE Renumber SET version=? WHERE version=? " ) );
+    versionSet.emplace_back( new Statement( *conn, "UPDATE ObjectHead SET version=? WHERE version=? " ) );
     // TODO: Set version in "AccessDomain" table
-
-    newerTransaction << tranasaction.date.toString();
-    unsigned version{ 0 };
-
-    // Add one to version for all newer transactions, including the current one
-    // to create a gap that we can move this transaction to.
-    // Starting with the highest version
-    while( newerTransaction.executeStep() ) {
-        version = newerTransaction.getColumn( "version" ).getUInt();
-        for( std::unique_ptr<Statement>& s : versionUp ) {
-            *s << version;
+    auto setVersion = [&versionSet]( unsigned version, unsigned oldVersion ) {
+        for( std::unique_ptr<Statement>& s : versionSet ) {
+            *s << version << oldVersion;
             s->exec();
             s->clearBindings();
             s->reset();
         }
-    }
+    };
 
-    // If the version is the same it was in the correct datetime place,
-    // or if there are no newer transactions
-    if ( tranasaction.version == version || 0 == version ) {
-        savePoint.reset();
-        return version;
+    CachedStatement previousTransaction( *conn,
+            "SELECT version "
+            "FROM 'Transaction' "
+            "WHERE timestamp <= ? AND version < ? "
+            "ORDER BY timestamp DESC, version DESC "
+            "LIMIT 1 ");
+    previousTransaction << nextTimestamp << nextVersion;
+    unsigned previousVersion{ 0 };
+    if ( previousTransaction.executeStep() ) {
+        previousVersion = previousTransaction.getColumn( "version" ).getUInt();
     }
 
-    // Sort by id if the datetime is the same
-    sameTimeTransaction << tranasaction.date.toString();
-    while( sameTimeTransaction.executeStep() ) {
-        if ( tranasaction.hash < CryptoHelper::SHA3(
-                sameTimeTransaction.getColumn( "hash" ).getString() ) ) {
-            // Break the loop if the current transaction has the smaller hash
-            version = sameTimeTransaction.getColumn( "version" ).getUInt() - 1;
-            LOG ( DBUG ) << "Reordering: sametime version: " << version;
-            break;
-        }
-        version = sameTimeTransaction.getColumn( "version" ).getUInt();
-        LOG ( DBUG ) << "Reordering: sametime version: " << version;
-        for( std::unique_ptr<Statement>& s : versionDown ) {
-            *s << version;
-            s->exec();
-            s->clearBindings();
-            s->reset();
+    unsigned version{ 0 };
+    if ( nextVersion - previousVersion > 1 ) {
+        version = previousVersion + ( nextVersion - previousVersion ) / 2;
+        setVersion( version, tranasaction.version );
+    } else {
+        // The gap is used up. Spread out the versions of the surrounding
+        // transactions evenly, growing the window until it has enough room.
+        // Park the transaction at version 0, which is never used, meanwhile.
+        setVersion( 0, tranasaction.version );
+
+        CachedStatement below( *conn,
+                "SELECT version FROM 'Transaction' "
+                "WHERE version > 0 AND version < ? "
+                "ORDER BY version DESC LIMIT ? ");
+        CachedStatement above( *conn,
+                "SELECT version FROM 'Transaction' "
+                "WHERE version >= ? "
+                "ORDER BY version ASC LIMIT ? ");
+
+        std::vector<unsigned> window;
+        std::size_t position{ 0 };
+        unsigned long long low{ 0 }, high{ 0 };
+        for ( int size = 8; ; size *= 2 ) {
+            window.clear();
+            below << nextVersion << size + 1;
+            while ( below.executeStep() ) {
+                window.push_back( below.getColumn( "version" ).getUInt() );
+            }
+            below.clearBindings();
+            below.reset();
+            low = 0;
+            if ( window.size() > static_cast<std::size_t>( size ) ) {
+                low = window.back();
+                window.pop_back();
+            }
+            std::reverse( window.begin(), window.end() );
+            position = window.size();
+
+            above << nextVersion << size + 1;
+            while ( above.executeStep() ) {
+                window.push_back( above.getColumn( "version" ).getUInt() );
+            }
+            above.clearBindings();
+            above.reset();
+            const bool last{ window.size() - position <= static_cast<std::size_t>( size ) };
+            if ( !last ) {
+                high = window.back();
+                window.pop_back();
+            }
+            const unsigned long long needed{ ( window.size() + 2 ) * VERSION_MIN_GAP };
+            if ( last ) {
+                // The window reaches the last transaction, there is room above it
+                high = std::max<unsigned long long>( window.back() + VERSION_STRIDE, low + needed );
+            }
+            if ( high - low >= needed ) {
+                break;
+            }
         }
-    }
-    // If the version is the same it was in the correct datetime place,
-    // therefore nothing needs to be done
-    if ( version == tranasaction.version ) {
-        savePoint.reset();
-        return version;
-    }
 
-    // Set version for the current transaction to the newly freed gap
-    for( std::unique_ptr<Statement>& s : versionSet ) {
-        *s << version << tranasaction.version + 1; // Add one to reflect the update in the database
-        s->exec();
-        s->clearBindings();
-        s->reset();
+        // Move the transactions to their new versions. Transactions that move
+        // down are moved lowest first and those that move up highest first,
+        // so that no version is ever used twice.
+        const unsigned long long step{ ( high - low ) / ( window.size() + 2 ) };
+        auto target = [&]( std::size_t i ) {
+            return static_cast<unsigned>( low + step * ( i < position ? i + 1 : i + 2 ) );
+        };
+        for ( std::size_t i = 0; i < window.size(); ++i ) {
+            if ( target( i ) < window[i] ) {
+                setVersion( target( i ), window[i] );
+            }
+        }
+        for ( std::size_t i = window.size(); i-- > 0; ) {
+            if ( target( i ) > window[i] ) {
+                setVersion( target( i ), window[i] );
+            }
+        }
+        version = static_cast<unsigned>( low + step * ( position + 1 ) );
+        setVersion( version, 0 );
+        LOG ( DBUG ) << "Reordering: respaced " << window.size() << " transactions";
     }
+    LOG ( DBUG ) << "Reordering: new version: " << version;
 
     savePoint->save(); // Same as commit for a regular transaction begin
     savePoint.reset();
@@ -1450,12 +2664,12 @@ CryptoHelper::Signature Database::signTransaction( const CryptoHelper::SHA3& has
 void Database::usersChanged( const Database::ObjectRef& userObject ) {
     if ( AccessDomain::Settings == userObject.accessDomain && USERS_OBJECT_ID == userObject.id ) {
         // Handle user changes
-        Database::Statement affectedUsers( *db.get(),
+        Database::CachedStatement affectedUsers( *db.get(),
                 "SELECT id, max(version) AS version, status "
                 "FROM Object WHERE accessDomain=? AND parent=? "
                 "GROUP BY id " );
 
-        Database::Statement user( *db.get(),
+        Database::CachedStatement user( *db.get(),
                 "SELECT accessDomain, id, version, name, value "
                 "FROM Attribute "
                 "WHERE accessDomain=? AND id=? AND version=? ");
@@ -1504,15 +2718,82 @@ void Database::usersChanged( const Database::ObjectRef& userObject ) {
     }
 }
 
+bool Database::describeChange( const ObjectRef& objectRef,
+        std::map<ObjectRef,ChildrenChange,lessObjectRef>& changes ) {
+    CachedStatement latest( *db.get(),
+            "SELECT version, parent, parentAccessDomain, transactionAction FROM Object "
+            "WHERE accessDomain=? AND id=? ORDER BY version DESC LIMIT 2" );
+    latest << static_cast<int>( objectRef.accessDomain ) << static_cast<long long>( objectRef.id );
+    if ( !latest.executeStep() ) {
+        return false;
+    }
+    unsigned version{ latest.getColumn( "version" ).getUInt() };
+    ObjectRef parent{ static_cast<AccessDomain>( latest.getColumn( "parentAccessDomain" ).getUInt() ),
+            static_cast<unsigned long>( latest.getColumn( "parent" ).getInt64() ) };
+    ObjectAction action{ static_cast<ObjectAction>( latest.getColumn( "transactionAction" ).getInt() ) };
+    ChildrenChange& change( changes[ parent ] );
+    change.objects.insert( objectRef.id );
+
+    bool hasPrevious{ latest.executeStep() };
+    if ( ObjectAction::Update != action || !hasPrevious ) {
+        change.membership = true;
+        if ( hasPrevious ) {
+            // A moved object also leaves its previous parent
+            ObjectRef previousParent{ static_cast<AccessDomain>( latest.getColumn( "parentAccessDomain" ).getUInt() ),
+                    static_cast<unsigned long>( latest.getColumn( "parent" ).getInt64() ) };
+            changes[ previousParent ].membership = true;
+            changes[ previousParent ].objects.insert( objectRef.id );
+        }
+        return ObjectAction::Delete == action;
+    }
+
+    // Attributes that were added, removed or given a new value
+    CachedStatement attributes( *db.get(),
+            "SELECT name FROM Attribute WHERE accessDomain=? AND id=? AND version IN (?, ?) "
+            "GROUP BY name HAVING COUNT(*) < 2 OR MIN(type) <> MAX(type) OR MIN(value) IS NOT MAX(value)" );
+    attributes << static_cast<int>( objectRef.accessDomain ) << static_cast<long long>( objectRef.id )
+            << version << latest.getColumn( "version" ).getUInt();
+    while ( attributes.executeStep() ) {
+        change.attributes.insert( attributes.getColumn( "name" ).getString() );
+    }
+    return false;
+}
+
 void Database::objectsChanged( const std::set<ObjectRef, lessObjectRef>& objects ) {
-    // Rerun all function queries and check if the result have changed
-    for( auto& kv : queryFunctionSubscriberCallback ) {
-        const Query& q{ *( std::get<0>( kv.second ).get() ) };
-        double& val{ std::get<1>( kv.second ) };
-        QueryResult qr{ query( q, db.get() ) };
-        if ( val != qr.functionValue ) {
-            val = qr.functionValue;
-            std::get<2>( kv.second )( qr );
+    std::lock_guard<std::recursive_mutex> lock( mux );
+    std::set<unsigned> affected{};
+
+    // Find the subscriptions that read the children of a changed parent
+    std::map<ObjectRef,ChildrenChange,lessObjectRef> changes{};
+    bool deleted{ false };
+    if ( !parentSubscribers.empty() ) {
+        for( const ObjectRef& objectRef: objects ) {
+            deleted = describeChange( objectRef, changes ) || deleted;
+        }
+
+        if ( deleted ) {
+            // The descendants of a deleted object change status without being listed
+            for ( const auto& kv : parentSubscribers ) {
+                affected.insert( kv.second.begin(), kv.second.end() );
+            }
+        } else {
+            for ( const auto& change : changes ) {
+                auto subs = parentSubscribers.find( change.first );
+                if ( subs == parentSubscribers.end() ) {
+                    continue;
+                }
+                for ( const unsigned sub : subs->second ) {
+                    auto attributes = subscriberAttributes.find( sub );
+                    if ( change.second.membership
+                            || attributes == subscriberAttributes.end()
+                            || std::any_of( change.second.attributes.begin(), change.second.attributes.end(),
+                                    [&attributes]( const std::string& name ) {
+                                        return 0 != attributes->second.count( name );
+                                    } ) ) {
+                        affected.insert( sub );
+                    }
+                }
+            }
         }
     }
 
@@ -1537,11 +2818,9 @@ void Database::objectsChanged( const std::set<ObjectRef, lessObjectRef>& objects
                     if ( objectSubscriberCallback.count( sub ) ) {
                         objectSubscriberCallback.at( sub )( obj );
                         subscriber.insert( sub );
-                    }
-                    if ( querySubscriberCallback.count( sub ) ) {
-                        Query* q{ querySubscriberCallback.at( sub ).first.get() };
-                        if( querySubscriberCallback.at( sub ).second )
-                            querySubscriberCallback.at( sub ).second( query( *q, db.get() ) );
+                    } else {
+                        // Version query subscription
+                        affected.insert( sub );
                     }
                 }
             }
@@ -1549,6 +2828,51 @@ void Database::objectsChanged( const std::set<ObjectRef, lessObjectRef>& objects
             // OK, no subscribers found
         }
     }
+
+    // Rerun the affected queries, callbacks are copied since they may unsubscribe
+    for ( const unsigned sub : affected ) {
+        auto function = queryFunctionSubscriberCallback.find( sub );
+        if ( function != queryFunctionSubscriberCallback.end() ) {
+            const Query& querier{ *std::get<0>( function->second ) };
+            QueryResult qr{};
+            auto aggregate = functionAggregates.find( sub );
+            if ( aggregate == functionAggregates.end() ) {
+                qr = query( querier, db.get() );
+            } else {
+                auto change = changes.find( subscriberParent.at( sub ) );
+                if ( deleted || change == changes.end() ) {
+                    loadAggregate( querier, aggregate->second );
+                } else {
+                    updateAggregate( querier, aggregate->second, change->second.objects );
+                }
+                qr.isFunctionCall = true;
+                qr.functionName = querier.getFunctionName();
+                qr.functionAttribute = querier.getFunctionAttribute();
+                qr.functionValue = aggregateValue( qr.functionName, aggregate->second );
+            }
+            if ( std::get<1>( function->second ) != qr.functionValue ) {
+                std::get<1>( function->second ) = qr.functionValue;
+                std::function<void(QueryResult)> cb{ std::get<2>( function->second ) };
+                cb( qr );
+            }
+            continue;
+        }
+        auto delta = queryDeltaSubscriberCallback.find( sub );
+        if ( delta != queryDeltaSubscriberCallback.end() ) {
+            QueryDelta qd{ diffObjects( query( *std::get<0>( delta->second ), db.get() ).objects,
+                    std::get<1>( delta->second ) ) };
+            if ( !qd.added.empty() || !qd.changed.empty() || !qd.removed.empty() ) {
+                std::function<void(QueryDelta)> cb{ std::get<2>( delta->second ) };
+                cb( qd );
+            }
+            continue;
+        }
+        auto list = querySubscriberCallback.find( sub );
+        if ( list != querySubscriberCallback.end() && list->second.second ) {
+            std::function<void(QueryResult)> cb{ list->second.second };
+            cb( query( *list->second.first, db.get() ) );
+        }
+    }
 }
 
 void Database::rollback( Mist::RemoteTransaction* transaction ) {
@@ -1577,8 +2901,8 @@ std::vector<CryptoHelper::SHA3> Database::getParents( unsigned version,
     if ( nullptr != connection ) {
         conn = connection;
     }
-    Database::Statement parent( *conn,
-            "SELECT hash"
+    Database::CachedStatement parent( *conn,
+            "SELECT hash "
             "FROM TransactionParent AS tp, 'Transaction' AS t "
             "WHERE tp.version=? AND t.accessDomain=tp.parentAccessDomain AND t.version=tp.parentVersion "
             "ORDER BY hash ");
@@ -1586,28 +2910,19 @@ std::vector<CryptoHelper::SHA3> Database::getParents( unsigned version,
 
     std::vector<CryptoHelper::SHA3> parents;
     while ( parent.executeStep() ) {
-        parents.push_back( CryptoHelper::SHA3::fromString( parent.getColumn( "hash" ).getString() ) );
+        parents.push_back( columnToHash( parent.getColumn( "hash" ) ) );
     }
     return parents;
 }
 
-std::vector<CryptoHelper::SHA3> Database::getParents( CryptoHelper::SHA3 transactionHash,
-        Connection* connection ) const {
-    Connection* conn{ db.get() };
-    if ( nullptr != connection ) {
-        conn = connection;
-    }
-    Database::Statement parent( *conn,
-            "SELECT hash "
-            "FROM TransactionParent AS tp, 'Transaction' AS t "
-            "WHERE t.hash=? AND tp.version=t.version AND tp.accessDomain=t.parentAccessDomain "
-            "ORDER BY hash ");
-    parent << transactionHash.toString();
-
-    std::vector<CryptoHelper::SHA3> parents;
-    while ( parent.executeStep() ) {
-        parents.push_back( CryptoHelper::SHA3::fromString( parent.getColumn( "hash" ).getString() ) );
+std::vector<CryptoHelper::SHA3> Database::getParents( CryptoHelper::SHA3 transactionHash ) const {
+    std::lock_guard<std::mutex> lock( graphMutex );
+    auto node = graph.find( transactionHash );
+    if ( node == graph.end() ) {
+        return std::vector<CryptoHelper::SHA3>{};
     }
+    std::vector<CryptoHelper::SHA3> parents{ node->second.parents };
+    std::sort( parents.begin(), parents.end() );
     return parents;
 }
 
@@ -1618,23 +2933,9 @@ Database::Transaction Database::statementRowToTransaction( Database::Statement&
         unsigned version{ stmt.getColumn( "version" ).getUInt() };
         Helper::Date timestamp{ stmt.getColumn( "timestamp" ).getString() };
 
-        CryptoHelper::SHA3 creator{};
-        CryptoHelper::SHA3 hash{};
-        CryptoHelper::Signature signature{};
-
-        std::string userHash{ stmt.getColumn( "userHash" ).getString() };
-        std::string hashStr{ stmt.getColumn( "hash" ).getString() };
-        std::string sig{ stmt.getColumn( "signature" ).getString() };
-
-        if ( !userHash.empty() ) {
-            creator = CryptoHelper::SHA3::fromString( userHash );
-        }
-        if ( !hashStr.empty() ) {
-            hash = CryptoHelper::SHA3::fromString( hashStr );
-        }
-        if ( !sig.empty() ) {
-            signature = CryptoHelper::Signature::fromString( sig );
-        }
+        CryptoHelper::SHA3 creator{ columnToHash( stmt.getColumn( "userHash" ) ) };
+        CryptoHelper::SHA3 hash{ columnToHash( stmt.getColumn( "hash" ) ) };
+        CryptoHelper::Signature signature{ columnToSignature( stmt.getColumn( "signature" ) ) };
 
         return Database::Transaction{ ad, version, timestamp, creator, hash, signature };
     } catch( const SQLite::Exception& e ) {
@@ -1644,6 +2945,38 @@ Database::Transaction Database::statementRowToTransaction( Database::Statement&
     }
 }
 
+Helper::Database::Blob Database::toBlob( const CryptoHelper::SHA3& hash ) {
+    if ( 0 == hash.size() ) {
+        return Helper::Database::Blob{ nullptr, 0 };
+    }
+    return Helper::Database::Blob{ hash.data(), static_cast<int>( hash.size() ) };
+}
+
+Helper::Database::Blob Database::toBlob( const CryptoHelper::Signature& signature ) {
+    if ( 0 == signature.size() ) {
+        return Helper::Database::Blob{ nullptr, 0 };
+    }
+    return Helper::Database::Blob{ signature.data(), static_cast<int>( signature.size() ) };
+}
+
+CryptoHelper::SHA3 Database::columnToHash( const Helper::Database::Column& column ) {
+    const std::uint8_t* data{ static_cast<const std::uint8_t*>( column.getBlob() ) };
+    const int size{ column.getBytes() };
+    if ( nullptr == data || 0 == size ) {
+        return CryptoHelper::SHA3{};
+    }
+    return CryptoHelper::SHA3::fromBuffer( std::vector<std::uint8_t>( data, data + size ) );
+}
+
+CryptoHelper::Signature Database::columnToSignature( const Helper::Database::Column& column ) {
+    const std::uint8_t* data{ static_cast<const std::uint8_t*>( column.getBlob() ) };
+    const int size{ column.getBytes() };
+    if ( nullptr == data || 0 == size ) {
+        return CryptoHelper::Signature{};
+    }
+    return CryptoHelper::Signature::fromBuffer( std::vector<std::uint8_t>( data, data + size ) );
+}
+
 Database::Object Database::statementRowToObject( Database::Statement& object, std::map<std::string, Database::Value> attributes ) {
     try {
         AccessDomain ad{ static_cast<AccessDomain>( object.getColumn( "accessDomain" ).getInt() ) };
@@ -1826,6 +3159,119 @@ Database::Manifest Database::Manifest::fromString( const std::string& serialized
     return Manifest( signer, verifier, name, created, creator, signature, hash );
 }
 
+Database::Sketch::Sketch( std::size_t cells ) :
+        cells( std::max( SKETCH_HASHES, cells + SKETCH_HASHES - 1 ) / SKETCH_HASHES * SKETCH_HASHES,
+                Cell{ 0, key_t{}, 0 } ) {
+}
+
+void Database::Sketch::insert( const CryptoHelper::SHA3& hash ) {
+    key_t key{};
+    std::copy( hash.data(), hash.data() + std::min( hash.size(), key.size() ), key.begin() );
+    toggle( key, 1 );
+}
+
+void Database::Sketch::toggle( const key_t& key, long long count ) {
+    // The hash is already uniform, each of its first words picks a cell in
+    // a part of the table of its own
+    std::size_t part{ cells.size() / SKETCH_HASHES };
+    std::uint32_t check{ sketchCheck( key ) };
+    for ( std::size_t i{ 0 }; i < SKETCH_HASHES; ++i ) {
+        std::uint32_t word{ static_cast<std::uint32_t>( key[4 * i] ) << 24
+                | static_cast<std::uint32_t>( key[4 * i + 1] ) << 16
+                | static_cast<std::uint32_t>( key[4 * i + 2] ) << 8
+                | static_cast<std::uint32_t>( key[4 * i + 3] ) };
+        Cell& cell = cells.at( i * part + word % part );
+        cell.count += count;
+        for ( std::size_t j{ 0 }; j < key.size(); ++j ) {
+            cell.keySum[j] ^= key[j];
+        }
+        cell.checkSum ^= check;
+    }
+}
+
+void Database::Sketch::subtract( const Sketch& other ) {
+    if ( other.cells.size() != cells.size() ) {
+        throw std::invalid_argument( "Sketches differ in size" );
+    }
+    for ( std::size_t i{ 0 }; i < cells.size(); ++i ) {
+        cells[i].count -= other.cells[i].count;
+        for ( std::size_t j{ 0 }; j < cells[i].keySum.size(); ++j ) {
+            cells[i].keySum[j] ^= other.cells[i].keySum[j];
+        }
+        cells[i].checkSum ^= other.cells[i].checkSum;
+    }
+}
+
+bool Database::Sketch::decode( std::vector<CryptoHelper::SHA3>& here,
+        std::vector<CryptoHelper::SHA3>& there ) const {
+    // Peel off the cells that hold one hash until nothing is left
+    Sketch rest{ *this };
+    bool peeled{ true };
+    while ( peeled ) {
+        peeled = false;
+        for ( const Cell& cell : rest.cells ) {
+            if ( ( 1 == cell.count || -1 == cell.count ) && sketchCheck( cell.keySum ) == cell.checkSum ) {
+                key_t key{ cell.keySum };
+                long long count{ cell.count };
+                ( 1 == count ? here : there ).push_back(
+                        CryptoHelper::SHA3( std::vector<std::uint8_t>( key.begin(), key.end() ) ) );
+                rest.toggle( key, -count );
+                peeled = true;
+            }
+        }
+    }
+    for ( const Cell& cell : rest.cells ) {
+        if ( 0 != cell.count || 0 != cell.checkSum || key_t{} != cell.keySum ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string Database::Sketch::toString() const {
+    std::stringstream ss{};
+    JSON::Serialize s{};
+    std::ostream os( ss.rdbuf() );
+    s.set_ostream( os );
+    s.start_object();
+        s.put( "cells" );
+        s.start_array();
+        for ( const Cell& cell : cells ) {
+            s.start_array();
+                s.put( cell.count );
+                s.put( CryptoHelper::SHA3( std::vector<std::uint8_t>( cell.keySum.begin(), cell.keySum.end() ) ).toString() );
+                s.put( static_cast<long long>( cell.checkSum ) );
+            s.close_array();
+        }
+        s.close_array();
+    s.close_object();
+    return ss.str();
+}
+
+Database::Sketch Database::Sketch::fromString( const std::string& serialized ) {
+    JSON::Value json{ JSON::Deserialize::generate_json_value( serialized ) };
+    const std::vector<JSON::Value>& cells = json.at( "cells" ).array;
+    if ( cells.size() > SKETCH_CELLS_MAX ) {
+        throw std::invalid_argument( "Sketch is too large" );
+    }
+
+    Sketch sketch( cells.size() );
+    if ( sketch.cells.size() != cells.size() ) {
+        throw std::invalid_argument( "Sketch size is not a multiple of the number of hashes" );
+    }
+    for ( std::size_t i{ 0 }; i < cells.size(); ++i ) {
+        Cell& cell = sketch.cells[i];
+        cell.count = cells.at( i ).at( 0 ).get_integer();
+        CryptoHelper::SHA3 keySum{ CryptoHelper::SHA3::fromString( cells.at( i ).at( 1 ).get_string() ) };
+        if ( keySum.size() != cell.keySum.size() ) {
+            throw std::invalid_argument( "Invalid sketch cell" );
+        }
+        std::copy( keySum.data(), keySum.data() + keySum.size(), cell.keySum.begin() );
+        cell.checkSum = static_cast<std::uint32_t>( cells.at( i ).at( 2 ).get_integer() );
+    }
+    return sketch;
+}
+
 Database::Manifest Database::Manifest::fromJSON( const JSON::Value& json, Verifier verifier, Signer signer ) {
     std::string name{ json.at( "manifest" ).at( "name" ).get_string() };
     Helper::Date created { json.at( "manifest" ).at( "created" ).get_string() };
@@ -4,6 +4,7 @@
  * Free software licensed under GPLv3.
  */
 
+#include <algorithm>
 #include <ostream>
 #include <stdexcept>
 
@@ -105,6 +106,10 @@ enum class ExchangeState : int {
 
 using sb_t = std::basic_streambuf<char>;
 
+// The object sections of a transaction body, in the order they are serialized
+const char* const objectSections[]{ "changed", "deleted", "moved", "new" };
+constexpr unsigned objectSectionCount{ 4 };
+
 void write( sb_t& sb, char c ) {
     if ( std::char_traits<char>::eof() == sb.sputc( c ) ) {
         throw FormatException( "Stream error while outputting exchange format data." );
@@ -120,13 +125,13 @@ void write( sb_t& sb, const std::string& data ) {
 /*****************************************************************************/
 using namespace std::placeholders;
 
-Serializer::Serializer( Database* db ) : db( db ), sb( nullptr ), s{}, os{} {
+Serializer::Serializer( const Database* db ) : db( db ), sb( nullptr ), s{}, os{} {
 
 }
 
 void Serializer::readTransaction( sb_t& sb,
         const std::string& hash,
-        Helper::Database::Database* connection ) {
+        Helper::Database::Connection* connection ) {
     Database::Transaction transaction{ db->getTransactionMeta( hash, connection ) };
     initReading( sb );
 
@@ -135,7 +140,7 @@ void Serializer::readTransaction( sb_t& sb,
 
 void Serializer::readTransactionBody( sb_t& sb,
         const std::string& hash,
-        Helper::Database::Database* connection ) {
+        Helper::Database::Connection* connection ) {
     Database::Transaction transaction{ db->getTransactionMeta( hash, connection ) };
     initReading( sb );
 
@@ -144,45 +149,80 @@ void Serializer::readTransactionBody( sb_t& sb,
 
 void Serializer::readTransactionBody( sb_t& sb,
         unsigned version,
-        Helper::Database::Database* connection ) {
+        Helper::Database::Connection* connection ) {
     Database::Transaction transaction{ db->getTransactionMeta( version, connection ) };
     initReading( sb );
 
     transBody( transaction, connection );
 }
 
-void Serializer::readTransactionList( sb_t& sb ) {
+void Serializer::readTransactionList( sb_t& sb,
+        Helper::Database::Connection* connection ) {
     initReading( sb );
 
     s->start_array();
-    db->mapTransactions( std::bind( &Serializer::meta, this, _1, nullptr ), nullptr );
+    db->mapTransactions( std::bind( &Serializer::meta, this, _1, connection ), connection );
     s->close_array();
 }
 
 void Serializer::readTransactionMetadata( sb_t& sb,
-        const std::string& hash ) {
+        const std::string& hash,
+        Helper::Database::Connection* connection ) {
     initReading( sb );
-    meta( db->getTransactionMeta( hash ), nullptr );
+    meta( db->getTransactionMeta( hash, connection ), connection );
 }
 
-void Serializer::readTransactionMetadataLatest( sb_t& sb ) {
+void Serializer::readTransactionMetadataLatest( sb_t& sb,
+        Helper::Database::Connection* connection ) {
     initReading( sb );
 
     s->start_array();
-    db->mapTransactionLatest( std::bind( &Serializer::meta, this, _1, nullptr ), nullptr );
+    db->mapTransactionLatest( std::bind( &Serializer::meta, this, _1, connection ), connection );
     s->close_array();
 }
 
 // TODO: make this like "readTransactionList" method
 void Serializer::readTransactionMetadataFrom( sb_t& sb,
-        const std::vector<std::string>& hashes ) {
+        const std::vector<std::string>& hashes,
+        Helper::Database::Connection* connection ) {
     initReading( sb );
 
     s->start_array();
-    db->mapTransactionsFrom( std::bind( &Serializer::meta, this, _1, nullptr ), hashes, nullptr );
+    db->mapTransactionsFrom( std::bind( &Serializer::meta, this, _1, connection ), hashes, connection );
+    s->close_array();
+}
+
+void Serializer::readTransactionMetadataOf( sb_t& sb,
+        const std::vector<std::string>& hashes,
+        Helper::Database::Connection* connection ) {
+    initReading( sb );
+
+    s->start_array();
+    for ( const std::string& hash : hashes ) {
+        meta( db->getTransactionMeta( hash, connection ), connection );
+    }
     s->close_array();
 }
 
+void Serializer::readTransactions( sb_t& sb,
+        const std::vector<std::string>& hashes,
+        Helper::Database::Connection* connection ) {
+    for ( const std::string& hash : hashes ) {
+        readTransaction( sb, hash, connection );
+        sb.sputc( '\n' );
+    }
+}
+
+void Serializer::readTransactionsFrom( sb_t& sb,
+        const std::vector<std::string>& hashes,
+        Helper::Database::Connection* connection ) {
+    db->mapTransactionsFrom( [this, &sb, connection]( const Database::Transaction& transaction ) -> void {
+        initReading( sb );
+        trans( transaction, connection );
+        sb.sputc( '\n' );
+    }, hashes, connection );
+}
+
 void Serializer::readUser( std::basic_streambuf<char>& sb, const std::string& user ) {
     initReading( sb );
     try {
@@ -217,7 +257,7 @@ void Serializer::initReading( sb_t& sb ) {
 }
 
 void Serializer::trans( const Database::Transaction& transaction,
-        Helper::Database::Database* connection ) const {
+        Helper::Database::Connection* connection ) const {
     s->start_object();
         s->put( "id" );
         s->put( transaction.hash.toString() );
@@ -229,7 +269,7 @@ void Serializer::trans( const Database::Transaction& transaction,
 }
 
 void Serializer::transBody( const Database::Transaction& transaction,
-        Helper::Database::Database* connection ) const {
+        Helper::Database::Connection* connection ) const {
     s->start_object();
         s->put( "metadata" );
         s->start_object();
@@ -269,7 +309,7 @@ void Serializer::transBody( const Database::Transaction& transaction,
 }
 
 void Serializer::meta( const Database::Transaction& transaction,
-        Helper::Database::Database* connection ) const {
+        Helper::Database::Connection* connection ) const {
     s->start_object();
         s->put( "id" );
         s->put( transaction.hash.toString() );
@@ -373,8 +413,8 @@ void Serializer::user( const std::string& id,
 /*****************************************************************************/
 
 
-Deserializer::Deserializer( Database* db ) :
-        JSON::Event_handler(), db( db ), cb(), d{ new JSON::Deserialize() }, transaction{}, state{}, event_receiver{ JSON::Event_receiver::new_shared() } {
+Deserializer::Deserializer( Database* db, Helper::Database::Connection* connection ) :
+        JSON::Event_handler(), db( db ), connection( connection ), cb(), d{ new JSON::Deserialize() }, transaction{}, state{}, event_receiver{ JSON::Event_receiver::new_shared() } {
     event_receiver->set_event_handler( this );
     d.reset( new JSON::Deserialize() );
     d->add_event_receiver( event_receiver.get() );
@@ -663,7 +703,7 @@ void Deserializer::parseMetaData( E e ) {
                 parents.clear();
                 try {
                     for ( const std::string& parent: parentIds ) {
-                        parents.push_back( db->getTransactionMeta( parent ) );
+                        parents.push_back( db->getTransactionMeta( parent, connection ) );
                     }
                     startTransaction();
                 } catch ( const Mist::Exception& e ) {
@@ -875,6 +915,7 @@ void Deserializer::parseChanged( E e ) {
             return;
         } else if ( E::Object_end == e ) {
             d->pop();
+            hashSection( 1 );
             state.top() = S::DeletedKeyword; // <------- Next state
             return;
         }
@@ -925,6 +966,7 @@ void Deserializer::parseDeleted( E e ) {
        } else if ( E::Object_end == e ) {
            // No more deleted objects
            d->pop();
+           hashSection( 2 );
            state.top() = S::MovedKeyword; // <------- Next state
            return;
        }
@@ -972,6 +1014,7 @@ void Deserializer::parseMoved( E e ) {
         } else if ( E::Object_end == e ) {
             // No more moved objects
             d->pop();
+            hashSection( 3 );
             state.top() = S::NewKeyword; // <------- Next state
             return;
         }
@@ -1031,6 +1074,7 @@ void Deserializer::parseNew( E e ) {
         } else if ( E::Object_end == e ) {
             // No more new objects
             d->pop();
+            hashSection( objectSectionCount );
             pop(); // <------- Pop state
             return;
         }
@@ -1172,6 +1216,7 @@ void Deserializer::startTransaction() {
     if ( !db )
         return;
     transaction.reset();
+    hashReset();
     alreadyExists = false;
     try {
     transaction = std::move( db->beginRemoteTransaction(
@@ -1180,8 +1225,10 @@ void Deserializer::startTransaction() {
             Helper::Date( timestamp ),
             CryptoHelper::PublicKeyHash::fromString( user ),
             CryptoHelper::SHA3::fromString( transactionId ),
-            CryptoHelper::Signature::fromString( signature ) ) );
+            CryptoHelper::Signature::fromString( signature ),
+            connection ) );
     transaction->init(); // TODO: this should not be needed, make it RAII instead?
+    hashMetadata();
     } catch( const Exception& e ) {
         if( static_cast<Error::ErrorCode>( e.getErrorCode() ) == Error::ErrorCode::AlreadyInUse ) {
             // Transaction already exists, skip adding to database.
@@ -1212,13 +1259,14 @@ void Deserializer::commitTransaction() {
         } );
     }
     if ( db && transaction ) {
-        transaction->commit();
+        transaction->commit( hashBody() );
         transaction.reset();
     }
 }
 
 void Deserializer::rollbackTransaction() {
     transaction.reset();
+    hashReset();
 }
 
 void Deserializer::changeObject() {
@@ -1228,6 +1276,16 @@ void Deserializer::changeObject() {
 
     if ( !db )
         return;
+    body->put( std::to_string( std::stoll( objId ) ) );
+    body->start_object();
+        body->put( "attributes" );
+        body->start_object();
+        for( const auto& attr : attributes ) {
+           putAttribute( body.get(), attr );
+        }
+        body->close_object();
+    body->close_object();
+
     // TODO: correct conversion for id
     transaction->updateObject( std::stoll( objId ), attributes );
 }
@@ -1239,6 +1297,9 @@ void Deserializer::deleteObject() {
 
     if ( !db )
         return;
+    body->put( std::to_string( std::stoll( objId ) ) );
+    body->create_true();
+
     // TODO: correct conversion for id
     transaction->deleteObject( std::stoll( objId ) );
 }
@@ -1250,6 +1311,9 @@ void Deserializer::moveObject() {
 
     if ( !db )
         return;
+    body->put( std::to_string( std::stoll( objId ) ) );
+    body->put( objParent );
+
     // TODO: correct conversion for id
     transaction->moveObject(
             std::stoll( objId ),
@@ -1266,6 +1330,18 @@ void Deserializer::newObject() {
 
     if ( !db )
         return;
+    body->put( std::to_string( std::stoll( objId ) ) );
+    body->start_object();
+        body->put( "parent" );
+        body->put( objParent ); // TODO: AD
+        body->put( "attributes" );
+        body->start_object();
+        for( const auto& attr : attributes ) {
+           putAttribute( body.get(), attr );
+        }
+        body->close_object();
+    body->close_object();
+
     // TODO: correct conversion for id
     transaction->newObject(
             std::stoll( objId ),
@@ -1276,6 +1352,83 @@ void Deserializer::newObject() {
             attributes );
 }
 
+void Deserializer::hashMetadata() {
+    hasher.reset();
+    hashStream.reset( new StreamToString<>(
+        std::bind(
+                (void(CryptoHelper::SHA3Hasher::*)(const std::string&))&CryptoHelper::SHA3Hasher::update,
+                std::ref( hasher ),
+                _1 ) ) );
+    hashOstream.reset( new std::basic_ostream<char>( hashStream.get() ) );
+    body.reset( new JSON::Serialize() );
+    body->set_ostream( hashOstream.get() );
+
+    // The parents are serialized in the total order, as mapParents reads them
+    std::vector<Database::Transaction> sortedParents{ parents };
+    std::sort( sortedParents.begin(), sortedParents.end(),
+            []( const Database::Transaction& l, const Database::Transaction& r ) -> bool {
+        return l.version < r.version;
+    } );
+
+    body->start_object();
+        body->put( "metadata" );
+        body->start_object();
+            body->put( "accessDomain" );
+            body->put( static_cast<long long>( accessDomain ) );
+            body->put( "timestamp" );
+            body->put( timestamp );
+            body->put( "user" );
+            body->put( CryptoHelper::PublicKeyHash::fromString( user ).toString() );
+            body->put( "parents" );
+            body->start_object();
+            for ( const Database::Transaction& parent : sortedParents ) {
+                body->put( parent.hash.toString() );
+                body->create_true();
+            }
+            body->close_object();
+            body->put( "version" );
+            body->put( "1.0" );
+        body->close_object();
+        body->put( "objects" );
+        body->start_object();
+            body->put( objectSections[0] );
+            body->start_object();
+    bodySection = 0;
+}
+
+void Deserializer::hashSection( unsigned section ) {
+    if ( !body ) {
+        return;
+    }
+    // Close the open section, and output any skipped sections empty
+    while ( bodySection < section ) {
+        body->close_object();
+        if ( ++bodySection < objectSectionCount ) {
+            body->put( objectSections[bodySection] );
+            body->start_object();
+        }
+    }
+}
+
+CryptoHelper::SHA3 Deserializer::hashBody() {
+    hashSection( objectSectionCount );
+        body->close_object();
+    body->close_object();
+    hashOstream->flush();
+    if ( std::char_traits<char>::eof() == hashStream->pubsync() ) {
+        LOG( WARNING ) << "Can not sync streamer." ;
+        throw std::runtime_error( "Can not sync streamer." );
+    }
+    hashReset();
+    return hasher.finalize();
+}
+
+void Deserializer::hashReset() {
+    body.reset();
+    hashOstream.reset();
+    hashStream.reset();
+}
+
 void Deserializer::pop() {
     if ( state.empty() ) {
         rollbackTransaction();
@@ -11,6 +11,58 @@ namespace Helper {
 
 namespace Database {
 
+CachedStatement::CachedStatement( Connection& connection, const std::string& query ) :
+        Statement( query, connection.takeStatement( query ) ), connection( connection ) {
+}
+
+CachedStatement::~CachedStatement() noexcept {
+    sqlite3_stmt* statement{ getStmtPtr() };
+    // The result of the last step is already reported, ignore it here
+    sqlite3_reset( statement );
+    sqlite3_clear_bindings( statement );
+    try {
+        connection.releaseStatement( getQuery(), getStmtPtr() );
+    } catch (...) {
+        // The statement is finalized instead
+    }
+}
+
+constexpr std::size_t Connection::STATEMENT_CACHE_SIZE;
+
+unsigned long long Connection::getStatementCacheHits() const {
+    std::lock_guard<std::mutex> lock( statementCacheMutex );
+    return statementCacheHits;
+}
+
+unsigned long long Connection::getStatementCacheMisses() const {
+    std::lock_guard<std::mutex> lock( statementCacheMutex );
+    return statementCacheMisses;
+}
+
+CachedStatement::Ptr Connection::takeStatement( const std::string& query ) {
+    {
+        std::lock_guard<std::mutex> lock( statementCacheMutex );
+        auto it = statementCache.find( query );
+        if ( statementCache.end() != it ) {
+            ++statementCacheHits;
+            CachedStatement::Ptr statement{ it->second };
+            statementCache.erase( it );
+            return statement;
+        }
+        ++statementCacheMisses;
+    }
+    // Prepared outside the lock, SQLite serializes the use of the handle
+    std::string sql{ query };
+    return CachedStatement::Ptr( getHandle(), sql );
+}
+
+void Connection::releaseStatement( const std::string& query, const CachedStatement::Ptr& statement ) {
+    std::lock_guard<std::mutex> lock( statementCacheMutex );
+    if ( statementCache.size() < STATEMENT_CACHE_SIZE ) {
+        statementCache.emplace( query, statement );
+    }
+}
+
 SavePoint::SavePoint( Database* connection, const std::string& name ) :
         name( name ), released( false ), connection( connection ) {
     if ( nullptr == connection ) {
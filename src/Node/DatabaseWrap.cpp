@@ -60,6 +60,8 @@ DatabaseWrap::Init(v8::Local<v8::Object> target)
     Method<&DatabaseWrap::getObject>);
   Nan::SetPrototypeMethod(tpl, "query",
     Method<&DatabaseWrap::query>);
+  Nan::SetPrototypeMethod(tpl, "mapQuery",
+    Method<&DatabaseWrap::mapQuery>);
   Nan::SetPrototypeMethod(tpl, "queryVersion",
     Method<&DatabaseWrap::queryVersion>);
   Nan::SetPrototypeMethod(tpl, "subscribeObject",
@@ -150,6 +152,12 @@ void DatabaseWrap::query(const Nan::FunctionCallbackInfo<v8::Value>& info)
   auto attrs(objectAttributes(info[5]));
   int maxVersion{convBack<int>(info[6])};
   bool includeDeleted{convBack<bool>(info[7])};
+  unsigned pageSize{0};
+  std::string cursor;
+  if (info.Length() >= 9)
+    pageSize = convBack<unsigned>(info[8]);
+  if (info.Length() >= 10)
+    cursor = convBack<std::string>(info[9]);
 
   info.GetReturnValue().Set(QueryResultWrap::make(self()->query(
           accessDomain,
@@ -159,10 +167,45 @@ void DatabaseWrap::query(const Nan::FunctionCallbackInfo<v8::Value>& info)
           sort,
           attrs,
           maxVersion,
-          includeDeleted
+          includeDeleted,
+          pageSize,
+          cursor
           )));
 }
 
+void DatabaseWrap::mapQuery(const Nan::FunctionCallbackInfo<v8::Value>& info)
+{
+  Nan::HandleScope scope;
+
+  int accessDomain{convBack<int>(info[0])};
+  long long id{convBack<long long>(info[1])};
+  const std::string select{convBack<std::string>(info[2])};
+  const std::string filter{convBack<std::string>(info[3])};
+  const std::string sort{convBack<std::string>(info[4])};
+  auto attrs(objectAttributes(info[5]));
+  int maxVersion{convBack<int>(info[6])};
+  bool includeDeleted{convBack<bool>(info[7])};
+  auto func(info[8].As<v8::Function>());
+
+  // Each object is handed to JS while the query is still running
+  self()->mapQuery(
+          [&func](const Mist::Database::Object& object) -> void {
+            Nan::HandleScope scope;
+            v8::Local<v8::Value> args[] = { MistObjectWrap::make(object) };
+            Nan::Callback cb(func);
+            cb(1, args);
+          },
+          accessDomain,
+          id,
+          select,
+          filter,
+          sort,
+          attrs,
+          maxVersion,
+          includeDeleted
+          );
+}
+
 void DatabaseWrap::queryVersion(const Nan::FunctionCallbackInfo<v8::Value>& info)
 {
   Nan::HandleScope scope;
@@ -514,6 +557,8 @@ QueryResultWrap::Init(v8::Local<v8::Object> target)
            Getter<&QueryResultWrap::getFunctionValue>);
   Nan::SetAccessor(objTpl, Nan::New("objects").ToLocalChecked(),
            Getter<&QueryResultWrap::getObjects>);
+  Nan::SetAccessor(objTpl, Nan::New("cursor").ToLocalChecked(),
+           Getter<&QueryResultWrap::getCursor>);
 
   auto func(Nan::GetFunction(tpl).ToLocalChecked());
 
@@ -552,6 +597,13 @@ void QueryResultWrap::getFunctionValue(v8::Local<v8::String> name,
   info.GetReturnValue().Set(Nan::New(value));
 }
 
+void QueryResultWrap::getCursor(v8::Local<v8::String> name,
+        const Nan::PropertyCallbackInfo<v8::Value>& info)
+{
+  Nan::HandleScope scope;
+  info.GetReturnValue().Set(conv(self().cursor));
+}
+
 void QueryResultWrap::getObjects(v8::Local<v8::String> name,
         const Nan::PropertyCallbackInfo<v8::Value>& info)
 {
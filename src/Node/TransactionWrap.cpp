@@ -44,6 +44,8 @@ TransactionWrap::Init(v8::Local<v8::Object> target)
     Method<&TransactionWrap::getObject>);
   Nan::SetPrototypeMethod(tpl, "query",
     Method<&TransactionWrap::query>);
+  Nan::SetPrototypeMethod(tpl, "mapQuery",
+    Method<&TransactionWrap::mapQuery>);
   Nan::SetPrototypeMethod(tpl, "queryVersion",
     Method<&TransactionWrap::queryVersion>);
 
@@ -173,6 +175,39 @@ TransactionWrap::query(const Nan::FunctionCallbackInfo<v8::Value>& info)
           )));
 }
 
+void
+TransactionWrap::mapQuery(const Nan::FunctionCallbackInfo<v8::Value>& info)
+{
+  Nan::HandleScope scope;
+
+  int accessDomain{convBack<int>(info[0])};
+  long long id{convBack<long long>(info[1])};
+  const std::string select{convBack<std::string>(info[2])};
+  const std::string filter{convBack<std::string>(info[3])};
+  const std::string sort{convBack<std::string>(info[4])};
+  auto attrs(objectAttributes(info[5]));
+  int maxVersion{convBack<int>(info[6])};
+  bool includeDeleted{convBack<bool>(info[7])};
+  auto func(info[8].As<v8::Function>());
+
+  self()->mapQuery(
+          [&func](const Mist::Database::Object& object) -> void {
+            Nan::HandleScope scope;
+            v8::Local<v8::Value> args[] = { MistObjectWrap::make(object) };
+            Nan::Callback cb(func);
+            cb(1, args);
+          },
+          accessDomain,
+          id,
+          select,
+          filter,
+          sort,
+          attrs,
+          maxVersion,
+          includeDeleted
+          );
+}
+
 void
 TransactionWrap::queryVersion(const Nan::FunctionCallbackInfo<v8::Value>& info)
 {
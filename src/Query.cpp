@@ -957,17 +957,25 @@ void Filter::parse( std::string str )
     expression.parse( QueryParser::parseExpression( QueryTokenizer::tokenize( str ) ) );
 }
 
+std::set<std::string> Filter::getAttributes()
+{
+    if (none)
+        return {};
+    return expression.getAttributes();
+}
+
 void Filter::makeSQL( Query &res, const std::map<std::string,ArgumentVT> &args, int maxVersion, std::string status, bool versionsQuery )
 {
     if (none) {
         if (maxVersion) {
+            // The rowId is taken from the row that MAX() picks in each group
             res.args.push_back( std::to_string( maxVersion ) );
-            res.sqlQuery += std::string( "AND o.rowId IN (SELECT o.rowId, max(version) FROM Object AS o " )
+            res.sqlQuery += std::string( "AND o.rowId IN (SELECT rowId FROM (SELECT o.rowId AS rowId, MAX(o.version) FROM Object AS o " )
                 + "WHERE o.accessDomain=" + Query::printArg( 1 )
                 + (versionsQuery ? " AND o.id=" : " AND o.parent=" ) + Query::printArg( 2 ) + " "
-                + "AND " + status + " AND version >= " + Query::printArg( res.args.size() ) + " "
+                + "AND " + status + " AND o.version <= " + Query::printArg( res.args.size() ) + " "
                 + (versionsQuery ? " GROUP BY o.version " : " GROUP BY o.id " )
-                + ")";
+                + "))";
         } else {
         }
     } else {
@@ -983,15 +991,16 @@ void Filter::makeSQL( Query &res, const std::map<std::string,ArgumentVT> &args,
                 throw std::runtime_error( "Missing argument " + k );
             res.args.push_back( args.at( k ) );
             argsIndex[ k ] = Query::printArg( res.args.size() );
+            res.argumentIndex[ k ] = res.args.size() - 1;
         }
         for( const ArgumentVT& v : constants ) {
             res.args.push_back( v );
             constIndex[ v ] = Query::printArg( res.args.size() );
         }
         if (maxVersion) {
-            res.sqlQuery += "AND o.rowId IN (SELECT o.rowId, max(version) FROM Object AS o ";
+            res.sqlQuery += "AND o.rowId IN (SELECT rowId FROM (SELECT o.rowId AS rowId, MAX(o.version) FROM Object AS o ";
         } else {
-            res.sqlQuery += "AND o.rowId IN (SELECT o.rowId FROM Object AS o ";
+            res.sqlQuery += "AND o.rowId IN (SELECT o.rowId FROM " + Query::objectTable( maxVersion, versionsQuery ) + " AS o ";
         }
         for( const std::string& k : attributes ) {
             res.args.push_back( k );
@@ -1002,7 +1011,7 @@ void Filter::makeSQL( Query &res, const std::map<std::string,ArgumentVT> &args,
             res.args.push_back( std::to_string( maxVersion ) );
             res.sqlQuery += "WHERE o.accessDomain=" + Query::printArg( 1 )
                 + (versionsQuery ? " AND o.id=" : " AND o.parent=" ) + Query::printArg( 2 ) + " "
-                + "AND " + status + " AND version >= " + Query::printArg( res.args.size() ) + " ";
+                + "AND " + status + " AND o.version <= " + Query::printArg( res.args.size() ) + " ";
         } else {
             res.sqlQuery += "WHERE o.accessDomain=" + Query::printArg( 1 )
                 + (versionsQuery ? " AND o.id=" : " AND o.parent=" ) + Query::printArg( 2 ) + " "
@@ -1010,7 +1019,12 @@ void Filter::makeSQL( Query &res, const std::map<std::string,ArgumentVT> &args,
         }
         res.sqlQuery += "AND ";
         res.sqlQuery += expression.makeSQL( args, argsIndex, constIndex );
-        res.sqlQuery += (versionsQuery ? " GROUP BY o.version " : " GROUP BY o.id " );
+        // ObjectHead already holds one row per object, so there is nothing to group
+        if (maxVersion) {
+            res.sqlQuery += (versionsQuery ? " GROUP BY o.version)" : " GROUP BY o.id)" );
+        } else if (versionsQuery) {
+            res.sqlQuery += " GROUP BY o.version ";
+        }
         res.sqlQuery += ")";
     }
 }
@@ -1053,6 +1067,12 @@ void Sort::parse( const std::string& str ) {
     }
 }
 
+std::string Query::objectTable( int maxVersion, bool versionsQuery ) {
+    // Without a version limit only the latest version of each object is
+    // needed, and ObjectHead has exactly one row per object.
+    return maxVersion || versionsQuery ? "Object" : "ObjectHead";
+}
+
 std::string Query::printArg( int i ) {
     if (i >= 100)
         return "?" + std::to_string( i );
@@ -1061,12 +1081,39 @@ std::string Query::printArg( int i ) {
     return "?00" + std::to_string( i );
 }
 
-void Query::parseQuery( int accessDomain, long long parent, std::string selectStr, std::string filterStr, std::string sortStr, std::map<std::string,ArgumentVT> args, int maxVersion, bool includeDeleted ) {
+void Query::bindArguments( int accessDomain, long long parent, const std::map<std::string,ArgumentVT>& args ) {
+    this->args.at( 0 ) = std::to_string( accessDomain );
+    this->args.at( 1 ) = std::to_string( parent );
+    for ( const auto& argument : argumentIndex ) {
+        if ( !args.count( argument.first ) )
+            throw std::runtime_error( "Missing argument " + argument.first );
+        const ArgumentVT& arg = args.at( argument.first );
+        if ( arg.type() != this->args.at( argument.second ).type() )
+            throw std::runtime_error( "Wrong type of argument " + argument.first );
+        this->args.at( argument.second ) = arg;
+    }
+}
+
+void Query::bindPage( unsigned pageSize, const ArgumentVT& sortValue, unsigned long id ) {
+    if (!this->pageSize)
+        throw std::runtime_error( "Query is not paged" );
+    this->pageSize = pageSize;
+    // One more object than asked for tells if there is a next page
+    this->args.at( pageArgument ) = ArgumentVT( static_cast<double>( pageSize ) + 1 );
+    if (afterCursor) {
+        this->args.at( pageArgument - 2 ) = sortValue;
+        this->args.at( pageArgument - 1 ) = ArgumentVT( static_cast<double>( id ) );
+    }
+}
+
+void Query::parseQuery( int accessDomain, long long parent, std::string selectStr, std::string filterStr, std::string sortStr, std::map<std::string,ArgumentVT> args, int maxVersion, bool includeDeleted, unsigned pageSize, bool afterCursor ) {
     std::string status;
 
     select.parse( selectStr );
     filter.parse( filterStr );
     sort.parse( sortStr );
+    filterAttributes = filter.getAttributes();
+    this->maxVersion = maxVersion;
 
     if (maxVersion) {
         if (includeDeleted) {
@@ -1099,17 +1146,25 @@ void Query::parseQuery( int accessDomain, long long parent, std::string selectSt
             int argIndex = this->args.size();
 
             this->sqlQuery = "SELECT " + select.getFunctionName() + "( a.value ) AS value "
-                + "FROM Object AS o, Attribute AS a "
-                + "WHERE o.accessDomain=" + printArg( 1 ) + " AND o.parent=" + printArg( 2 ) + " AND " + status + " ";
+                + "FROM " + objectTable( maxVersion, false ) + " AS o, Attribute AS a "
+                + "WHERE o.accessDomain=" + printArg( 1 ) + " AND o.parent=" + printArg( 2 ) + " AND " + status + " "
                 + "AND a.accessDomain=o.accessDomain AND a.id=o.id AND a.version=o.version AND a.name=" + printArg( argIndex ) + " "
                 + "AND a.type=" + std::to_string( static_cast<int>( Type::Number ) ) + " ";
             filter.makeSQL( *this, args, maxVersion, status, false );
         } else {
             this->sqlQuery = "SELECT " + select.getFunctionName() + "( * ) AS value "
-                + "FROM Object AS o "
+                + "FROM " + objectTable( maxVersion, false ) + " AS o "
                 + "WHERE o.accessDomain=" + printArg( 1 ) + " AND o.parent=" + printArg( 2 ) + " AND " + status + " ";
             filter.makeSQL( *this, args, maxVersion, status, false );
         }
+        // The same objects, each with the value it adds to the function.
+        // Objects as of an older version are not followed.
+        if (!maxVersion) {
+            this->valuesSqlQuery = std::string( "SELECT o.id AS id, " )
+                + (select.getFunctionAttribute().size() > 0 ? "a.value" : "1") + " AS value "
+                + this->sqlQuery.substr( this->sqlQuery.find( "FROM " ) );
+            this->objectValueSqlQuery = this->valuesSqlQuery + " AND o.id=" + printArg( this->args.size() + 1 ) + " ";
+        }
     } else {
         std::string attributeNames = "";
 
@@ -1124,19 +1179,65 @@ void Query::parseQuery( int accessDomain, long long parent, std::string selectSt
         }
         if (!sort.getNone())
             this->args.push_back( sort.getAttribute() );
+        const int sortArg = this->args.size();
+        // Pages are ordered by what the cursor holds, the sort value and the
+        // id, since the version of an object changes when it is updated
+        const std::string orderBy{ sort.getNone()
+            ? std::string( pageSize ? "ORDER BY o.id " : "ORDER BY o.version, o.id " )
+            : std::string( "ORDER BY aSort.value " ) + (sort.getDesc() ? "DESC" : "")
+                + (pageSize ? ", o.id " : ", o.version, o.id ") };
         this->sqlQuery = std::string( "SELECT "
                 "o.accessDomain AS _accessDomain, o.id AS _id, o.version AS _version, o.status AS _status, o.parent AS _parent, o.parentAccessDomain AS _parentAccessDomain, o.transactionAction AS _transactionAction, "
                 "a.name AS name, a.type AS type, a.value AS value " )
-            + "FROM Object AS o, Attribute AS a "
-            + (sort.getNone() ? "" : std::string( "LEFT OUTER JOIN Attribute AS aSort ON o.accessDomain=a.accessDomain AND o.id=a.id AND o.version=a.version " )
-                + "AND a.name=" + printArg( this->args.size() ) + " ")
-            + "WHERE o.accessDomain=a.accessDomain AND o.id=a.id AND o.version=a.version " + attributeNames + " ";
+            // CROSS JOIN keeps the children of the parent as the outer loop, the
+            // access domain alone would otherwise be used to search Attribute
+            + "FROM " + objectTable( maxVersion, false ) + " AS o CROSS JOIN Attribute AS a "
+            + (sort.getNone() ? "" : std::string( "LEFT OUTER JOIN Attribute AS aSort ON o.accessDomain=aSort.accessDomain AND o.id=aSort.id AND o.version=aSort.version " )
+                + "AND aSort.name=" + printArg( this->args.size() ) + " ")
+            + "WHERE o.accessDomain=" + printArg( 1 ) + " AND o.parent=" + printArg( 2 ) + " AND " + status + " "
+            + "AND o.accessDomain=a.accessDomain AND o.id=a.id AND o.version=a.version " + attributeNames + " ";
+        const std::string::size_type filterStart{ this->sqlQuery.size() };
         filter.makeSQL( *this, args, maxVersion, status, false );
-        if (sort.getNone()) {
-            this->sqlQuery += "ORDER BY o.version, o.id ";
-        } else {
-            this->sqlQuery += std::string( "ORDER BY aSort.value " ) + (sort.getDesc() ? "DESC" : "") + ", o.version, o.id";
+        if (pageSize) {
+            // The page is picked by object in a subquery, each object spans
+            // one row per attribute above. Objects without any of the
+            // selected attributes are skipped so that they do not end a page.
+            const std::string filterSql{ this->sqlQuery.substr( filterStart ) };
+            std::string after{};
+            if (afterCursor) {
+                this->args.push_back( ArgumentVT( nullptr ) );
+                this->args.push_back( ArgumentVT( 0.0 ) );
+                // The sort value and id of the last object on the previous page
+                const std::string last{ printArg( this->args.size() - 1 ) };
+                const std::string id{ printArg( this->args.size() ) };
+                const std::string next{ "o.id > " + id };
+                if (sort.getNone()) {
+                    after = "AND " + next + " ";
+                } else {
+                    // NULL sorts first, and last when descending
+                    if (sort.getDesc()) {
+                        after = "AND ((" + last + " IS NULL AND aSort.value IS NULL AND " + next + ") "
+                            + "OR (" + last + " IS NOT NULL AND (aSort.value IS NULL OR aSort.value < " + last
+                            + " OR (aSort.value = " + last + " AND " + next + ")))) ";
+                    } else {
+                        after = "AND ((" + last + " IS NULL AND (aSort.value IS NOT NULL OR " + next + ")) "
+                            + "OR aSort.value > " + last + " OR (aSort.value = " + last + " AND " + next + ")) ";
+                    }
+                }
+            }
+            this->args.push_back( ArgumentVT( static_cast<double>( pageSize ) + 1 ) );
+            this->pageArgument = this->args.size() - 1;
+            this->pageSize = pageSize;
+            this->afterCursor = afterCursor;
+            this->sqlQuery += "AND o.rowId IN (SELECT o.rowId FROM " + objectTable( maxVersion, false ) + " AS o "
+                + (sort.getNone() ? "" : "LEFT OUTER JOIN Attribute AS aSort ON o.accessDomain=aSort.accessDomain AND o.id=aSort.id AND o.version=aSort.version "
+                    "AND aSort.name=" + printArg( sortArg ) + " ")
+                + "WHERE o.accessDomain=" + printArg( 1 ) + " AND o.parent=" + printArg( 2 ) + " AND " + status + " "
+                + "AND EXISTS (SELECT 1 FROM Attribute AS a WHERE a.accessDomain=o.accessDomain AND a.id=o.id AND a.version=o.version " + attributeNames + ") "
+                + filterSql + " " + after
+                + orderBy + "LIMIT " + printArg( this->args.size() ) + ") ";
         }
+        this->sqlQuery += orderBy;
     }
 }
 
@@ -1145,6 +1246,7 @@ void Query::parseVersionQuery( int accessDomain, long long parent, std::string s
 
     select.parse( selectStr );
     filter.parse( filterStr );
+    filterAttributes = filter.getAttributes();
 
     if (includeDeleted) {
         status = " o.status IN (" + std::to_string( (int )Mist::Database::ObjectStatus::Current )
@@ -1167,7 +1269,7 @@ void Query::parseVersionQuery( int accessDomain, long long parent, std::string s
 
             this->sqlQuery = "SELECT " + select.getFunctionName() + "( a.value ) AS value "
                 + "FROM Object AS o, Attribute AS a "
-                + "WHERE o.accessDomain=" + printArg( 1 ) + " AND o.id=" + printArg( 2 ) + " AND " + status + " ";
+                + "WHERE o.accessDomain=" + printArg( 1 ) + " AND o.id=" + printArg( 2 ) + " AND " + status + " "
                 + "AND a.accessDomain=o.accessDomain AND a.id=o.id AND a.version=o.version AND a.name=" + printArg( argIndex ) + " "
                 + "AND a.type=" + std::to_string( static_cast<int>( Type::Number ) ) + " ";
             filter.makeSQL( *this, args, 0, status, true );
@@ -17,10 +17,13 @@ RemoteTransaction::RemoteTransaction(
         Helper::Date timestamp,
         CryptoHelper::SHA3 userHash,
         CryptoHelper::SHA3 hash,
-        CryptoHelper::Signature signature) :
+        CryptoHelper::Signature signature,
+        Database::Connection* batchConnection ) :
                 db( db ),
-                connection{ nullptr == db ? nullptr : std::move( db->getIsolatedDbConnection() ) },
-                transaction( new Helper::Database::Transaction( *connection.get() ) ),
+                isolatedConnection{ nullptr == db || batchConnection ? nullptr : db->getIsolatedDbConnection() },
+                connection( batchConnection ? batchConnection : isolatedConnection.get() ),
+                transaction( batchConnection ? nullptr : new Helper::Database::Transaction( *connection ) ),
+                savePoint( batchConnection ? new Helper::Database::SavePoint( connection, "batchMember" ) : nullptr ),
                 accessDomain( accessDomain ),
                 version( version ),
                 parents( parents ),
@@ -52,25 +55,25 @@ void RemoteTransaction::init() {
     }
 
     // Insert transaction
-    Database::Statement insertTransaction( *connection.get(),
+    Database::CachedStatement insertTransaction( *connection,
             "INSERT INTO 'Transaction' (accessDomain, version, timestamp, userHash, hash, signature) "
             "VALUES (?, ?, ?, ?, ?, ?) " );
     insertTransaction <<
             static_cast<int>( accessDomain ) <<
             version <<
             timestamp.toString() <<
-            userHash.toString() <<
-            hash.toString() <<
-            signature.toString();
+            Database::toBlob( userHash ) <<
+            Database::toBlob( hash ) <<
+            Database::toBlob( signature );
     if ( 0 == insertTransaction.exec() ) {
         LOG( WARNING ) << "Could not insert transaction";
         throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
     }
 
     // Read back the meta info from the db
-    Database::Transaction meta{ db->getTransactionMeta( version, connection.get() ) };
+    Database::Transaction meta{ db->getTransactionMeta( version, connection ) };
     // Reorder the transaction to its correct place
-    version = db->reorderTransaction( meta, connection.get() );
+    version = db->reorderTransaction( meta, connection );
 
     // Check that we have all parents
     if ( !parents.empty() ) {
@@ -79,15 +82,19 @@ void RemoteTransaction::init() {
         // Should it be required in the constructor or done here?
         std::string q = "SELECT accessDomain, version, timestamp, userHash, hash, signature "
                 "FROM 'Transaction' "
-                "WHERE version < " + std::to_string( version ) + " AND hash IN ( ";
-        for ( auto parent : parents ) {
-            q += " '" + parent.hash.toString() + "',";
+                "WHERE version < ? AND hash IN ( ";
+        for ( std::size_t i = 0; i < parents.size(); ++i ) {
+            q += "?,";
         }
         q.pop_back();
         q += ")";
 
         std::vector<Database::Transaction> rows {};
-        Database::Statement query( *connection.get(), q );
+        Database::CachedStatement query( *connection, q );
+        query << version;
+        for ( const auto& parent : parents ) {
+            query << Database::toBlob( parent.hash );
+        }
         while ( query.executeStep() ) {
             rows.push_back( Database::statementRowToTransaction( query ) );
         }
@@ -102,7 +109,7 @@ void RemoteTransaction::init() {
     }
 
     // Insert transaction parents
-    Database::Statement insertTransactionParent( *connection.get(),
+    Database::CachedStatement insertTransactionParent( *connection,
             "INSERT INTO transactionParent (accessDomain, version, parentAccessDomain, parentVersion) "
             "VALUES (?, ?, ?, ?)");
     for ( auto parent : parents ) {
@@ -118,7 +125,7 @@ void RemoteTransaction::init() {
         insertTransactionParent.reset();
     }
 
-    Database::Statement queryMaxVersion( *connection.get(),
+    Database::CachedStatement queryMaxVersion( *connection,
             "SELECT MAX(version) AS max FROM 'Transaction'" );
     if ( !queryMaxVersion.executeStep() ) {
         // Most likely empty
@@ -131,6 +138,11 @@ void RemoteTransaction::init() {
 
     this->last = this->version >= maxVersion;
 
+    node.timestamp = timestamp.toString();
+    node.parents.clear();
+    for ( const Database::Transaction& parent : parents ) {
+        node.parents.push_back( parent.hash );
+    }
     parents.clear();
 }
 
@@ -146,7 +158,7 @@ void RemoteTransaction::newObject( unsigned long id, const Database::ObjectRef&
     }
 
     // Check that the same object id is NOT used multiple times in the same transaction.
-    Database::Statement queryId( *connection.get(),
+    Database::CachedStatement queryId( *connection,
             "SELECT id FROM Object "
             "WHERE accessDomain=? AND id=? AND version=?" );
     queryId <<
@@ -174,7 +186,7 @@ void RemoteTransaction::newObject( unsigned long id, const Database::ObjectRef&
     }
 
     // Insert the object
-    Database::Statement insertObject( *connection.get(),
+    Database::CachedStatement insertObject( *connection,
             "INSERT INTO Object (accessDomain, id, version, status, parent, parentAccessDomain, transactionAction) "
             "VALUES (?, ?, ?, ?, ?, ?, ?)" );
     insertObject <<
@@ -194,7 +206,7 @@ void RemoteTransaction::newObject( unsigned long id, const Database::ObjectRef&
     }
 
     // Insert the objects attributes
-    Database::Statement insertIntoAttribute( *connection.get(),
+    Database::CachedStatement insertIntoAttribute( *connection,
             "INSERT INTO Attribute (accessDomain, id, version, name, type, value) "
             "VALUES (?, ?, ?, ?, ?, ?)" );
     for ( auto const & kv : attributes ) {
@@ -263,7 +275,7 @@ void RemoteTransaction::moveObject( unsigned long id, Database::ObjectRef newPar
     }
     //*/
 
-    Database::Statement queryId( *connection.get(),
+    Database::CachedStatement queryId( *connection,
             "SELECT id FROM Object WHERE accessDomain=? AND id=? AND version=?" );
     queryId.bind( 1, (unsigned) accessDomain );
     queryId.bind( 2, (long long) id );
@@ -274,7 +286,7 @@ void RemoteTransaction::moveObject( unsigned long id, Database::ObjectRef newPar
         throw Mist::Exception( Mist::Error::ErrorCode::ObjectCollisionInTransaction );
     }
 
-    Database::Statement getOldParent( *connection.get(),
+    Database::CachedStatement getOldParent( *connection,
             "SELECT accessDomain, id, MAX(version) "
             "FROM Object "
             "WHERE id=( "
@@ -290,7 +302,7 @@ void RemoteTransaction::moveObject( unsigned long id, Database::ObjectRef newPar
         oldParent.id = static_cast<unsigned long>( getOldParent.getColumn( "id" ).getInt64() );
     }
 
-    Database::Statement queryInsertIntoObject( *connection.get(),
+    Database::CachedStatement queryInsertIntoObject( *connection,
             "INSERT INTO Object (accessDomain, id, version, status, parent, parentAccessDomain, transactionAction) "
             "VALUES (?, ?, ?, ?, ?, ?, ?)" );
     queryInsertIntoObject.bind( 1, (unsigned) accessDomain );
@@ -308,7 +320,7 @@ void RemoteTransaction::moveObject( unsigned long id, Database::ObjectRef newPar
         throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
     }
 
-    Database::Statement queryObject( *connection.get(),
+    Database::CachedStatement queryObject( *connection,
             "SELECT id, parent, parentAccessDomain, version, status, transactionAction "
             "FROM Object "
             "WHERE accessDomain=? AND id=? AND version=(SELECT MAX(version) "
@@ -320,7 +332,7 @@ void RemoteTransaction::moveObject( unsigned long id, Database::ObjectRef newPar
     queryObject.bind( 5, (unsigned) Database::ObjectStatus::OldDeletedParent );
     queryObject.bind( 6, version );
     if ( queryObject.executeStep() != 0 ) {
-        Database::Statement queryAttribute( *connection.get(),
+        Database::CachedStatement queryAttribute( *connection,
                 // TODO: wrong query?
                 "INSERT INTO Attribute (accessDomain, id, version, name, type, value) "
                 "SELECT accessDomain, id, ?, name, type, value "
@@ -371,7 +383,7 @@ void RemoteTransaction::updateObject( unsigned long id, std::map<std::string, Da
     }
     //*/
 
-    Database::Statement getParent( *connection.get(),
+    Database::CachedStatement getParent( *connection,
             "SELECT accessDomain, id, MAX(version) "
             "FROM Object "
             "WHERE id=( "
@@ -387,7 +399,7 @@ void RemoteTransaction::updateObject( unsigned long id, std::map<std::string, Da
         parent.id = static_cast<unsigned long>( getParent.getColumn( "id" ).getInt64() );
     }
 
-    Database::Statement queryId( *connection.get(),
+    Database::CachedStatement queryId( *connection,
             "SELECT id, transactionAction "
             "FROM Object "
             "WHERE accessDomain=? AND id=? AND version=?" );
@@ -396,7 +408,7 @@ void RemoteTransaction::updateObject( unsigned long id, std::map<std::string, Da
     queryId.bind( 3, version );
     if ( queryId.executeStep() ) {
         if ( ( (Database::ObjectAction) queryId.getColumn( "transactionAction" ).getUInt() ) == Database::ObjectAction::Move ) {
-            Database::Statement queryUpdateObject( *connection.get(),
+            Database::CachedStatement queryUpdateObject( *connection,
                     "UPDATE Object SET transactionAction=? "
                     "WHERE accessDomain=? AND id=? AND version=?" );
             queryUpdateObject <<
@@ -412,7 +424,7 @@ void RemoteTransaction::updateObject( unsigned long id, std::map<std::string, Da
             }
 
             // TODO: Do we really want to delete something here?
-            Database::Statement quertDeleteAttribute( *connection.get(),
+            Database::CachedStatement quertDeleteAttribute( *connection,
                     "DELETE FROM Attribute WHERE accessDomain=? AND id=? AND version=?" );
             quertDeleteAttribute.bind( 1, (unsigned) accessDomain );
             quertDeleteAttribute.bind( 2, (long long) id );
@@ -429,7 +441,7 @@ void RemoteTransaction::updateObject( unsigned long id, std::map<std::string, Da
             throw Mist::Exception( Mist::Error::ErrorCode::ObjectCollisionInTransaction );
         }
     } else {
-        Database::Statement queryObject( *connection.get(),
+        Database::CachedStatement queryObject( *connection,
                 "SELECT id, parent, parentAccessDomain, version, status, transactionAction "
                 "FROM Object "
                 "WHERE accessDomain=? AND id=? AND version=(SELECT MAX(version) "
@@ -442,7 +454,7 @@ void RemoteTransaction::updateObject( unsigned long id, std::map<std::string, Da
         queryObject.bind( 6, version );
         if ( !queryObject.executeStep() ) {
             // TODO: Not found??? verify this.
-            Database::Statement queryInsertIntoObject( *connection.get(),
+            Database::CachedStatement queryInsertIntoObject( *connection,
                     "INSERT INTO Object (accessDomain, id, parent, parentAccessDomain, version, status, transactionAction) "
                     "VALUES (?, ?, ?, ?, ?, ?, ?)" );
             queryInsertIntoObject.bind( 1, (unsigned) accessDomain );
@@ -461,9 +473,11 @@ void RemoteTransaction::updateObject( unsigned long id, std::map<std::string, Da
                 throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
             }
         } else {
-            Database::Statement queryInsertIntoObject( *connection.get(),
+            // The update takes the status of the version it follows. That
+            // version is old now, unless a later version already replaced it.
+            Database::CachedStatement queryInsertIntoObject( *connection,
                     "INSERT INTO Object (accessDomain, id, parent, parentAccessDomain, version, status, transactionAction) "
-                    "SELECT accessDomain, id, parent, parentAccessDomain, ?, NULL, ? "
+                    "SELECT accessDomain, id, parent, parentAccessDomain, ?, status, ? "
                     "FROM Object "
                     "WHERE accessDomain=? AND id=? AND version=?" );
             queryInsertIntoObject.bind( 1, version );
@@ -478,10 +492,20 @@ void RemoteTransaction::updateObject( unsigned long id, std::map<std::string, Da
                 throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
             }
 
+            // Each old status is the current one offset by Old
+            Database::CachedStatement queryMakeOld( *connection,
+                    "UPDATE Object SET status=status+? "
+                    "WHERE accessDomain=? AND id=? AND version=? AND status < ?" );
+            queryMakeOld.bind( 1, (unsigned) Database::ObjectStatus::Old - (unsigned) Database::ObjectStatus::Current );
+            queryMakeOld.bind( 2, (unsigned) accessDomain );
+            queryMakeOld.bind( 3, (long long) id );
+            queryMakeOld.bind( 4, queryObject.getColumn( "version" ).getUInt() );
+            queryMakeOld.bind( 5, (unsigned) Database::ObjectStatus::Old );
+            queryMakeOld.exec();
         }
     }
 
-    Database::Statement insertIntoAttribute( *connection.get(),
+    Database::CachedStatement insertIntoAttribute( *connection,
             "INSERT INTO Attribute (accessDomain, id, version, name, type, value) "
             "VALUES (?, ?, ?, ?, ?, ?)" );
     for ( auto const & kv : attributes ) {
@@ -544,7 +568,7 @@ void RemoteTransaction::deleteObject( unsigned long id ) {
         id = reObj->second;
     }
 
-    Database::Statement getParent( *connection.get(),
+    Database::CachedStatement getParent( *connection,
             "SELECT accessDomain, id "
             "FROM Object "
             "WHERE id=( "
@@ -561,7 +585,7 @@ void RemoteTransaction::deleteObject( unsigned long id ) {
         parent.id = static_cast<unsigned long>( getParent.getColumn( "id" ).getInt64() );
     }
 
-    Database::Statement queryId( *connection.get(),
+    Database::CachedStatement queryId( *connection,
             "SELECT id, transactionAction "
             "FROM Object WHERE accessDomain=? AND id=? AND version=?" );
     queryId.bind( 1, (unsigned) accessDomain );
@@ -573,7 +597,7 @@ void RemoteTransaction::deleteObject( unsigned long id ) {
         throw Mist::Exception( Mist::Error::ErrorCode::ObjectCollisionInTransaction );
     }
 
-    Database::Statement queryObject( *connection.get(),
+    Database::CachedStatement queryObject( *connection,
             "SELECT id, parent, parentAccessDomain, version, status, transactionAction "
             "FROM Object "
             "WHERE accessDomain=? AND id=? AND version=(SELECT version "
@@ -586,7 +610,7 @@ void RemoteTransaction::deleteObject( unsigned long id ) {
     queryObject.bind( 6, version );
     if ( queryObject.executeStep() == 0 ) {
         // TODO: Not found???
-        Database::Statement queryInsertIntoObject( *connection.get(),
+        Database::CachedStatement queryInsertIntoObject( *connection,
                 "INSERT INTO Object (accessDomain, id, parent, parentAccessDomain, version, status, transactionAction) "
                 "VALUES (?, ?, ?, ?, ?, ?, ?)" );
         queryInsertIntoObject.bind( 1, (unsigned) accessDomain );
@@ -605,7 +629,7 @@ void RemoteTransaction::deleteObject( unsigned long id ) {
             throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
         }
     } else {
-        Database::Statement queryInsertIntoObject( *connection.get(),
+        Database::CachedStatement queryInsertIntoObject( *connection,
                 // TODO: wrong query?
                 "INSERT INTO Object (accessDomain, id, parent, parentAccessDomain, version, status, transactionAction) "
                 "SELECT accessDomain, id, parent, parentAccessDomain, ?, NULL, ? "
@@ -632,6 +656,17 @@ void RemoteTransaction::deleteObject( unsigned long id ) {
 }
 
 void RemoteTransaction::commit() {
+    if ( !valid ) {
+        LOG( WARNING ) << "Invalid transaction";
+        throw Mist::Exception( Mist::Error::ErrorCode::InvalidTransaction );
+    }
+
+    // Read the body back from the db to hash it
+    Database::Transaction meta{ db->getTransactionMeta( version, connection ) };
+    commit( db->calculateTransactionHash( meta, connection ) );
+}
+
+void RemoteTransaction::commit( const CryptoHelper::SHA3& bodyHash ) {
     if ( !valid ) { // TODO: atomic test and set to make threading secure?
         LOG( WARNING ) << "Invalid transaction";
         throw Mist::Exception( Mist::Error::ErrorCode::InvalidTransaction );
@@ -640,7 +675,7 @@ void RemoteTransaction::commit() {
     LOG( DBUG ) << "Commit";
 
     // Check for collisions
-    Database::Statement object( *connection.get(),
+    Database::CachedStatement object( *connection,
             "SELECT accessDomain, id, version, status, parent, parentAccessDomain, transactionAction "
             "FROM Object "
             "WHERE version=? "
@@ -660,17 +695,28 @@ void RemoteTransaction::commit() {
     }
 
     // Check and verify transaction hash value
-    Database::Transaction meta{ db->getTransactionMeta( version, connection.get() ) };
-    if ( !( hash == db->calculateTransactionHash( meta, connection.get() ) ) ) {
+    if ( !( hash == bodyHash ) ) {
         rollback();
         LOG( WARNING ) << "Transaction hash value is not a match";
         throw Mist::Exception( Mist::Error::ErrorCode::InvalidTransaction );
     }
 
+    db->updateObjectHeads( version, connection );
+
+    if ( savePoint ) {
+        savePoint->save();
+        savePoint.reset();
+        db->commit( this );
+        LOG( DBUG ) << "Transaction added to batch.";
+        db->batchCommitted( affectedObjects, hash, std::move( node ) );
+        return;
+    }
+
     // TODO: some sort of lock here,
     // to prevent changes to the database before "objectChanged" has finished
     transaction->commit();
     db->commit( this );
+    db->addToGraph( { std::make_pair( hash, std::move( node ) ) } );
     LOG( DBUG ) << "Transaction commited.";
 
     db->objectsChanged( affectedObjects );
@@ -678,6 +724,12 @@ void RemoteTransaction::commit() {
 }
 
 void RemoteTransaction::rollback() {
+    if ( savePoint ) {
+        // Undo this transaction only, and leave the rest of the batch
+        savePoint->rollback();
+        savePoint->save();
+        savePoint.reset();
+    }
     transaction.reset();
     db->rollback( this );
     valid = false;
@@ -694,7 +746,7 @@ void RemoteTransaction::checkNew( Database::ObjectMeta& object ) {
     }
 
     // Check if we have a collision
-    Database::Statement isColliding( *connection.get(),
+    Database::CachedStatement isColliding( *connection,
             "SELECT version "
             "FROM Object "
             "WHERE accessDomain=? AND id=? AND version < ? " );
@@ -710,7 +762,7 @@ void RemoteTransaction::checkNew( Database::ObjectMeta& object ) {
          */
 
         std::unique_ptr<Helper::Database::SavePoint> savePoint{
-            new Helper::Database::SavePoint( connection.get(), "renumber" ) };
+            new Helper::Database::SavePoint( connection, "renumber" ) };
 
         // TODO Check Version In Transaction History ???
 
@@ -720,7 +772,7 @@ void RemoteTransaction::checkNew( Database::ObjectMeta& object ) {
         oRef.id = object.id;
 
         // Update the object id
-        Database::Statement updateObject( *connection.get(),
+        Database::CachedStatement updateObject( *connection,
                 "UPDATE Object "
                 "SET id=? "
                 "WHERE accessDomain=? AND id=? AND version=? ");
@@ -731,7 +783,7 @@ void RemoteTransaction::checkNew( Database::ObjectMeta& object ) {
                 version;
         updateObject.exec();
 
-        Database::Statement updateAttributes( *connection.get(),
+        Database::CachedStatement updateAttributes( *connection,
                 "UPDATE Attribute "
                 "SET id=? "
                 "WHERE accessDomain=? AND id=? AND version=? ");
@@ -746,7 +798,7 @@ void RemoteTransaction::checkNew( Database::ObjectMeta& object ) {
         object.id = newId;
 
         // Map the old id to the new id
-        Database::Statement insertRenumber(  *connection.get(),
+        Database::CachedStatement insertRenumber(  *connection,
                 "INSERT INTO Renumber (accessDomain, version, oldId, newId) "
                 "VALUES (?, ?, ?, ?) " );
         insertRenumber <<
@@ -774,6 +826,10 @@ void RemoteTransaction::checkNew( Database::ObjectMeta&& object ) {
 
 Database::ObjectStatus RemoteTransaction::getParentStatus( const Database::ObjectMeta& object ) const {
     using Status = Database::ObjectStatus;
+    if ( Database::ROOT_OBJECT_ID == object.parent.id ) {
+        // The root has no row of its own
+        return Status::Current;
+    }
     std::string parentQuery{};
     if ( last ) {
         parentQuery =
@@ -790,7 +846,7 @@ Database::ObjectStatus RemoteTransaction::getParentStatus( const Database::Objec
                     "FROM Object "
                     "WHERE accessDomain=? AND id=? AND version <= ? AND status < ? ) ";
     }
-    Database::Statement parentRow( *connection.get(), parentQuery );
+    Database::CachedStatement parentRow( *connection, parentQuery );
     if ( last ) {
         parentRow <<
                 static_cast<unsigned>( object.parent.accessDomain ) <<
@@ -858,7 +914,7 @@ unsigned long RemoteTransaction::nextNumber( unsigned long num ) const {
 
 unsigned long RemoteTransaction::findNewId( unsigned long id ) const {
     unsigned long newId{ nextNumber( id ) };
-    Database::Statement alreadyExist( *connection.get(),
+    Database::CachedStatement alreadyExist( *connection,
             "SELECT id "
             "FROM Object "
             "WHERE accessDomain=? AND id=? AND version <= ? ");
@@ -873,7 +929,7 @@ unsigned long RemoteTransaction::findNewId( unsigned long id ) const {
 }
 
 Database::ObjectRef RemoteTransaction::getParent( unsigned long id ) const {
-    Database::Statement getParent( *connection.get(),
+    Database::CachedStatement getParent( *connection,
             "SELECT accessDomain, id "
             "FROM Object "
             "WHERE id=( "
@@ -895,7 +951,7 @@ Database::ObjectRef RemoteTransaction::getParent( unsigned long id ) const {
 }
 
 bool RemoteTransaction::objectExists( unsigned long id ) const {
-    Database::Statement queryId( *connection.get(),
+    Database::CachedStatement queryId( *connection,
             "SELECT id FROM Object "
             "WHERE accessDomain=? AND id=? AND version=?" );
     queryId <<
@@ -909,7 +965,7 @@ bool RemoteTransaction::objectExists( unsigned long id ) const {
 }
 
 bool RemoteTransaction::olderVersionOfObjectExists( unsigned long id ) const {
-    Database::Statement queryId( *connection.get(),
+    Database::CachedStatement queryId( *connection,
             "SELECT id FROM Object "
             "WHERE accessDomain=? AND id=? AND version < ?" );
     queryId <<
@@ -924,7 +980,7 @@ bool RemoteTransaction::olderVersionOfObjectExists( unsigned long id ) const {
 
 void RemoteTransaction::insertObject( unsigned long id, unsigned status,
         unsigned long parentId, unsigned parentAccessDomain, unsigned action ) {
-    Database::Statement insertObject( *connection.get(),
+    Database::CachedStatement insertObject( *connection,
             "INSERT INTO Object (accessDomain, id, parent, parentAccessDomain, version, status, transactionAction) "
             "VALUES (?, ?, ?, ?, ?, ?, ?)" );
     insertObject <<
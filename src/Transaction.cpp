@@ -39,10 +39,13 @@ Database::ObjectStatus convertStatusToOld( Database::ObjectStatus objectStatus )
 
 }
 
-Transaction::Transaction( Database *db, Database::AccessDomain accessDomain, unsigned version ) :
+Transaction::Transaction( Database *db, Database::AccessDomain accessDomain, unsigned version,
+        Database::Connection* groupConnection ) :
         db( db ),
-        connection( std::move( db->getIsolatedDbConnection() ) ),
-        transaction( new Helper::Database::Transaction( *connection.get() ) ),
+        isolatedConnection( groupConnection ? nullptr : db->getIsolatedDbConnection() ),
+        connection( groupConnection ? groupConnection : isolatedConnection.get() ),
+        transaction( groupConnection ? nullptr : new Helper::Database::Transaction( *connection ) ),
+        savePoint( groupConnection ? new Helper::Database::SavePoint( connection, "groupMember" ) : nullptr ),
         accessDomain( accessDomain ),
         version( version ),
         parentAccessDomains{},
@@ -74,7 +77,7 @@ unsigned long Transaction::allocateObjectId() {
 
     // TODO: error handling of query call, either here or in the Database.
     //Database::Statement query = db->query( "SELECT id FROM Object WHERE id=? AND accessDomain=?" );
-    Database::Statement query( *connection.get(), "SELECT id FROM Object WHERE id=? AND accessDomain=?" );
+    Database::CachedStatement query( *connection, "SELECT id FROM Object WHERE id=? AND accessDomain=?" );
     query.bind( 1, (long long) newId ); // TODO: verify correct behavior.
     query.bind( 2, (unsigned int) accessDomain ); // TODO: verify correct behavior.
     if ( query.executeStep() > 0 ) {
@@ -110,7 +113,7 @@ unsigned long Transaction::newObject( const Database::ObjectRef &parent, const s
         // TODO: verify user permission?
     } else if ( parent.id != Database::ROOT_OBJECT_ID ) {
         // TODO: handle query exceptions.
-        Database::Statement query( *connection.get(),
+        Database::CachedStatement query( *connection,
                 "SELECT accessDomain, id, version, transactionAction "
                 "FROM Object "
                 "WHERE accessDomain=? AND id=? AND status=? " );
@@ -131,7 +134,7 @@ unsigned long Transaction::newObject( const Database::ObjectRef &parent, const s
 
     unsigned long newId{ allocateObjectId() }; // TODO: what happens if this id is generated somewhere else but it has not arrived here yet?
     LOG ( DBUG ) << "New object id: " << newId;
-    Database::Statement query( *connection.get(),
+    Database::CachedStatement query( *connection,
             "INSERT INTO Object (accessDomain, id, version, status, parent, parentAccessDomain, transactionAction) "
             "VALUES (?, ?, ?, ?, ?, ?, ?)" );
     query << static_cast<int>( accessDomain )
@@ -147,7 +150,7 @@ unsigned long Transaction::newObject( const Database::ObjectRef &parent, const s
         throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
     }
 
-    Database::Statement insertAttribute( *connection.get(),
+    Database::CachedStatement insertAttribute( *connection,
             "INSERT INTO Attribute (accessDomain, id, version, name, type, value) "
             "VALUES (?, ?, ?, ?, ?, ?) " );
     for ( auto const & kv : attributes ) {
@@ -223,7 +226,7 @@ void Transaction::moveObject( unsigned long id, const Database::ObjectRef &newPa
 
     // TODO: Refactor to be more similar to updateObject by creating an Database::Object
 
-    Mist::Database::Statement query( *connection.get(),
+    Mist::Database::CachedStatement query( *connection,
             "SELECT id, parent, parentAccessDomain, version, status, transactionAction "
             "FROM Object "
             "WHERE accessDomain=? AND id=? AND status <= ? " );
@@ -245,7 +248,7 @@ void Transaction::moveObject( unsigned long id, const Database::ObjectRef &newPa
     }
 
     // Needs to be in this scope since it's used further down at the moment.
-    Mist::Database::Statement parentQuery( *connection.get(),
+    Mist::Database::CachedStatement parentQuery( *connection,
             "SELECT accessDomain, id, version, parent, parentAccessDomain "
             "FROM Object "
             "WHERE accessDomain=? AND id=? AND status=?" );
@@ -270,7 +273,7 @@ void Transaction::moveObject( unsigned long id, const Database::ObjectRef &newPa
     }
 
     if ( query.getColumn( "version" ).getUInt() != version ) {
-        Database::Statement updateObj( *connection.get(),
+        Database::CachedStatement updateObj( *connection,
                 "UPDATE Object SET status=? WHERE accessDomain=? AND id=? AND version=?" );
         updateObj <<
                 (int) convertStatusToOld( { (Database::ObjectStatus) query.getColumn( "status" ).getUInt() } ) <<
@@ -283,7 +286,7 @@ void Transaction::moveObject( unsigned long id, const Database::ObjectRef &newPa
             throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
         }
 
-        Database::Statement insertObj( *connection.get(),
+        Database::CachedStatement insertObj( *connection,
                 "INSERT INTO Object (accessDomain, id, version, status, parentAccessDomain, parent, transactionAction) "
                 "VALUES (?, ?, ?, ?, ?, ?, ?)" );
         insertObj <<
@@ -300,7 +303,7 @@ void Transaction::moveObject( unsigned long id, const Database::ObjectRef &newPa
             throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
         }
 
-        Database::Statement insertAttr( *connection.get(),
+        Database::CachedStatement insertAttr( *connection,
                 "INSERT INTO Attribute (accessDomain, id, version, name, type, value) "
                 "SELECT accessDomain, id, ?, name, type, value "
                 "FROM Attribute "
@@ -322,7 +325,7 @@ void Transaction::moveObject( unsigned long id, const Database::ObjectRef &newPa
          *     Update -> Update parent and make into MoveUpdate
          *     Delete -> Update parent and make into Move, copy attributes from last version
          */
-        Database::Statement updateObj( *connection.get(),
+        Database::CachedStatement updateObj( *connection,
                 "UPDATE Object SET transactionAction=?, status=?, parentAccessDomain=?, parent=? "
                 "WHERE accessDomain=? AND id=? AND version=?" );
         updateObj <<
@@ -346,7 +349,7 @@ void Transaction::moveObject( unsigned long id, const Database::ObjectRef &newPa
         if ( ( (Database::ObjectAction) query.getColumn( "transactionAction" ).getUInt() ) == Database::ObjectAction::Delete ) {
             // TODO: return?
         } else {
-            Database::Statement insertAttr( *connection.get(),
+            Database::CachedStatement insertAttr( *connection,
                     "INSERT INTO Attribute (accessDomain, id, version, name, type, value ) "
                     "SELECT accessDomain, id, ?, name, type, value "
                     "FROM Attribute "
@@ -397,7 +400,7 @@ void Transaction::updateObject( unsigned long id, const std::map<std::string, Da
     }
     // TODO: accessDomain check?
 
-    Database::Statement query( *connection.get(),
+    Database::CachedStatement query( *connection,
             "SELECT id, version, transactionAction, parent, parentAccessDomain "
             "FROM Object "
             "WHERE accessDomain=? AND id=? AND status < ? " );
@@ -422,7 +425,7 @@ void Transaction::updateObject( unsigned long id, const std::map<std::string, Da
 
     if ( obj.parent.id != Database::ROOT_OBJECT_ID ) {
         obj.status = Database::ObjectStatus::Current;
-        Database::Statement parentQuery( *connection.get(),
+        Database::CachedStatement parentQuery( *connection,
                 "SELECT id, version, transactionAction "
                 "FROM Object "
                 "WHERE accessDomain=? AND id=? AND status=?" );
@@ -438,7 +441,7 @@ void Transaction::updateObject( unsigned long id, const std::map<std::string, Da
     }
 
     if ( obj.version != version ) {
-        Database::Statement updateObj( *connection.get(),
+        Database::CachedStatement updateObj( *connection,
                 "UPDATE Object SET status=? WHERE accessDomain=? AND id=? AND version=?" );
         updateObj <<
                 (int) convertStatusToOld( obj.status ) <<
@@ -453,7 +456,7 @@ void Transaction::updateObject( unsigned long id, const std::map<std::string, Da
         obj.status = Database::ObjectStatus::Current;
         obj.action = Database::ObjectAction::Update;
 
-        Database::Statement insertObj( *connection.get(),
+        Database::CachedStatement insertObj( *connection,
                 "INSERT INTO Object (accessDomain, id, version, status, parent, parentAccessDomain, transactionAction) "
                 "VALUES (?, ?, ?, ?, ?, ?, ?)" );
         insertObj <<
@@ -476,7 +479,7 @@ void Transaction::updateObject( unsigned long id, const std::map<std::string, Da
          *     Move -> Update attributes and make into UpdateMove
          *     Delete -> Replace with Update
          */
-        Database::Statement deleteAttr( *connection.get(),
+        Database::CachedStatement deleteAttr( *connection,
                 "DELETE FROM Attribute WHERE accessDomain=? AND id=? AND version=?" );
         deleteAttr <<
                 (int) obj.accessDomain <<
@@ -490,7 +493,7 @@ void Transaction::updateObject( unsigned long id, const std::map<std::string, Da
 
         if ( obj.action == Database::ObjectAction::Move ) {
             obj.action = Database::ObjectAction::MoveUpdate;
-            Database::Statement updateObj( *connection.get(),
+            Database::CachedStatement updateObj( *connection,
                     "UPDATE Object SET transactionAction=? WHERE accessDomain=? AND id=? AND version=?" );
             updateObj <<
                     (int) obj.action <<
@@ -506,7 +509,7 @@ void Transaction::updateObject( unsigned long id, const std::map<std::string, Da
             obj.action = Database::ObjectAction::Update;
             obj.status = Database::ObjectStatus::Current;
 
-            Database::Statement updateObj( *connection.get(),
+            Database::CachedStatement updateObj( *connection,
                     "UPDATE Object SET transactionAction=?, status=? WHERE accessDomain=? AND id=? AND version=?" );
             updateObj <<
                     (int) obj.action <<
@@ -522,7 +525,7 @@ void Transaction::updateObject( unsigned long id, const std::map<std::string, Da
         }
     }
 
-    Database::Statement insertIntoAttribute( *connection.get(),
+    Database::CachedStatement insertIntoAttribute( *connection,
             "INSERT INTO Attribute (accessDomain, id, version, name, type, value) "
             "VALUES (?, ?, ?, ?, ?, ?)" );
     for ( auto const & kv : attributes ) {
@@ -587,7 +590,7 @@ void Transaction::deleteObject( unsigned long id ) {
     }
     // TODO: accessDomain check?
 
-    Database::Statement query( *connection.get(),
+    Database::CachedStatement query( *connection,
             "SELECT id, version, transactionAction, parent, parentAccessDomain "
             "FROM Object "
             "WHERE accessDomain=? AND id=? AND status < ?" );
@@ -607,7 +610,7 @@ void Transaction::deleteObject( unsigned long id ) {
         return;
     }
 
-    Database::Statement queryChild( *connection.get(),
+    Database::CachedStatement queryChild( *connection,
             "SELECT COUNT(id) AS count "
             "FROM Object "
             "WHERE accessDomain=? AND parentAccessDomain=? AND parent=? AND status=?" );
@@ -629,7 +632,7 @@ void Transaction::deleteObject( unsigned long id ) {
     }
 
     if ( obj.version != version ) {
-        Database::Statement updateObj( *connection.get(),
+        Database::CachedStatement updateObj( *connection,
                 "UPDATE Object SET status=? WHERE accessDomain=? AND id=? AND version=? " );
         updateObj <<
                 (int) convertStatusToOld( obj.status ) <<
@@ -642,7 +645,7 @@ void Transaction::deleteObject( unsigned long id ) {
             throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
         }
 
-        Database::Statement insertIntoObj( *connection.get(),
+        Database::CachedStatement insertIntoObj( *connection,
                 "INSERT INTO Object (accessDomain, id, version, status, transactionAction) "
                 "VALUES (?, ?, ?, ?, ?)" );
         insertIntoObj <<
@@ -663,7 +666,7 @@ void Transaction::deleteObject( unsigned long id ) {
          *     Update -> Remove attributes, make into Delete
          *     Move, MoveUpdate -> Restore parent, remove attributes, make into Delete
          */
-        Database::Statement deleteAttr( *connection.get(),
+        Database::CachedStatement deleteAttr( *connection,
                 "DELETE FROM Attribute WHERE accessDomain=? AND id=? AND version=?" );
         deleteAttr <<
                 (int) obj.accessDomain <<
@@ -676,7 +679,7 @@ void Transaction::deleteObject( unsigned long id ) {
         }
 
         if ( obj.action == Database::ObjectAction::New ) {
-            Database::Statement deleteObj( *connection.get(),
+            Database::CachedStatement deleteObj( *connection,
                     "DELETE FROM Object WHERE accessDomain=? AND id=? AND version=?" );
             deleteObj <<
                     (int) obj.accessDomain <<
@@ -687,9 +690,17 @@ void Transaction::deleteObject( unsigned long id ) {
                 valid = false;
                 throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
             }
+            // A read in this transaction may have made it a head already
+            Database::CachedStatement deleteHead( *connection,
+                    "DELETE FROM ObjectHead WHERE accessDomain=? AND id=? AND version=?" );
+            deleteHead <<
+                    (int) obj.accessDomain <<
+                    (long long) obj.id <<
+                    version;
+            deleteHead.exec();
         } else if ( obj.action == Database::ObjectAction::Move ||
                 obj.action == Database::ObjectAction::MoveUpdate ) {
-            Database::Statement queryParent( *connection.get(),
+            Database::CachedStatement queryParent( *connection,
                     "SELECT parentAccessDomain, parent "
                     "FROM Object "
                     "WHERE accessDomain=? AND id=? AND version=( "
@@ -709,7 +720,7 @@ void Transaction::deleteObject( unsigned long id ) {
                 throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
             }
 
-            Database::Statement updateObj( *connection.get(),
+            Database::CachedStatement updateObj( *connection,
                     "UPDATE Object SET status=?, transactionAction=?, parentAccessDomain=?, parent=? "
                     "WHERE accessDomain=? AND id=? AND version=? " );
             updateObj <<
@@ -726,7 +737,7 @@ void Transaction::deleteObject( unsigned long id ) {
                 throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
             }
         } else { // Database::ObjectAction::.Update
-            Database::Statement updateObj( *connection.get(),
+            Database::CachedStatement updateObj( *connection,
                     "UPDATE Object SET status=?, transactionAction=? "
                     "WHERE accessDomain=? AND id=? AND version=?" );
             updateObj <<
@@ -757,12 +768,13 @@ void Transaction::commit() {
     valid = false;
     LOG( DBUG ) << "Commit";
 
-    Database::Statement insertTransaction( *connection.get(),
+    Database::CachedStatement insertTransaction( *connection,
             "INSERT INTO 'Transaction' (accessDomain, version, timestamp, userHash, hash, signature) "
             "VALUES (?, ?, STRFTIME('%Y-%m-%d %H:%M:%f','now'), ?, NULL, NULL)" );
     // TODO: Wait here if it is less than a millisecond since the last local commit.
     try {
-        insertTransaction << static_cast<int>( accessDomain ) << version << db->getUserHash();
+        insertTransaction << static_cast<int>( accessDomain ) << version
+                << Database::toBlob( CryptoHelper::SHA3::fromString( db->getUserHash() ) );
         if ( insertTransaction.exec() == 0 ) {
             LOG( WARNING ) << "Unexpected Database Error";
             throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
@@ -772,7 +784,7 @@ void Transaction::commit() {
         throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
     }
 
-    Database::Statement selectParents( *connection.get(),
+    Database::CachedStatement selectParents( *connection,
             "SELECT t.accessDomain AS accessDomain, t.version AS version, timestamp, userHash, hash, signature "
             "FROM 'Transaction' AS t "
             "LEFT OUTER JOIN TransactionParent tp "
@@ -782,12 +794,14 @@ void Transaction::commit() {
     // link the transaction with other access domains if this transaction creates or moves objects
     // so they get a parent from the other access domain
 
-    Database::Statement insertTransactionParent( *connection.get(),
+    Database::CachedStatement insertTransactionParent( *connection,
             "INSERT INTO TransactionParent (accessDomain, version, parentAccessDomain, parentVersion) "
                     "VALUES (?, ?, ?, ?)" );
+    Database::GraphNode node{};
     try {
         selectParents << version; // << static_cast<int>( accessDomain );
         while ( selectParents.executeStep() ) {
+            node.parents.push_back( Database::columnToHash( selectParents.getColumn( "hash" ) ) );
             insertTransactionParent << static_cast<int>( accessDomain )
                     << version
                     << selectParents.getColumn( "accessDomain" ).getUInt()
@@ -806,16 +820,17 @@ void Transaction::commit() {
 
     Database::Transaction thisMeta;
     try {
-        thisMeta = db->getTransactionMeta( version, connection.get() );
+        thisMeta = db->getTransactionMeta( version, connection );
     } catch (...) {
         LOG( WARNING ) << "Database Error: failed to get transaction meta data.";
         throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
     }
+    node.timestamp = thisMeta.date.toString();
 
     // Calculate the transaction hash
     CryptoHelper::SHA3 hash;
     try {
-        hash = db->calculateTransactionHash( thisMeta, connection.get() );
+        hash = db->calculateTransactionHash( thisMeta, connection );
         LOG( DBUG ) << "Meta: version: " << thisMeta.version << " hash: " << thisMeta.hash.toString();
         LOG( DBUG ) << "New Hash: " << hash.toString();
     } catch ( const std::runtime_error& e ) {
@@ -833,12 +848,12 @@ void Transaction::commit() {
     }
 
     // Update the database with the this users hash, transaction hash and signature
-    Database::Statement updateTransaction( *connection.get(),
+    Database::CachedStatement updateTransaction( *connection,
             "UPDATE 'Transaction' "
             "SET hash=?, signature=? "
             "WHERE version=?" );
     try {
-        updateTransaction << hash.toString() << signature.toString() << version;
+        updateTransaction << Database::toBlob( hash ) << Database::toBlob( signature ) << version;
         if ( updateTransaction.exec() == 0 ) {
             // 0 rows affected
             // TODO: handle this.
@@ -853,12 +868,34 @@ void Transaction::commit() {
     //*/
 
     /*    try {
-        version = db->reorderTransaction( thisMeta, connection.get() );
+        version = db->reorderTransaction( thisMeta, connection );
     } catch (...) {
         LOG( WARNING ) << "Reordering failed.";
         throw;
 	}*/
 
+    try {
+        db->updateObjectHeads( version, connection );
+    } catch (...) {
+        LOG( WARNING ) << "Unexpected Database Error";
+        throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
+    }
+
+    if ( savePoint ) {
+        // Written and notified together with the rest of the group
+        try {
+            savePoint->save();
+        } catch (...) {
+            LOG( WARNING ) << "Commit failed.";
+            throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
+        }
+        savePoint.reset();
+        db->commit( this );
+        LOG( DBUG ) << "Transaction added to group commit.";
+        db->endGroupTransaction( affectedObjects, true, hash, std::move( node ) );
+        return;
+    }
+
     // TODO: some sort of lock here,
     // to prevent changes to the database before "objectChanged" has finished
     try {
@@ -868,6 +905,8 @@ void Transaction::commit() {
         throw Mist::Exception( Mist::Error::ErrorCode::UnexpectedDatabaseError );
     }
     db->commit( this );
+    db->addToGraph( { std::make_pair( hash, std::move( node ) ) } );
+    db->announceTransactions( { hash } );
     LOG( DBUG ) << "Transaction commited.";
 
     db->objectsChanged( affectedObjects );
@@ -877,26 +916,47 @@ void Transaction::commit() {
 void Transaction::rollback() {
     valid = false;
     LOG( DBUG ) << "Rollback";
+    if ( savePoint ) {
+        // Undo this transaction only, and leave the rest of the group
+        savePoint->rollback();
+        savePoint->save();
+        savePoint.reset();
+        db->endGroupTransaction( affectedObjects, false );
+    }
     // rollback helper transaction by deleting it.
     transaction.reset();
     //db->rollback( this );
 }
 
 Database::Object Transaction::getObject( int accessDomain, long long id, bool includeDeleted ) const {
-    return db->getObject( connection.get() , accessDomain, id, includeDeleted );
+    // Make the changes done so far in this transaction visible
+    db->updateObjectHeads( version, connection );
+    return db->getObject( connection , accessDomain, id, includeDeleted );
 }
 
 Database::QueryResult Transaction::query( int accessDomain, long long id, const std::string& select,
             const std::string& filter, const std::string& sort,
             const std::map<std::string, Database::Value>& args,
             int maxVersion, bool includeDeleted ) {
-    return db->query( connection.get(), accessDomain, id, select, filter, sort, args, maxVersion, includeDeleted );
+    // Make the changes done so far in this transaction visible
+    db->updateObjectHeads( version, connection );
+    return db->query( connection, accessDomain, id, select, filter, sort, args, maxVersion, includeDeleted );
+}
+
+void Transaction::mapQuery( std::function<void(const Database::Object&)> fn,
+            int accessDomain, long long id, const std::string& select,
+            const std::string& filter, const std::string& sort,
+            const std::map<std::string, Database::Value>& args,
+            int maxVersion, bool includeDeleted ) {
+    // Make the changes done so far in this transaction visible
+    db->updateObjectHeads( version, connection );
+    db->mapQuery( fn, connection, accessDomain, id, select, filter, sort, args, maxVersion, includeDeleted );
 }
 
 Database::QueryResult Transaction::queryVersion( int accessDomain, long long id, const std::string& select,
             const std::string& filter, const std::map<std::string, Database::Value>& args,
             bool includeDeleted ) {
-    return db->queryVersion( connection.get(), accessDomain, id, select, filter, args, includeDeleted );
+    return db->queryVersion( connection, accessDomain, id, select, filter, args, includeDeleted );
 }
 
 } /* namespace Mist */